@@ -32,6 +32,7 @@
 
 /* misc */
 static char *_lowercase(char *str);
+static int _header_slot(const char *name);
 
 /* for avl trees */
 static int _compare_vars(void *compare_arg, void *a, void *b);
@@ -50,6 +51,8 @@ void httpp_initialize(http_parser_t *parser, http_varlist_t *defaults)
     parser->uri = NULL;
     parser->vars = avl_tree_new(_compare_vars, NULL);
     parser->queryvars = avl_tree_new(_compare_vars, NULL);
+    parser->header_data = NULL;
+    memset(parser->headers, 0, sizeof(parser->headers));
 
     /* now insert the default variables */
     list = defaults;
@@ -89,7 +92,35 @@ static int split_headers(char *data, unsigned long len, char **line)
     return lines;
 }
 
-static void parse_headers(http_parser_t *parser, char **line, int lines)
+/* add a header which refers to the parsers copy of the request, rather
+** than duplicating the name and value
+*/
+static void add_header(http_parser_t *parser, char *name, char *value)
+{
+    http_var_t *var;
+    void *found;
+    int slot;
+
+    var = (http_var_t *)malloc(sizeof(http_var_t));
+    if (var == NULL) return;
+
+    var->name = name;
+    var->value = value;
+    var->in_place = 1;
+
+    /* repeated header, the last one wins */
+    if (avl_get_by_key(parser->vars, (void *)var, &found) == 0)
+        avl_delete(parser->vars, (void *)var, _free_vars);
+    avl_insert(parser->vars, (void *)var);
+    slot = _header_slot(name);
+    if (slot >= 0)
+        parser->headers[slot] = value;
+}
+
+/* the data is kept by the parser when the headers are added in place,
+** returns 0 if the caller still has to free it
+*/
+static int parse_headers(http_parser_t *parser, char *data, char **line, int lines)
 {
     int i,l;
     int whitespace, where, slen;
@@ -122,11 +153,15 @@ static void parse_headers(http_parser_t *parser, char **line, int lines)
         }
         
         if (name != NULL && value != NULL) {
-            httpp_setvar(parser, _lowercase(name), value);
+            if (parser->header_data == data)
+                add_header(parser, _lowercase(name), value);
+            else
+                httpp_setvar(parser, _lowercase(name), value);
             name = NULL; 
             value = NULL;
         }
     }
+    return parser->header_data == data;
 }
 
 int httpp_parse_response(http_parser_t *parser, const char *http_data, unsigned long len, const char *uri)
@@ -182,9 +217,10 @@ int httpp_parse_response(http_parser_t *parser, const char *http_data, unsigned
     httpp_setvar(parser, HTTPP_VAR_URI, uri);
     httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "NONE");
 
-    parse_headers(parser, line, lines);
-
-    free(data);
+    if (parser->header_data == NULL)
+        parser->header_data = data;
+    if (parse_headers(parser, data, line, lines) == 0)
+        free(data);
 
     return 1;
 }
@@ -424,9 +460,10 @@ int httpp_parse(http_parser_t *parser, const char *http_data, unsigned long len)
         return 0;
     }
 
-    parse_headers(parser, line, lines);
-
-    free(data);
+    if (parser->header_data == NULL)
+        parser->header_data = data;
+    if (parse_headers(parser, data, line, lines) == 0)
+        free(data);
 
     return 1;
 }
@@ -434,17 +471,22 @@ int httpp_parse(http_parser_t *parser, const char *http_data, unsigned long len)
 void httpp_deletevar(http_parser_t *parser, const char *name)
 {
     http_var_t var;
+    int slot;
 
     if (parser == NULL || name == NULL)
         return;
     var.name = (char*)name;
     var.value = NULL;
     avl_delete(parser->vars, (void *)&var, _free_vars);
+    slot = _header_slot(name);
+    if (slot >= 0)
+        parser->headers[slot] = NULL;
 }
 
 void httpp_setvar(http_parser_t *parser, const char *name, const char *value)
 {
     http_var_t *var;
+    int slot;
 
     if (name == NULL || value == NULL)
         return;
@@ -454,6 +496,7 @@ void httpp_setvar(http_parser_t *parser, const char *name, const char *value)
 
     var->name = strdup(name);
     var->value = strdup(value);
+    var->in_place = 0;
 
     if (httpp_getvar(parser, name) == NULL) {
         avl_insert(parser->vars, (void *)var);
@@ -461,6 +504,9 @@ void httpp_setvar(http_parser_t *parser, const char *name, const char *value)
         avl_delete(parser->vars, (void *)var, _free_vars);
         avl_insert(parser->vars, (void *)var);
     }
+    slot = _header_slot(var->name);
+    if (slot >= 0)
+        parser->headers[slot] = var->value;
 }
 
 const char *httpp_getvar(http_parser_t *parser, const char *name)
@@ -468,10 +514,15 @@ const char *httpp_getvar(http_parser_t *parser, const char *name)
     http_var_t var;
     http_var_t *found;
     void *fp;
+    int slot;
 
     if (parser == NULL || name == NULL)
         return NULL;
 
+    slot = _header_slot(name);
+    if (slot >= 0)
+        return parser->headers[slot];
+
     fp = &found;
     var.name = (char*)name;
     var.value = NULL;
@@ -494,6 +545,7 @@ void httpp_set_query_param(http_parser_t *parser, const char *name, const char *
 
     var->name = strdup(name);
     var->value = url_escape(value);
+    var->in_place = 0;
 
     if (httpp_get_query_param(parser, name) == NULL) {
         avl_insert(parser->queryvars, (void *)var);
@@ -528,6 +580,9 @@ void httpp_clear(http_parser_t *parser)
     avl_tree_free(parser->vars, _free_vars);
     avl_tree_free(parser->queryvars, _free_vars);
     parser->vars = NULL;
+    free(parser->header_data);
+    parser->header_data = NULL;
+    memset(parser->headers, 0, sizeof(parser->headers));
 }
 
 void httpp_destroy(http_parser_t *parser)
@@ -545,6 +600,34 @@ static char *_lowercase(char *str)
     return str;
 }
 
+/* map the commonly used header names to their fixed slot */
+static int _header_slot(const char *name)
+{
+    switch (name[0]) {
+    case 'h':
+        if (strcmp(name, "host") == 0)
+            return httpp_hdr_host;
+        break;
+    case 'a':
+        if (strcmp(name, "authorization") == 0)
+            return httpp_hdr_authorization;
+        break;
+    case 'r':
+        if (strcmp(name, "range") == 0)
+            return httpp_hdr_range;
+        break;
+    case 'i':
+        if (strcmp(name, "icy-metadata") == 0)
+            return httpp_hdr_icy_metadata;
+        break;
+    case 'u':
+        if (strcmp(name, "user-agent") == 0)
+            return httpp_hdr_user_agent;
+        break;
+    }
+    return -1;
+}
+
 static int _compare_vars(void *compare_arg, void *a, void *b)
 {
     http_var_t *vara, *varb;
@@ -561,10 +644,12 @@ static int _free_vars(void *key)
 
     var = (http_var_t *)key;
 
-    if (var->name)
-        free(var->name);
-    if (var->value)
-        free(var->value);
+    if (var->in_place == 0) {
+        if (var->name)
+            free(var->name);
+        if (var->value)
+            free(var->value);
+    }
     free(var);
 
     return 1;
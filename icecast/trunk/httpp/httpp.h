@@ -29,6 +29,8 @@ typedef enum httpp_request_type_tag {
 typedef struct http_var_tag {
     char *name;
     char *value;
+    /* set when name and value point into the parsers header copy */
+    int in_place;
 } http_var_t;
 
 typedef struct http_varlist_tag {
@@ -36,11 +38,22 @@ typedef struct http_varlist_tag {
     struct http_varlist_tag *next;
 } http_varlist_t;
 
+/* headers looked up on most requests, kept in fixed slots so that
+ * httpp_getvar can return them without walking the vars tree */
+typedef enum httpp_header_tag {
+    httpp_hdr_host, httpp_hdr_authorization, httpp_hdr_range,
+    httpp_hdr_icy_metadata, httpp_hdr_user_agent, httpp_hdr_count
+} httpp_header_e;
+
 typedef struct http_parser_tag {
     httpp_request_type_e req_type;
     char *uri;
     avl_tree *vars;
     avl_tree *queryvars;
+
+    /* single copy of the request, header lines are split in place */
+    char *header_data;
+    const char *headers[httpp_hdr_count];
 } http_parser_t;
 
 #ifdef _mangle
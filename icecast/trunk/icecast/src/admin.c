@@ -651,7 +651,7 @@ static void command_show_listeners(client_t *client, source_t *source,
 {
     xmlDocPtr doc;
     xmlNodePtr node, srcnode, listenernode;
-    avl_node *client_node;
+    unsigned int i;
     client_t *current;
     char buf[22];
     const char *userAgent = NULL;
@@ -667,11 +667,10 @@ static void command_show_listeners(client_t *client, source_t *source,
     snprintf (buf, sizeof(buf), "%lu", source->listeners);
     xmlNewChild(srcnode, NULL, XMLSTR("Listeners"), XMLSTR(buf));
 
-    avl_tree_rlock(source->client_tree);
+    client_list_rlock (source->client_list);
 
-    client_node = avl_get_first(source->client_tree);
-    while(client_node) {
-        current = (client_t *)client_node->key;
+    for (i = 0; i < client_list_count (source->client_list); i++) {
+        current = client_list_get (source->client_list, i);
         listenernode = xmlNewChild(srcnode, NULL, XMLSTR("listener"), NULL);
         xmlNewChild(listenernode, NULL, XMLSTR("IP"), XMLSTR(current->con->ip));
         userAgent = httpp_getvar(current->parser, "user-agent");
@@ -690,10 +689,9 @@ static void command_show_listeners(client_t *client, source_t *source,
         if (current->username) {
             xmlNewChild(listenernode, NULL, XMLSTR("username"), XMLSTR(current->username));
         }
-        client_node = avl_get_next(client_node);
     }
 
-    avl_tree_unlock(source->client_tree);
+    client_list_unlock (source->client_list);
     admin_send_response(doc, client, response, 
         LISTCLIENTS_TRANSFORMED_REQUEST);
     xmlFreeDoc(doc);
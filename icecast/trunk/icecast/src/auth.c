@@ -33,6 +33,7 @@
 #include "httpp/httpp.h"
 #include "fserve.h"
 #include "admin.h"
+#include "timers.h"
 
 #include "logging.h"
 #define CATMODULE "auth"
@@ -196,7 +197,7 @@ static void auth_new_listener (auth_t *auth, auth_client *auth_user)
 
     /* make sure there is still a client at this point, a slow backend request
      * can be avoided if client has disconnected */
-    if (is_listener_connected (client) == 0)
+    if (auth_user->request == NULL && is_listener_connected (client) == 0)
     {
         DEBUG0 ("listener is no longer connected");
         client->respcode = 400;
@@ -206,7 +207,11 @@ static void auth_new_listener (auth_t *auth, auth_client *auth_user)
     }
     if (auth->authenticate)
     {
-        if (auth->authenticate (auth_user) != AUTH_OK)
+        auth_result result = auth->authenticate (auth_user);
+
+        if (auth_user->pending)
+            return;
+        if (result != AUTH_OK)
         {
             auth_release (client->auth);
             client->auth = NULL;
@@ -229,7 +234,11 @@ static void auth_remove_listener (auth_t *auth, auth_client *auth_user)
     client_t *client = auth_user->client;
 
     if (client->auth->release_listener)
+    {
         client->auth->release_listener (auth_user);
+        if (auth_user->pending)
+            return;
+    }
     auth_release (client->auth);
     client->auth = NULL;
     /* client is going, so auth is not an issue at this point */
@@ -245,7 +254,11 @@ static void stream_auth_callback (auth_t *auth, auth_client *auth_user)
     client_t *client = auth_user->client;
 
     if (auth->stream_auth)
+    {
         auth->stream_auth (auth_user);
+        if (auth_user->pending)
+            return;
+    }
 
     auth_release (auth);
     client->auth = NULL;
@@ -262,7 +275,11 @@ static void stream_auth_callback (auth_t *auth, auth_client *auth_user)
 static void stream_start_callback (auth_t *auth, auth_client *auth_user)
 {
     if (auth->stream_start)
-        auth->stream_start (auth_user);
+    {
+        auth->stream_start (auth, auth_user);
+        if (auth_user->pending)
+            return;
+    }
     auth_release (auth);
 }
 
@@ -273,21 +290,51 @@ static void stream_start_callback (auth_t *auth, auth_client *auth_user)
 static void stream_end_callback (auth_t *auth, auth_client *auth_user)
 {
     if (auth->stream_end)
-        auth->stream_end (auth_user);
+    {
+        auth->stream_end (auth, auth_user);
+        if (auth_user->pending)
+            return;
+    }
     auth_release (auth);
 }
 
 
+/* run the processing for this client, unless the authenticator has left
+ * a request running for it the client is finished with afterwards.
+ * Returns non-zero if the request is still pending
+ */
+static int auth_process_client (auth_t *auth, auth_client *auth_user)
+{
+    auth_user->pending = 0;
+    if (auth_user->process)
+        auth_user->process (auth, auth_user);
+    else
+        ERROR0 ("client auth process not set");
+
+    if (auth_user->pending)
+        return 1;
+    auth_client_free (auth_user);
+    return 0;
+}
+
+
+void auth_complete_client (auth_t *auth, auth_client *auth_user)
+{
+    auth_process_client (auth, auth_user);
+}
+
+
 /* The auth thread main loop. */
 static void *auth_run_thread (void *arg)
 {
     auth_t *auth = arg;
+    int in_progress = 0;
 
     INFO0 ("Authentication thread started");
     while (auth->running)
     {
         /* usually no clients are waiting, so don't bother taking locks */
-        if (auth->head)
+        if (auth->head && in_progress < auth->max_requests)
         {
             auth_client *auth_user;
 
@@ -307,13 +354,16 @@ static void *auth_run_thread (void *arg)
             thread_mutex_unlock (&auth->lock);
             auth_user->next = NULL;
 
-            if (auth_user->process)
-                auth_user->process (auth, auth_user);
-            else
-                ERROR0 ("client auth process not set");
-
-            auth_client_free (auth_user);
-
+            if (auth_process_client (auth, auth_user))
+                in_progress++;
+            else if (auth->poll == NULL || in_progress == 0)
+                continue;
+        }
+        if (auth->poll)
+        {
+            /* don't wait if more clients could be started */
+            int wait = (auth->head && in_progress < auth->max_requests) ? 0 : 150;
+            in_progress = auth->poll (auth, wait);
             continue;
         }
         thread_sleep (150000);
@@ -323,6 +373,28 @@ static void *auth_run_thread (void *arg)
 }
 
 
+/* is there a client logged in with this username on the list */
+static int client_list_has_user (client_list_t *list, const char *username)
+{
+    unsigned int i;
+    int found = 0;
+
+    client_list_rlock (list);
+    for (i = 0; i < client_list_count (list); i++)
+    {
+        client_t *existing_client = client_list_get (list, i);
+        if (existing_client->username &&
+                strcmp (existing_client->username, username) == 0)
+        {
+            found = 1;
+            break;
+        }
+    }
+    client_list_unlock (list);
+    return found;
+}
+
+
 /* Check whether this client is currently on this mount, the client may be
  * on either the active or pending lists.
  * return 1 if ok to add or 0 to prevent
@@ -335,37 +407,10 @@ static int check_duplicate_logins (source_t *source, client_t *client, auth_t *a
 
     if (auth && auth->allow_duplicate_users == 0)
     {
-        avl_node *node;
-
-        avl_tree_rlock (source->client_tree);
-        node = avl_get_first (source->client_tree);
-        while (node)
-        {   
-            client_t *existing_client = (client_t *)node->key;
-            if (existing_client->username && 
-                    strcmp (existing_client->username, client->username) == 0)
-            {
-                avl_tree_unlock (source->client_tree);
-                return 0;
-            }
-            node = avl_get_next (node);
-        }       
-        avl_tree_unlock (source->client_tree);
-
-        avl_tree_rlock (source->pending_tree);
-        node = avl_get_first (source->pending_tree);
-        while (node)
-        {
-            client_t *existing_client = (client_t *)node->key;
-            if (existing_client->username && 
-                    strcmp (existing_client->username, client->username) == 0)
-            {
-                avl_tree_unlock (source->pending_tree);
-                return 0;
-            }
-            node = avl_get_next (node);
-        }
-        avl_tree_unlock (source->pending_tree);
+        if (client_list_has_user (source->client_list, client->username))
+            return 0;
+        if (client_list_has_user (source->pending_list, client->username))
+            return 0;
     }
     return 1;
 }
@@ -411,9 +456,13 @@ static int add_listener_to_source (source_t *source, client_t *client)
     memset (client->refbuf->data, 0, PER_CLIENT_REFBUF_SIZE);
 
     /* lets add the client to the active list */
-    avl_tree_wlock (source->pending_tree);
-    avl_insert (source->pending_tree, client);
-    avl_tree_unlock (source->pending_tree);
+    client_list_wlock (source->pending_list);
+    if (client_list_add (source->pending_list, client) < 0)
+    {
+        client_list_unlock (source->pending_list);
+        return -1;
+    }
+    client_list_unlock (source->pending_list);
 
     if (source->running == 0 && source->on_demand)
     {
@@ -464,6 +513,15 @@ static int add_authenticated_listener (const char *mount, mount_proxy *mountinfo
             if (mountinfo->max_listener_duration && client->con->discon_time == 0)
                 client->con->discon_time = time(NULL) + mountinfo->max_listener_duration;
         }
+        if (client->con->discon_time)
+        {
+            time_t now = time (NULL);
+            unsigned int remaining = 0;
+
+            if (client->con->discon_time > now)
+                remaining = (unsigned int)(client->con->discon_time - now);
+            timers_add (&client->con->timer, remaining * 1000);
+        }
 
         ret = add_listener_to_source (source, client);
         avl_tree_unlock (global.source_tree);
@@ -683,6 +741,8 @@ auth_t *auth_get_authenticator (xmlNodePtr node)
         thread_mutex_create (&auth->lock);
         auth->refcount = 1;
         auth->running = 1;
+        if (auth->max_requests < 1)
+            auth->max_requests = 1;
         auth->thread = thread_create ("auth thread", auth_run_thread, auth, THREAD_ATTACHED);
     }
 
@@ -43,6 +43,12 @@ typedef struct auth_client_tag
     char        *mount;
     client_t    *client;
     void        (*process)(struct auth_tag *auth, struct auth_client_tag *auth_user);
+
+    /* set by an authenticator which has the request running in the
+     * background, process is called again once it completes */
+    int         pending;
+    void        *request;
+
     struct auth_client_tag *next;
 } auth_client;
 
@@ -59,14 +65,20 @@ typedef struct auth_tag
     void (*stream_auth)(auth_client *auth_user);
 
     /* auth handler for source startup, no client passed as it may disappear */
-    void (*stream_start)(auth_client *auth_user);
+    void (*stream_start)(struct auth_tag *auth, auth_client *auth_user);
 
     /* auth handler for source exit, no client passed as it may disappear */
-    void (*stream_end)(auth_client *auth_user);
+    void (*stream_end)(struct auth_tag *auth, auth_client *auth_user);
 
     /* auth state-specific free call */
     void (*free)(struct auth_tag *self);
 
+    /* for authenticators which run requests in the background. Waits up to
+     * wait_ms for requests to progress and returns how many are still in
+     * progress, more clients are only started while below max_requests */
+    int (*poll)(struct auth_tag *auth, int wait_ms);
+    int max_requests;
+
     auth_result (*adduser)(struct auth_tag *auth, const char *username, const char *password);
     auth_result (*deleteuser)(struct auth_tag *auth, const char *username);
     auth_result (*listuser)(struct auth_tag *auth, xmlNodePtr srcnode);
@@ -108,6 +120,10 @@ int auth_stream_authenticate (client_t *client, const char *mount, struct _mount
  * and requires adding to source or fserve. */
 int auth_postprocess_listener (auth_client *auth_user);
 
+/* called from the poll routine of the authenticator when a pending
+ * request has completed */
+void auth_complete_client (auth_t *auth, auth_client *auth_user);
+
 #endif
 
 
@@ -56,6 +56,13 @@
  * As admin requests can come in for a stream (eg metadata update) these requests
  * can be issued while stream is active. For these &admin=1 is added to the POST
  * details.
+ *
+ * The requests are run in the background on a curl multi handle, so up to
+ * max_requests can be in progress at once, each one is abandoned after
+ * timeout seconds. Connections to the auth server are kept open between
+ * requests. The listener_add responses can also be cached, for cache_ttl
+ * seconds when accepted and cache_negative_ttl seconds when rejected, keyed
+ * on the mount (with query args), username and password.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -66,8 +73,11 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <time.h>
 #ifndef _WIN32
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/select.h>
 #include <strings.h>
 #else
 #define snprintf _snprintf
@@ -81,11 +91,44 @@
 #include "client.h"
 #include "cfgfile.h"
 #include "httpp/httpp.h"
+#include "avl/avl.h"
 
 #include "logging.h"
 #define CATMODULE "auth_url"
 
-typedef struct {
+/* a listener_add response kept for reuse */
+typedef struct url_cache_entry_tag
+{
+    char *key;
+    int authenticated;
+    time_t discon_time; /* end of the time granted, 0 if unlimited */
+    time_t expires;
+    int in_tree;
+    struct url_cache_entry_tag *next;
+} url_cache_entry;
+
+/* a request to the auth server, the curl handle is kept with it when the
+ * request is finished so connections can be reused */
+typedef struct url_request_tag
+{
+    CURL *handle;
+    struct auth_url_tag *url;
+    auth_client *auth_user;
+    char *userpwd;
+    char *cache_key;
+    const char *target;
+
+    /* from the response */
+    CURLcode result;
+    int authenticated;
+    int timelimit;
+    char errormsg [CURL_ERROR_SIZE];
+
+    char post [4096];
+    struct url_request_tag *next;
+} url_request;
+
+typedef struct auth_url_tag {
     char *pass_headers; // headers passed from client to addurl.
     char *prefix_headers; // prefix for passed headers.
     char *addurl;
@@ -100,19 +143,56 @@ typedef struct {
     char *timelimit_header;
     int  timelimit_header_len;
     char *userpwd;
-    CURL *handle;
-    char errormsg [CURL_ERROR_SIZE];
+    int  timeout;
+
+    /* only used from the auth thread */
+    CURLM *multi;
+    int requests;
+    url_request *idle;
+    int idle_count, max_idle;
+
+    int cache_ttl;
+    int cache_negative_ttl;
+    avl_tree *cache;
+    url_cache_entry *cache_head [2], **cache_tail [2];
 } auth_url;
 
 
+static void url_cache_free (url_cache_entry *entry)
+{
+    free (entry->key);
+    free (entry);
+}
+
+
 static void auth_url_clear(auth_t *self)
 {
     auth_url *url;
+    int i;
 
     INFO0 ("Doing auth URL cleanup");
     url = self->state;
     self->state = NULL;
-    curl_easy_cleanup (url->handle);
+    while (url->idle)
+    {
+        url_request *req = url->idle;
+        url->idle = req->next;
+        curl_easy_cleanup (req->handle);
+        free (req);
+    }
+    if (url->multi)
+        curl_multi_cleanup (url->multi);
+    for (i = 0; i < 2; i++)
+    {
+        while (url->cache_head [i])
+        {
+            url_cache_entry *entry = url->cache_head [i];
+            url->cache_head [i] = entry->next;
+            url_cache_free (entry);
+        }
+    }
+    if (url->cache)
+        avl_tree_free (url->cache, NULL);
     free (url->username);
     free (url->password);
     free (url->pass_headers);
@@ -121,6 +201,7 @@ static void auth_url_clear(auth_t *self)
     free (url->addurl);
     free (url->stream_start);
     free (url->stream_end);
+    free (url->stream_auth);
     free (url->auth_header);
     free (url->timelimit_header);
     free (url->userpwd);
@@ -140,32 +221,27 @@ static int my_getpass(void *client, char *prompt, char *buffer, int buflen)
 
 static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void *stream)
 {
-    auth_client *auth_user = stream;
+    url_request *req = stream;
+    auth_url *url = req->url;
     unsigned bytes = size * nmemb;
-    client_t *client = auth_user->client;
 
-    if (client)
+    if (strncasecmp (ptr, url->auth_header, url->auth_header_len) == 0)
+        req->authenticated = 1;
+    if (strncasecmp (ptr, url->timelimit_header, url->timelimit_header_len) == 0)
     {
-        auth_t *auth = client->auth;
-        auth_url *url = auth->state;
-        if (strncasecmp (ptr, url->auth_header, url->auth_header_len) == 0)
-            client->authenticated = 1;
-        if (strncasecmp (ptr, url->timelimit_header, url->timelimit_header_len) == 0)
-        {
-            unsigned int limit = 0;
-            sscanf ((char *)ptr+url->timelimit_header_len, "%u\r\n", &limit);
-            client->con->discon_time = time(NULL) + limit;
-        }
-        if (strncasecmp (ptr, "icecast-auth-message: ", 22) == 0)
-        {
-            char *eol;
-            snprintf (url->errormsg, sizeof (url->errormsg), "%s", (char*)ptr+22);
-            eol = strchr (url->errormsg, '\r');
-            if (eol == NULL)
-                eol = strchr (url->errormsg, '\n');
-            if (eol)
-                *eol = '\0';
-        }
+        unsigned int limit = 0;
+        sscanf ((char *)ptr+url->timelimit_header_len, "%u\r\n", &limit);
+        req->timelimit = (int)limit;
+    }
+    if (strncasecmp (ptr, "icecast-auth-message: ", 22) == 0)
+    {
+        char *eol;
+        snprintf (req->errormsg, sizeof (req->errormsg), "%s", (char*)ptr+22);
+        eol = strchr (req->errormsg, '\r');
+        if (eol == NULL)
+            eol = strchr (req->errormsg, '\n');
+        if (eol)
+            *eol = '\0';
     }
 
     return (int)bytes;
@@ -178,6 +254,313 @@ static size_t handle_returned_data (void *ptr, size_t size, size_t nmemb, void *
 }
 
 
+static int compare_cache_entry (void *arg, void *a, void *b)
+{
+    url_cache_entry *e1 = a, *e2 = b;
+
+    return strcmp (e1->key, e2->key);
+}
+
+
+static char *url_cache_key (auth_url *url, const char *mount, client_t *client)
+{
+    char *key;
+    size_t len;
+
+    if (url->cache == NULL)
+        return NULL;
+    len = strlen (mount) + 3;
+    if (client->username) len += strlen (client->username);
+    if (client->password) len += strlen (client->password);
+    key = malloc (len);
+    if (key)
+        snprintf (key, len, "%s\n%s\n%s", mount,
+                client->username ? client->username : "",
+                client->password ? client->password : "");
+    return key;
+}
+
+
+static url_cache_entry *url_cache_find (auth_url *url, char *key)
+{
+    url_cache_entry find, *entry;
+
+    if (url->cache == NULL || key == NULL)
+        return NULL;
+    find.key = key;
+    if (avl_get_by_key (url->cache, &find, (void**)&entry) < 0)
+        return NULL;
+    if (entry->expires <= time (NULL))
+        return NULL;
+    return entry;
+}
+
+
+/* remember the response, each result has its own ttl so both lists are
+ * kept in order of expiry */
+static void url_cache_add (auth_url *url, char *key, int authenticated, int timelimit)
+{
+    url_cache_entry find, *entry;
+    int ttl = authenticated ? url->cache_ttl : url->cache_negative_ttl;
+    int i = authenticated ? 0 : 1;
+
+    if (url->cache == NULL || key == NULL || ttl <= 0)
+        return;
+    entry = calloc (1, sizeof (url_cache_entry));
+    if (entry == NULL)
+        return;
+
+    find.key = key;
+    if (avl_get_by_key (url->cache, &find, (void**)&find.next) == 0)
+    {
+        /* replaced, the old one is freed when it reaches the list head */
+        find.next->in_tree = 0;
+        avl_delete (url->cache, find.next, NULL);
+    }
+    entry->key = strdup (key);
+    entry->authenticated = authenticated;
+    /* a listener reconnecting from the cache only gets what is left */
+    if (timelimit >= 0)
+        entry->discon_time = time (NULL) + timelimit;
+    entry->expires = time (NULL) + ttl;
+    entry->in_tree = 1;
+    avl_insert (url->cache, entry);
+    *url->cache_tail [i] = entry;
+    url->cache_tail [i] = &entry->next;
+}
+
+
+static void url_cache_expire (auth_url *url)
+{
+    time_t now;
+    int i;
+
+    if (url->cache == NULL)
+        return;
+    now = time (NULL);
+    for (i = 0; i < 2; i++)
+    {
+        while (url->cache_head [i] && url->cache_head [i]->expires <= now)
+        {
+            url_cache_entry *entry = url->cache_head [i];
+
+            url->cache_head [i] = entry->next;
+            if (url->cache_head [i] == NULL)
+                url->cache_tail [i] = &url->cache_head [i];
+            if (entry->in_tree)
+                avl_delete (url->cache, entry, NULL);
+            url_cache_free (entry);
+        }
+    }
+}
+
+
+/* take an idle request, or create a new one */
+static url_request *url_request_get (auth_url *url, auth_client *auth_user)
+{
+    url_request *req = url->idle;
+
+    if (req)
+    {
+        url->idle = req->next;
+        url->idle_count--;
+    }
+    else
+    {
+        req = calloc (1, sizeof (url_request));
+        if (req == NULL)
+            return NULL;
+        req->handle = curl_easy_init ();
+        if (req->handle == NULL)
+        {
+            free (req);
+            return NULL;
+        }
+        req->url = url;
+        curl_easy_setopt (req->handle, CURLOPT_USERAGENT, ICECAST_VERSION_STRING);
+        curl_easy_setopt (req->handle, CURLOPT_HEADERFUNCTION, handle_returned_header);
+        curl_easy_setopt (req->handle, CURLOPT_WRITEHEADER, req);
+        curl_easy_setopt (req->handle, CURLOPT_WRITEFUNCTION, handle_returned_data);
+        curl_easy_setopt (req->handle, CURLOPT_WRITEDATA, req->handle);
+        curl_easy_setopt (req->handle, CURLOPT_PRIVATE, req);
+        curl_easy_setopt (req->handle, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt (req->handle, CURLOPT_TIMEOUT, (long)url->timeout);
+#ifdef CURLOPT_PASSWDFUNCTION
+        curl_easy_setopt (req->handle, CURLOPT_PASSWDFUNCTION, my_getpass);
+#endif
+        curl_easy_setopt (req->handle, CURLOPT_ERRORBUFFER, &req->errormsg[0]);
+    }
+    req->next = NULL;
+    req->auth_user = auth_user;
+    req->result = CURLE_OK;
+    req->authenticated = 0;
+    req->timelimit = -1;
+    req->errormsg[0] = '\0';
+    return req;
+}
+
+
+/* finished with the request, keep the handle for later requests */
+static void url_request_put (auth_url *url, url_request *req)
+{
+    free (req->userpwd);
+    req->userpwd = NULL;
+    free (req->cache_key);
+    req->cache_key = NULL;
+    req->auth_user = NULL;
+    if (url->idle_count >= url->max_idle)
+    {
+        curl_easy_cleanup (req->handle);
+        free (req);
+        return;
+    }
+    req->next = url->idle;
+    url->idle = req;
+    url->idle_count++;
+}
+
+
+/* set the credentials for the request, unless they are in the url. For
+ * listener requests the client user/pass is used if none are configured */
+static void url_request_userpwd (auth_url *url, url_request *req, const char *target, client_t *client)
+{
+    if (strchr (target, '@') == NULL)
+    {
+        if (url->userpwd)
+        {
+            curl_easy_setopt (req->handle, CURLOPT_USERPWD, url->userpwd);
+            return;
+        }
+        /* auth'd requests may not have a user/pass, but may use query args */
+        if (client && client->username && client->password)
+        {
+            size_t len = strlen (client->username) + strlen (client->password) + 2;
+            req->userpwd = malloc (len);
+            snprintf (req->userpwd, len, "%s:%s", client->username, client->password);
+            curl_easy_setopt (req->handle, CURLOPT_USERPWD, req->userpwd);
+            return;
+        }
+    }
+    /* url has user/pass but libcurl may need to clear any existing settings */
+    curl_easy_setopt (req->handle, CURLOPT_USERPWD, "");
+}
+
+
+/* start the request running in the background, returns 1 if it is pending
+ * or 0 if it has completed already */
+static int url_request_start (auth_url *url, url_request *req, const char *target)
+{
+    auth_client *auth_user = req->auth_user;
+
+    req->target = target;
+    curl_easy_setopt (req->handle, CURLOPT_URL, target);
+    curl_easy_setopt (req->handle, CURLOPT_POSTFIELDS, req->post);
+    auth_user->request = req;
+
+    if (url->multi && curl_multi_add_handle (url->multi, req->handle) == CURLM_OK)
+    {
+        auth_user->pending = 1;
+        url->requests++;
+        return 1;
+    }
+    /* could not run it in the background so wait for it here */
+    req->result = curl_easy_perform (req->handle);
+    return 0;
+}
+
+
+/* take the completed request from the client */
+static url_request *url_request_done (auth_client *auth_user)
+{
+    url_request *req = auth_user->request;
+
+    auth_user->request = NULL;
+    return req;
+}
+
+
+/* wait up to wait_ms for activity on the requests in progress */
+static void url_wait (auth_url *url, int wait_ms)
+{
+#if LIBCURL_VERSION_NUM >= 0x071c00
+    /* not limited to descriptors below FD_SETSIZE, unlike select */
+    curl_multi_wait (url->multi, NULL, 0, wait_ms, NULL);
+#else
+    fd_set rfds, wfds, efds;
+    int maxfd = -1;
+
+    FD_ZERO (&rfds);
+    FD_ZERO (&wfds);
+    FD_ZERO (&efds);
+#if LIBCURL_VERSION_NUM >= 0x070f04
+    {
+        long timeout = -1;
+
+        curl_multi_timeout (url->multi, &timeout);
+        if (timeout >= 0 && timeout < wait_ms)
+            wait_ms = (int)timeout;
+    }
+#endif
+    if (wait_ms <= 0)
+        return;
+    curl_multi_fdset (url->multi, &rfds, &wfds, &efds, &maxfd);
+    if (maxfd < 0)
+    {
+        /* no sockets yet, eg still resolving */
+        thread_sleep ((wait_ms < 20 ? wait_ms : 20) * 1000);
+    }
+    else
+    {
+        struct timeval tv;
+
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+        select (maxfd+1, &rfds, &wfds, &efds, &tv);
+    }
+#endif
+}
+
+
+/* called from the auth thread to progress the requests, clients whose
+ * request has completed are passed back to be processed again */
+static int url_poll (auth_t *auth, int wait_ms)
+{
+    auth_url *url = auth->state;
+    CURLMsg *msg;
+    int running, msgs;
+
+    url_cache_expire (url);
+    if (url->requests == 0)
+    {
+        if (wait_ms > 0)
+            thread_sleep (wait_ms * 1000);
+        return 0;
+    }
+    url_wait (url, wait_ms);
+    while (curl_multi_perform (url->multi, &running) == CURLM_CALL_MULTI_PERFORM)
+        ;
+    while ((msg = curl_multi_info_read (url->multi, &msgs)))
+    {
+        CURL *handle = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        char *ptr = NULL;
+        url_request *req;
+
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        curl_easy_getinfo (handle, CURLINFO_PRIVATE, &ptr);
+        curl_multi_remove_handle (url->multi, handle);
+        url->requests--;
+        req = (url_request *)ptr;
+        if (req == NULL)
+            continue;
+        req->result = result;
+        auth_complete_client (auth, req->auth_user);
+    }
+    return url->requests;
+}
+
+
 static auth_result url_remove_listener (auth_client *auth_user)
 {
     client_t *client = auth_user->client;
@@ -188,84 +571,66 @@ static auth_result url_remove_listener (auth_client *auth_user)
     const char *mountreq;
     ice_config_t *config;
     int port;
-    char *userpwd = NULL, post [4096];
     const char *agent;
     char *user_agent, *ipaddr;
+    url_request *req = auth_user->request;
 
-    if (url->removeurl == NULL)
-        return AUTH_OK;
-
-    config = config_get_config ();
-    server = util_url_escape (config->hostname);
-    port = config->port;
-    config_release_config ();
+    if (req == NULL)
+    {
+        if (url->removeurl == NULL)
+            return AUTH_OK;
+        req = url_request_get (url, auth_user);
+        if (req == NULL)
+            return AUTH_FAILED;
+
+        config = config_get_config ();
+        server = util_url_escape (config->hostname);
+        port = config->port;
+        config_release_config ();
 
-    agent = httpp_getvar (client->parser, "user-agent");
-    if (agent)
-        user_agent = util_url_escape (agent);
-    else
-        user_agent = strdup ("-");
+        agent = httpp_getvar (client->parser, "user-agent");
+        if (agent)
+            user_agent = util_url_escape (agent);
+        else
+            user_agent = strdup ("-");
 
-    if (client->username)
-        username = util_url_escape (client->username);
-    else
-        username = strdup ("");
+        if (client->username)
+            username = util_url_escape (client->username);
+        else
+            username = strdup ("");
 
-    if (client->password)
-        password = util_url_escape (client->password);
-    else
-        password = strdup ("");
-
-    /* get the full uri (with query params if available) */
-    mountreq = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
-    if (mountreq == NULL)
-        mountreq = httpp_getvar (client->parser, HTTPP_VAR_URI);
-    mount = util_url_escape (mountreq);
-    ipaddr = util_url_escape (client->con->ip);
-
-    snprintf (post, sizeof (post),
-            "action=listener_remove&server=%s&port=%d&client=%lu&mount=%s"
-            "&user=%s&pass=%s&duration=%lu&ip=%s&agent=%s",
-            server, port, client->con->id, mount, username,
-            password, (long unsigned)duration, ipaddr, user_agent);
-    free (server);
-    free (mount);
-    free (username);
-    free (password);
-    free (ipaddr);
-    free (user_agent);
-
-    if (strchr (url->removeurl, '@') == NULL)
-    {
-        if (url->userpwd)
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, url->userpwd);
+        if (client->password)
+            password = util_url_escape (client->password);
         else
-        {
-            /* auth'd requests may not have a user/pass, but may use query args */
-            if (client->username && client->password)
-            {
-                size_t len = strlen (client->username) + strlen (client->password) + 2;
-                userpwd = malloc (len);
-                snprintf (userpwd, len, "%s:%s", client->username, client->password);
-                curl_easy_setopt (url->handle, CURLOPT_USERPWD, userpwd);
-            }
-            else
-                curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-        }
-    }
-    else
-    {
-        /* url has user/pass but libcurl may need to clear any existing settings */
-        curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
+            password = strdup ("");
+
+        /* get the full uri (with query params if available) */
+        mountreq = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
+        if (mountreq == NULL)
+            mountreq = httpp_getvar (client->parser, HTTPP_VAR_URI);
+        mount = util_url_escape (mountreq);
+        ipaddr = util_url_escape (client->con->ip);
+
+        snprintf (req->post, sizeof (req->post),
+                "action=listener_remove&server=%s&port=%d&client=%lu&mount=%s"
+                "&user=%s&pass=%s&duration=%lu&ip=%s&agent=%s",
+                server, port, client->con->id, mount, username,
+                password, (long unsigned)duration, ipaddr, user_agent);
+        free (server);
+        free (mount);
+        free (username);
+        free (password);
+        free (ipaddr);
+        free (user_agent);
+
+        url_request_userpwd (url, req, url->removeurl, client);
+        if (url_request_start (url, req, url->removeurl))
+            return AUTH_UNDEFINED;
     }
-    curl_easy_setopt (url->handle, CURLOPT_URL, url->removeurl);
-    curl_easy_setopt (url->handle, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (url->handle, CURLOPT_WRITEHEADER, auth_user);
-
-    if (curl_easy_perform (url->handle))
-        WARN2 ("auth to server %s failed with %s", url->removeurl, url->errormsg);
-
-    free (userpwd);
+    req = url_request_done (auth_user);
+    if (req->result)
+        WARN2 ("auth to server %s failed with %s", url->removeurl, req->errormsg);
+    url_request_put (url, req);
 
     return AUTH_OK;
 }
@@ -276,241 +641,208 @@ static auth_result url_add_listener (auth_client *auth_user)
     client_t *client = auth_user->client;
     auth_t *auth = client->auth;
     auth_url *url = auth->state;
-    int res = 0, port;
+    int port;
     const char *agent;
     char *user_agent, *username, *password;
     const char *mountreq;
     char *mount, *ipaddr, *server;
     ice_config_t *config;
-    char *userpwd = NULL, post [4096];
     ssize_t post_offset;
     char *pass_headers, *cur_header, *next_header;
     const char *header_val;
     char *header_valesc;
+    url_request *req = auth_user->request;
 
-    if (url->addurl == NULL)
-        return AUTH_OK;
-
-    config = config_get_config ();
-    server = util_url_escape (config->hostname);
-    port = config->port;
-    config_release_config ();
-
-    agent = httpp_getvar (client->parser, "user-agent");
-    if (agent)
-        user_agent = util_url_escape (agent);
-    else
-        user_agent = strdup ("-");
-
-    if (client->username)
-        username = util_url_escape (client->username);
-    else
-        username = strdup ("");
-
-    if (client->password)
-        password = util_url_escape (client->password);
-    else
-        password = strdup ("");
-
-    /* get the full uri (with query params if available) */
-    mountreq = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
-    if (mountreq == NULL)
-        mountreq = httpp_getvar (client->parser, HTTPP_VAR_URI);
-    mount = util_url_escape (mountreq);
-    ipaddr = util_url_escape (client->con->ip);
-
-    post_offset = snprintf (post, sizeof (post),
-            "action=listener_add&server=%s&port=%d&client=%lu&mount=%s"
-            "&user=%s&pass=%s&ip=%s&agent=%s",
-            server, port, client->con->id, mount, username,
-            password, ipaddr, user_agent);
-    free (server);
-    free (mount);
-    free (user_agent);
-    free (username);
-    free (password);
-    free (ipaddr);
-
-    pass_headers = NULL;
-    if (url->pass_headers)
-        pass_headers = strdup (url->pass_headers);
-    if (pass_headers)
+    if (req == NULL)
     {
-        cur_header = pass_headers;
-        while (cur_header)
+        url_cache_entry *cached;
+        char *key;
+
+        if (url->addurl == NULL)
+            return AUTH_OK;
+
+        /* get the full uri (with query params if available) */
+        mountreq = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
+        if (mountreq == NULL)
+            mountreq = httpp_getvar (client->parser, HTTPP_VAR_URI);
+
+        key = url_cache_key (url, mountreq, client);
+        cached = url_cache_find (url, key);
+        /* the time granted has run out, so ask again */
+        if (cached && cached->authenticated && cached->discon_time &&
+                cached->discon_time <= time (NULL))
+            cached = NULL;
+        if (cached)
         {
-	    next_header = strstr (cur_header, ",");
-	    if (next_header)
-	    {
-		*next_header=0;
-                next_header++;
-	    }
-
-            header_val = httpp_getvar (client->parser, cur_header);
-            if (header_val)
+            free (key);
+            if (cached->discon_time)
+                client->con->discon_time = cached->discon_time;
+            if (cached->authenticated)
             {
-                header_valesc = util_url_escape (header_val);
-                post_offset += snprintf (post+post_offset, sizeof (post)-post_offset, "&%s%s=%s",
-                                         url->prefix_headers ? url->prefix_headers : "",
-                                         cur_header, header_valesc);
-                free (header_valesc);
+                DEBUG1 ("client %lu accepted from cache", client->con->id);
+                client->authenticated = 1;
+                return AUTH_OK;
             }
-
-	    cur_header = next_header;
+            INFO1 ("client %lu rejected from cache", client->con->id);
+            return AUTH_FAILED;
         }
-    }
+        req = url_request_get (url, auth_user);
+        if (req == NULL)
+        {
+            free (key);
+            return AUTH_FAILED;
+        }
+        req->cache_key = key;
 
-    if (strchr (url->addurl, '@') == NULL)
-    {
-        if (url->userpwd)
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, url->userpwd);
+        config = config_get_config ();
+        server = util_url_escape (config->hostname);
+        port = config->port;
+        config_release_config ();
+
+        agent = httpp_getvar (client->parser, "user-agent");
+        if (agent)
+            user_agent = util_url_escape (agent);
+        else
+            user_agent = strdup ("-");
+
+        if (client->username)
+            username = util_url_escape (client->username);
         else
+            username = strdup ("");
+
+        if (client->password)
+            password = util_url_escape (client->password);
+        else
+            password = strdup ("");
+
+        mount = util_url_escape (mountreq);
+        ipaddr = util_url_escape (client->con->ip);
+
+        post_offset = snprintf (req->post, sizeof (req->post),
+                "action=listener_add&server=%s&port=%d&client=%lu&mount=%s"
+                "&user=%s&pass=%s&ip=%s&agent=%s",
+                server, port, client->con->id, mount, username,
+                password, ipaddr, user_agent);
+        free (server);
+        free (mount);
+        free (user_agent);
+        free (username);
+        free (password);
+        free (ipaddr);
+
+        pass_headers = NULL;
+        if (url->pass_headers)
+            pass_headers = strdup (url->pass_headers);
+        if (pass_headers)
         {
-            /* auth'd requests may not have a user/pass, but may use query args */
-            if (client->username && client->password)
+            cur_header = pass_headers;
+            while (cur_header)
             {
-                size_t len = strlen (client->username) + strlen (client->password) + 2;
-                userpwd = malloc (len);
-                snprintf (userpwd, len, "%s:%s", client->username, client->password);
-                curl_easy_setopt (url->handle, CURLOPT_USERPWD, userpwd);
+                next_header = strstr (cur_header, ",");
+                if (next_header)
+                {
+                    *next_header=0;
+                    next_header++;
+                }
+
+                header_val = httpp_getvar (client->parser, cur_header);
+                if (header_val)
+                {
+                    header_valesc = util_url_escape (header_val);
+                    post_offset += snprintf (req->post+post_offset, sizeof (req->post)-post_offset, "&%s%s=%s",
+                                             url->prefix_headers ? url->prefix_headers : "",
+                                             cur_header, header_valesc);
+                    free (header_valesc);
+                }
+
+                cur_header = next_header;
             }
-            else
-                curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
+            free (pass_headers);
         }
-    }
-    else
-    {
-        /* url has user/pass but libcurl may need to clear any existing settings */
-        curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    }
-    curl_easy_setopt (url->handle, CURLOPT_URL, url->addurl);
-    curl_easy_setopt (url->handle, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (url->handle, CURLOPT_WRITEHEADER, auth_user);
-    url->errormsg[0] = '\0';
-
-    res = curl_easy_perform (url->handle);
 
-    free (userpwd);
+        url_request_userpwd (url, req, url->addurl, client);
+        if (url_request_start (url, req, url->addurl))
+            return AUTH_UNDEFINED;
+    }
+    req = url_request_done (auth_user);
 
-    if (res)
+    if (req->result)
     {
-        WARN2 ("auth to server %s failed with %s", url->addurl, url->errormsg);
+        WARN2 ("auth to server %s failed with %s", url->addurl, req->errormsg);
+        url_request_put (url, req);
         return AUTH_FAILED;
     }
     /* we received a response, lets see what it is */
-    if (client->authenticated)
+    url_cache_add (url, req->cache_key, req->authenticated, req->timelimit);
+    if (req->timelimit >= 0)
+        client->con->discon_time = time(NULL) + req->timelimit;
+    if (req->authenticated)
+    {
+        client->authenticated = 1;
+        url_request_put (url, req);
         return AUTH_OK;
-    INFO2 ("client auth (%s) failed with \"%s\"", url->addurl, url->errormsg);
+    }
+    INFO2 ("client auth (%s) failed with \"%s\"", url->addurl, req->errormsg);
+    url_request_put (url, req);
     return AUTH_FAILED;
 }
 
 
-/* called by auth thread when a source starts, there is no client_t in
- * this case
- */
-static void url_stream_start (auth_client *auth_user)
+/* send a mount_add or mount_remove request for the stream. There is no
+ * client_t in this case.  The queued auth_client holds a reference on auth
+ * until the request completes */
+static void url_stream_notify (auth_t *auth, auth_client *auth_user, const char *action, int start)
 {
-    char *mount, *server;
-    ice_config_t *config = config_get_config ();
-    mount_proxy *mountinfo = config_find_mount (config, auth_user->mount, MOUNT_TYPE_NORMAL);
-    auth_t *auth = mountinfo->auth;
     auth_url *url = auth->state;
-    char *stream_start_url;
-    int port;
-    char post [4096];
+    url_request *req = auth_user->request;
 
-    if (url->stream_start == NULL)
+    if (req == NULL)
     {
+        char *mount, *server, *target;
+        ice_config_t *config;
+        int port;
+
+        target = start ? url->stream_start : url->stream_end;
+        if (target == NULL)
+            return;
+        req = url_request_get (url, auth_user);
+        if (req == NULL)
+            return;
+        config = config_get_config ();
+        server = util_url_escape (config->hostname);
+        port = config->port;
         config_release_config ();
-        return;
-    }
-    server = util_url_escape (config->hostname);
-    port = config->port;
-    stream_start_url = strdup (url->stream_start);
-    /* we don't want this auth disappearing from under us while
-     * the connection is in progress */
-    mountinfo->auth->refcount++;
-    config_release_config ();
-    mount = util_url_escape (auth_user->mount);
-
-    snprintf (post, sizeof (post),
-            "action=mount_add&mount=%s&server=%s&port=%d", mount, server, port);
-    free (server);
-    free (mount);
-
-    if (strchr (url->stream_start, '@') == NULL)
-    {
-        if (url->userpwd)
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, url->userpwd);
-        else
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    }
-    else
-        curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    curl_easy_setopt (url->handle, CURLOPT_URL, stream_start_url);
-    curl_easy_setopt (url->handle, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (url->handle, CURLOPT_WRITEHEADER, auth_user);
+        mount = util_url_escape (auth_user->mount);
 
-    if (curl_easy_perform (url->handle))
-        WARN2 ("auth to server %s failed with %s", stream_start_url, url->errormsg);
+        snprintf (req->post, sizeof (req->post),
+                "action=%s&mount=%s&server=%s&port=%d", action, mount, server, port);
+        free (server);
+        free (mount);
 
-    auth_release (auth);
-    free (stream_start_url);
-    return;
+        url_request_userpwd (url, req, target, NULL);
+        if (url_request_start (url, req, target))
+            return;
+    }
+    req = url_request_done (auth_user);
+    if (req->result)
+        WARN2 ("auth to server %s failed with %s", req->target, req->errormsg);
+    url_request_put (url, req);
 }
 
 
-static void url_stream_end (auth_client *auth_user)
+/* called by auth thread when a source starts */
+static void url_stream_start (auth_t *auth, auth_client *auth_user)
 {
-    char *mount, *server;
-    ice_config_t *config = config_get_config ();
-    mount_proxy *mountinfo = config_find_mount (config, auth_user->mount, MOUNT_TYPE_NORMAL);
-    auth_t *auth = mountinfo->auth;
-    auth_url *url = auth->state;
-    char *stream_end_url;
-    int port;
-    char post [4096];
-
-    if (url->stream_end == NULL)
-    {
-        config_release_config ();
-        return;
-    }
-    server = util_url_escape (config->hostname);
-    port = config->port;
-    stream_end_url = strdup (url->stream_end);
-    /* we don't want this auth disappearing from under us while
-     * the connection is in progress */
-    mountinfo->auth->refcount++;
-    config_release_config ();
-    mount = util_url_escape (auth_user->mount);
-
-    snprintf (post, sizeof (post),
-            "action=mount_remove&mount=%s&server=%s&port=%d", mount, server, port);
-    free (server);
-    free (mount);
-
-    if (strchr (url->stream_end, '@') == NULL)
-    {
-        if (url->userpwd)
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, url->userpwd);
-        else
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    }
-    else
-        curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    curl_easy_setopt (url->handle, CURLOPT_URL, url->stream_end);
-    curl_easy_setopt (url->handle, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (url->handle, CURLOPT_WRITEHEADER, auth_user);
+    url_stream_notify (auth, auth_user, "mount_add", 1);
+}
 
-    if (curl_easy_perform (url->handle))
-        WARN2 ("auth to server %s failed with %s", stream_end_url, url->errormsg);
 
-    auth_release (auth);
-    free (stream_end_url);
-    return;
+static void url_stream_end (auth_t *auth, auth_client *auth_user)
+{
+    url_stream_notify (auth, auth_user, "mount_remove", 0);
 }
 
+
 static void url_stream_auth (auth_client *auth_user)
 {
     ice_config_t *config;
@@ -518,43 +850,47 @@ static void url_stream_auth (auth_client *auth_user)
     client_t *client = auth_user->client;
     auth_url *url = client->auth->state;
     char *mount, *host, *user, *pass, *ipaddr, *admin="";
-    char post [4096];
+    url_request *req = auth_user->request;
 
-    if (strchr (url->stream_auth, '@') == NULL)
+    if (req == NULL)
     {
-        if (url->userpwd)
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, url->userpwd);
-        else
-            curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
+        req = url_request_get (url, auth_user);
+        if (req == NULL)
+        {
+            client->authenticated = 0;
+            return;
+        }
+        if (strcmp (auth_user->mount, httpp_getvar (client->parser, HTTPP_VAR_URI)) != 0)
+            admin = "&admin=1";
+        mount = util_url_escape (auth_user->mount);
+        config = config_get_config ();
+        host = util_url_escape (config->hostname);
+        port = config->port;
+        config_release_config ();
+        user = util_url_escape (client->username);
+        pass = util_url_escape (client->password);
+        ipaddr = util_url_escape (client->con->ip);
+
+        snprintf (req->post, sizeof (req->post),
+                "action=stream_auth&mount=%s&ip=%s&server=%s&port=%d&user=%s&pass=%s%s",
+                mount, ipaddr, host, port, user, pass, admin);
+        free (ipaddr);
+        free (user);
+        free (pass);
+        free (mount);
+        free (host);
+
+        client->authenticated = 0;
+        url_request_userpwd (url, req, url->stream_auth, NULL);
+        if (url_request_start (url, req, url->stream_auth))
+            return;
     }
-    else
-        curl_easy_setopt (url->handle, CURLOPT_USERPWD, "");
-    curl_easy_setopt (url->handle, CURLOPT_URL, url->stream_auth);
-    curl_easy_setopt (url->handle, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (url->handle, CURLOPT_WRITEHEADER, auth_user);
-    if (strcmp (auth_user->mount, httpp_getvar (client->parser, HTTPP_VAR_URI)) != 0)
-        admin = "&admin=1";
-    mount = util_url_escape (auth_user->mount);
-    config = config_get_config ();
-    host = util_url_escape (config->hostname);
-    port = config->port;
-    config_release_config ();
-    user = util_url_escape (client->username);
-    pass = util_url_escape (client->password);
-    ipaddr = util_url_escape (client->con->ip);
-
-    snprintf (post, sizeof (post),
-            "action=stream_auth&mount=%s&ip=%s&server=%s&port=%d&user=%s&pass=%s%s",
-            mount, ipaddr, host, port, user, pass, admin);
-    free (ipaddr);
-    free (user);
-    free (pass);
-    free (mount);
-    free (host);
-
-    client->authenticated = 0;
-    if (curl_easy_perform (url->handle))
-        WARN2 ("auth to server %s failed with %s", url->stream_auth, url->errormsg);
+    req = url_request_done (auth_user);
+    if (req->result)
+        WARN2 ("auth to server %s failed with %s", url->stream_auth, req->errormsg);
+    else if (req->authenticated)
+        client->authenticated = 1;
+    url_request_put (url, req);
 }
 
 
@@ -588,6 +924,8 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
     /* default headers */
     url_info->auth_header = strdup ("icecast-auth-user: 1\r\n");
     url_info->timelimit_header = strdup ("icecast-auth-timelimit:");
+    url_info->timeout = 15;
+    authenticator->max_requests = 10;
 
     /* force auth thread to call function. this makes sure the auth_t is attached to client */
     authenticator->authenticate = url_add_listener;
@@ -652,30 +990,44 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
             free (url_info->timelimit_header);
             url_info->timelimit_header = strdup (options->value);
         }
+        if (strcmp(options->name, "timeout") == 0)
+            url_info->timeout = atoi (options->value);
+        if (strcmp(options->name, "max_requests") == 0)
+            authenticator->max_requests = atoi (options->value);
+        if (strcmp(options->name, "cache_ttl") == 0)
+            url_info->cache_ttl = atoi (options->value);
+        if (strcmp(options->name, "cache_negative_ttl") == 0)
+            url_info->cache_negative_ttl = atoi (options->value);
         options = options->next;
     }
-    url_info->handle = curl_easy_init ();
-    if (url_info->handle == NULL)
+    if (url_info->timeout < 1)
+        url_info->timeout = 15;
+    if (authenticator->max_requests < 1)
+        authenticator->max_requests = 1;
+    url_info->max_idle = authenticator->max_requests;
+
+    url_info->multi = curl_multi_init ();
+    if (url_info->multi == NULL)
     {
         auth_url_clear (authenticator);
         return -1;
     }
+#if LIBCURL_VERSION_NUM >= 0x071003
+    curl_multi_setopt (url_info->multi, CURLMOPT_MAXCONNECTS, (long)authenticator->max_requests);
+#endif
+    authenticator->poll = url_poll;
+
+    if (url_info->cache_ttl > 0 || url_info->cache_negative_ttl > 0)
+    {
+        url_info->cache = avl_tree_new (compare_cache_entry, NULL);
+        url_info->cache_tail [0] = &url_info->cache_head [0];
+        url_info->cache_tail [1] = &url_info->cache_head [1];
+    }
     if (url_info->auth_header)
         url_info->auth_header_len = strlen (url_info->auth_header);
     if (url_info->timelimit_header)
         url_info->timelimit_header_len = strlen (url_info->timelimit_header);
 
-    curl_easy_setopt (url_info->handle, CURLOPT_USERAGENT, ICECAST_VERSION_STRING);
-    curl_easy_setopt (url_info->handle, CURLOPT_HEADERFUNCTION, handle_returned_header);
-    curl_easy_setopt (url_info->handle, CURLOPT_WRITEFUNCTION, handle_returned_data);
-    curl_easy_setopt (url_info->handle, CURLOPT_WRITEDATA, url_info->handle);
-    curl_easy_setopt (url_info->handle, CURLOPT_NOSIGNAL, 1L);
-    curl_easy_setopt (url_info->handle, CURLOPT_TIMEOUT, 15L);
-#ifdef CURLOPT_PASSWDFUNCTION
-    curl_easy_setopt (url_info->handle, CURLOPT_PASSWDFUNCTION, my_getpass);
-#endif
-    curl_easy_setopt (url_info->handle, CURLOPT_ERRORBUFFER, &url_info->errormsg[0]);
-
     if (url_info->username && url_info->password)
     {
         int len = strlen (url_info->username) + strlen (url_info->password) + 2;
@@ -683,7 +1035,7 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
         snprintf (url_info->userpwd, len, "%s:%s", url_info->username, url_info->password);
     }
 
-    INFO0("URL based authentication setup");
+    INFO2 ("URL based authentication setup, %d requests at once, %ds timeout",
+            authenticator->max_requests, url_info->timeout);
     return 0;
 }
-
@@ -39,7 +39,9 @@
 #define CONFIG_DEFAULT_SOURCE_LIMIT 16
 #define CONFIG_DEFAULT_QUEUE_SIZE_LIMIT (500*1024)
 #define CONFIG_DEFAULT_BURST_SIZE (64*1024)
-#define CONFIG_DEFAULT_THREADPOOL_SIZE 4
+#define CONFIG_DEFAULT_THREADPOOL_SIZE 0
+#define CONFIG_DEFAULT_ACCEPT_THREADS 1
+#define CONFIG_DEFAULT_DISPATCH_THREADS 2
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT 30
 #define CONFIG_DEFAULT_HEADER_TIMEOUT 15
 #define CONFIG_DEFAULT_SOURCE_TIMEOUT 10
@@ -75,8 +77,28 @@
 #define MIMETYPESFILE ".\\mime.types"
 #endif
 
-static ice_config_t _current_configuration;
+/* a published config, retired when the last reference is dropped and
+ * then freed by the reload thread */
+typedef struct config_snapshot_tag
+{
+    ice_config_t config;
+    unsigned long refcount;
+    struct config_snapshot_tag *next;
+} config_snapshot_t;
+
+/* per thread record of the snapshot in use */
+typedef struct config_reader_tag
+{
+    config_snapshot_t *snapshot;
+    unsigned int depth;
+    int reloading;
+} config_reader_t;
+
+static config_snapshot_t *_current_configuration;
+/* snapshots no longer referenced, waiting for config_free_retired */
+static config_snapshot_t *_retired_configurations;
 static ice_config_locks _locks;
+static thread_key_t _config_reader_key;
 
 static void _set_defaults(ice_config_t *c);
 static void _parse_root(xmlDocPtr doc, xmlNodePtr node, ice_config_t *c);
@@ -95,25 +117,69 @@ static void _add_server(xmlDocPtr doc, xmlNodePtr node, ice_config_t *c);
 
 static void merge_mounts(mount_proxy * dst, mount_proxy * src);
 static inline void _merge_mounts_all(ice_config_t *c);
+static struct mount_index_tag *_build_mount_index (mount_proxy *mounts);
+static void _free_mount_index (struct mount_index_tag *index);
 
 static void create_locks(void) {
     thread_mutex_create(&_locks.relay_lock);
-    thread_rwlock_create(&_locks.config_lock);
+    thread_mutex_create(&_locks.reload_lock);
+    thread_spin_create(&_locks.snapshot_lock);
 }
 
 static void release_locks(void) {
     thread_mutex_destroy(&_locks.relay_lock);
-    thread_rwlock_destroy(&_locks.config_lock);
+    thread_mutex_destroy(&_locks.reload_lock);
+    thread_spin_destroy(&_locks.snapshot_lock);
 }
 
 void config_initialize(void) {
     create_locks();
+    thread_key_create(&_config_reader_key, free);
+    _current_configuration = calloc(1, sizeof(config_snapshot_t));
+    _current_configuration->refcount = 1;
+}
+
+/* the last reader may be any thread, and clearing a config can join auth
+ * threads, so an unreferenced snapshot is only queued here */
+static void _release_snapshot(config_snapshot_t *snapshot)
+{
+    thread_spin_lock(&_locks.snapshot_lock);
+    if (--snapshot->refcount == 0)
+    {
+        snapshot->next = _retired_configurations;
+        _retired_configurations = snapshot;
+    }
+    thread_spin_unlock(&_locks.snapshot_lock);
+}
+
+/* free the snapshots no reader refers to any more, called periodically
+ * from the thread doing the reloads */
+void config_free_retired(void)
+{
+    config_snapshot_t *snapshot;
+
+    thread_spin_lock(&_locks.snapshot_lock);
+    snapshot = _retired_configurations;
+    _retired_configurations = NULL;
+    thread_spin_unlock(&_locks.snapshot_lock);
+
+    while (snapshot)
+    {
+        config_snapshot_t *next = snapshot->next;
+
+        config_clear(&snapshot->config);
+        free(snapshot);
+        snapshot = next;
+    }
 }
 
 void config_shutdown(void) {
-    config_get_config();
-    config_clear(&_current_configuration);
-    config_release_config();
+    _release_snapshot(_current_configuration);
+    _current_configuration = NULL;
+    config_free_retired();
+    /* other threads have already exited and freed their records */
+    free(thread_key_get(&_config_reader_key));
+    thread_key_destroy(&_config_reader_key);
     release_locks();
 }
 
@@ -131,6 +197,7 @@ static void config_clear_mount (mount_proxy *mount)
     if (mount->username)        xmlFree (mount->username);
     if (mount->password)        xmlFree (mount->password);
     if (mount->dumpfile)        xmlFree (mount->dumpfile);
+    if (mount->timeshift_file)  xmlFree (mount->timeshift_file);
     if (mount->intro_filename)  xmlFree (mount->intro_filename);
     if (mount->on_connect)      xmlFree (mount->on_connect);
     if (mount->on_disconnect)   xmlFree (mount->on_disconnect);
@@ -230,6 +297,7 @@ void config_clear(ice_config_t *c)
     }
     thread_mutex_unlock(&(_locks.relay_lock));
 
+    _free_mount_index (c->mount_index);
     mount = c->mounts;
     while(mount) {
         nextmount = mount->next;
@@ -269,7 +337,7 @@ void config_clear(ice_config_t *c)
 int config_initial_parse_file(const char *filename)
 {
     /* Since we're already pointing at it, we don't need to copy it in place */
-    return config_parse_file(filename, &_current_configuration);
+    return config_parse_file(filename, &_current_configuration->config);
 }
 
 int config_parse_file(const char *filename, ice_config_t *configuration)
@@ -304,6 +372,7 @@ int config_parse_file(const char *filename, ice_config_t *configuration)
     xmlFreeDoc(doc);
 
     _merge_mounts_all(configuration);
+    configuration->mount_index = _build_mount_index (configuration->mounts);
 
     return 0;
 }
@@ -318,31 +387,96 @@ ice_config_locks *config_locks(void)
     return &_locks;
 }
 
+static config_reader_t *_config_reader(void)
+{
+    config_reader_t *reader = thread_key_get(&_config_reader_key);
+
+    if (reader == NULL)
+    {
+        reader = calloc(1, sizeof(config_reader_t));
+        if (reader == NULL)
+            abort();
+        thread_key_set(&_config_reader_key, reader);
+    }
+    return reader;
+}
+
 void config_release_config(void)
 {
-    thread_rwlock_unlock(&(_locks.config_lock));
+    config_reader_t *reader = _config_reader();
+    config_snapshot_t *snapshot;
+
+    if (reader->depth == 0 || --reader->depth > 0)
+        return;
+    snapshot = reader->snapshot;
+    reader->snapshot = NULL;
+    if (reader->reloading)
+    {
+        reader->reloading = 0;
+        thread_mutex_unlock(&_locks.reload_lock);
+    }
+    _release_snapshot(snapshot);
 }
 
 ice_config_t *config_get_config(void)
 {
-    thread_rwlock_rlock(&(_locks.config_lock));
-    return &_current_configuration;
+    config_reader_t *reader = _config_reader();
+
+    if (reader->depth++ == 0)
+    {
+        thread_spin_lock(&_locks.snapshot_lock);
+        reader->snapshot = _current_configuration;
+        reader->snapshot->refcount++;
+        thread_spin_unlock(&_locks.snapshot_lock);
+    }
+    return &reader->snapshot->config;
 }
 
+/* as config_get_config, but also stops any other reload until released */
 ice_config_t *config_grab_config(void)
 {
-    thread_rwlock_wlock(&(_locks.config_lock));
-    return &_current_configuration;
+    config_reader_t *reader = _config_reader();
+
+    if (reader->reloading == 0)
+    {
+        thread_mutex_lock(&_locks.reload_lock);
+        reader->reloading = 1;
+    }
+    return config_get_config();
 }
 
-/* MUST be called with the lock held! */
+/* publish a new config, MUST be called between config_grab_config and
+ * config_release_config. The contents of config are taken over and the
+ * caller's reference moves to the new snapshot.
+ */
 void config_set_config(ice_config_t *config) {
-    memcpy(&_current_configuration, config, sizeof(ice_config_t));
+    config_reader_t *reader = _config_reader();
+    config_snapshot_t *snapshot = calloc(1, sizeof(config_snapshot_t));
+    config_snapshot_t *old;
+
+    if (snapshot == NULL)
+        abort();
+    memcpy(&snapshot->config, config, sizeof(ice_config_t));
+    /* one for being current and one for the caller */
+    snapshot->refcount = 2;
+
+    thread_spin_lock(&_locks.snapshot_lock);
+    old = _current_configuration;
+    _current_configuration = snapshot;
+    thread_spin_unlock(&_locks.snapshot_lock);
+
+    _release_snapshot(old);
+    _release_snapshot(reader->snapshot);
+    reader->snapshot = snapshot;
 }
 
 ice_config_t *config_get_config_unlocked(void)
 {
-    return &_current_configuration;
+    config_reader_t *reader = thread_key_get(&_config_reader_key);
+
+    if (reader && reader->snapshot)
+        return &reader->snapshot->config;
+    return &_current_configuration->config;
 }
 
 static void _set_defaults(ice_config_t *configuration)
@@ -354,6 +488,8 @@ static void _set_defaults(ice_config_t *configuration)
     configuration->source_limit = CONFIG_DEFAULT_SOURCE_LIMIT;
     configuration->queue_size_limit = CONFIG_DEFAULT_QUEUE_SIZE_LIMIT;
     configuration->threadpool_size = CONFIG_DEFAULT_THREADPOOL_SIZE;
+    configuration->accept_threads = CONFIG_DEFAULT_ACCEPT_THREADS;
+    configuration->dispatch_threads = CONFIG_DEFAULT_DISPATCH_THREADS;
     configuration->client_timeout = CONFIG_DEFAULT_CLIENT_TIMEOUT;
     configuration->header_timeout = CONFIG_DEFAULT_HEADER_TIMEOUT;
     configuration->source_timeout = CONFIG_DEFAULT_SOURCE_TIMEOUT;
@@ -518,10 +654,25 @@ static void _parse_limits(xmlDocPtr doc, xmlNodePtr node,
             tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             configuration->queue_size_limit = atoi(tmp);
             if (tmp) xmlFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("queue-memory-limit")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (tmp)
+            {
+                configuration->queue_memory_limit = strtoull (tmp, NULL, 10);
+                xmlFree(tmp);
+            }
         } else if (xmlStrcmp (node->name, XMLSTR("threadpool")) == 0) {
             tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             configuration->threadpool_size = atoi(tmp);
             if (tmp) xmlFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("accept-threads")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            configuration->accept_threads = atoi(tmp);
+            if (tmp) xmlFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("dispatch-threads")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            configuration->dispatch_threads = atoi(tmp);
+            if (tmp) xmlFree(tmp);
         } else if (xmlStrcmp (node->name, XMLSTR("client-timeout")) == 0) {
             tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             configuration->client_timeout = atoi(tmp);
@@ -559,6 +710,7 @@ static void _parse_mount(xmlDocPtr doc, xmlNodePtr node,
     mount->mounttype = MOUNT_TYPE_NORMAL;
     mount->max_listeners = -1;
     mount->burst_size = -1;
+    mount->skip_interval = -1;
     mount->mp3_meta_interval = -1;
     mount->yp_public = -1;
     mount->next = NULL;
@@ -600,6 +752,15 @@ static void _parse_mount(xmlDocPtr doc, xmlNodePtr node,
             mount->dumpfile = (char *)xmlNodeListGetString(
                     doc, node->xmlChildrenNode, 1);
         }
+        else if (xmlStrcmp (node->name, XMLSTR("timeshift-file")) == 0) {
+            mount->timeshift_file = (char *)xmlNodeListGetString(
+                    doc, node->xmlChildrenNode, 1);
+        }
+        else if (xmlStrcmp (node->name, XMLSTR("timeshift-size")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            mount->timeshift_size = atoi (tmp);
+            if(tmp) xmlFree(tmp);
+        }
         else if (xmlStrcmp (node->name, XMLSTR("intro")) == 0) {
             mount->intro_filename = (char *)xmlNodeListGetString(
                     doc, node->xmlChildrenNode, 1);
@@ -668,6 +829,16 @@ static void _parse_mount(xmlDocPtr doc, xmlNodePtr node,
             mount->queue_size_limit = atoi (tmp);
             if(tmp) xmlFree(tmp);
         }
+        else if (xmlStrcmp (node->name, XMLSTR("slow-listener-skip")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            mount->skip_slow_listeners = atoi (tmp);
+            if(tmp) xmlFree(tmp);
+        }
+        else if (xmlStrcmp (node->name, XMLSTR("slow-listener-skip-interval")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            mount->skip_interval = atoi (tmp);
+            if(tmp) xmlFree(tmp);
+        }
         else if (xmlStrcmp (node->name, XMLSTR("source-timeout")) == 0) {
             tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             if (tmp)
@@ -955,6 +1126,11 @@ static void _parse_directory(xmlDocPtr doc, xmlNodePtr node,
             configuration->yp_touch_interval[configuration->num_yp_directories] =
                 atoi(tmp);
             if (tmp) xmlFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("yp-max-requests")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            configuration->yp_max_requests[configuration->num_yp_directories] =
+                atoi(tmp);
+            if (tmp) xmlFree(tmp);
         }
     } while ((node = node->next));
     if (configuration->yp_url [configuration->num_yp_directories] == NULL)
@@ -1165,6 +1341,10 @@ static void merge_mounts(mount_proxy * dst, mount_proxy * src) {
     	dst->password = (char*)xmlStrdup((xmlChar*)src->password);
     if (!dst->dumpfile)
     	dst->dumpfile = (char*)xmlStrdup((xmlChar*)src->dumpfile);
+    if (!dst->timeshift_file)
+    	dst->timeshift_file = (char*)xmlStrdup((xmlChar*)src->timeshift_file);
+    if (!dst->timeshift_size)
+    	dst->timeshift_size = src->timeshift_size;
     if (!dst->intro_filename)
     	dst->intro_filename = (char*)xmlStrdup((xmlChar*)src->intro_filename);
     if (!dst->fallback_when_full)
@@ -1181,6 +1361,10 @@ static void merge_mounts(mount_proxy * dst, mount_proxy * src) {
     	dst->burst_size = src->burst_size;
     if (!dst->queue_size_limit)
     	dst->queue_size_limit = src->queue_size_limit;
+    if (!dst->skip_slow_listeners)
+    	dst->skip_slow_listeners = src->skip_slow_listeners;
+    if (dst->skip_interval == -1)
+    	dst->skip_interval = src->skip_interval;
     if (!dst->hidden)
     	dst->hidden = src->hidden;
     if (!dst->source_timeout)
@@ -1234,11 +1418,183 @@ static inline void _merge_mounts_all(ice_config_t *c) {
     }
 }
 
+/* The mount list is compiled into an index per mount type. Names without
+ * wildcards go into a hash table, the rest stay in list order and only those
+ * before any exact match need checking, which keeps the first match in the
+ * list as the result.
+ */
+typedef struct mount_index_entry_tag
+{
+    mount_proxy *mount;
+    unsigned int pos;
+    /* characters before the first wildcard, which must match exactly */
+    unsigned int prefix_len;
+    struct mount_index_entry_tag *next;
+} mount_index_entry_t;
+
+typedef struct
+{
+    /* returned when no mount name is asked for */
+    mount_proxy *first;
+    mount_index_entry_t **hash;
+    unsigned int hash_size;
+    mount_index_entry_t *wildcards, **wildcards_tail;
+} mount_type_index_t;
+
+struct mount_index_tag
+{
+    mount_type_index_t types [2];
+    mount_index_entry_t *entries;
+};
+
+
+static unsigned int _mount_hash (const char *name)
+{
+    unsigned int hash = 5381;
+
+    while (*name)
+        hash = hash * 33 + (unsigned char)*name++;
+    return hash;
+}
+
+
+static struct mount_index_tag *_build_mount_index (mount_proxy *mounts)
+{
+    struct mount_index_tag *index;
+    mount_proxy *mountinfo;
+    unsigned int count = 0, pos = 0, i;
+
+    for (mountinfo = mounts; mountinfo; mountinfo = mountinfo->next)
+        count++;
+    index = calloc (1, sizeof (struct mount_index_tag));
+    if (index == NULL)
+        return NULL;
+    index->entries = calloc (count + 1, sizeof (mount_index_entry_t));
+    for (i = 0; i < 2; i++)
+    {
+        mount_type_index_t *type_index = &index->types [i];
+
+        type_index->hash_size = 16;
+        while (type_index->hash_size < count)
+            type_index->hash_size <<= 1;
+        type_index->hash = calloc (type_index->hash_size, sizeof (mount_index_entry_t *));
+        type_index->wildcards_tail = &type_index->wildcards;
+    }
+    if (index->entries == NULL || index->types [0].hash == NULL || index->types [1].hash == NULL)
+    {
+        /* lookups will walk the list instead */
+        _free_mount_index (index);
+        return NULL;
+    }
+
+    for (mountinfo = mounts; mountinfo; mountinfo = mountinfo->next, pos++)
+    {
+        mount_type_index_t *type_index;
+        mount_index_entry_t *entry = &index->entries [pos];
+        const char *name = mountinfo->mountname;
+
+        if (mountinfo->mounttype != MOUNT_TYPE_NORMAL && mountinfo->mounttype != MOUNT_TYPE_DEFAULT)
+            continue;
+        type_index = &index->types [mountinfo->mounttype];
+        if (type_index->first == NULL)
+            type_index->first = mountinfo;
+
+        entry->mount = mountinfo;
+        entry->pos = pos;
+#ifndef _WIN32
+        if (name)
+            entry->prefix_len = strcspn (name, "*?[\\");
+        if (name == NULL || name [entry->prefix_len])
+        {
+            *type_index->wildcards_tail = entry;
+            type_index->wildcards_tail = &entry->next;
+            continue;
+        }
+#else
+        if (name == NULL)
+        {
+            *type_index->wildcards_tail = entry;
+            type_index->wildcards_tail = &entry->next;
+            continue;
+        }
+#endif
+        {
+            mount_index_entry_t **trail;
+
+            i = _mount_hash (name) & (type_index->hash_size - 1);
+            for (trail = &type_index->hash [i]; *trail; trail = &(*trail)->next)
+            {
+                if (strcmp ((*trail)->mount->mountname, name) == 0)
+                    break;
+            }
+            /* a repeated name can never be the first match */
+            if (*trail == NULL)
+                *trail = entry;
+        }
+    }
+    return index;
+}
+
+
+static void _free_mount_index (struct mount_index_tag *index)
+{
+    if (index)
+    {
+        free (index->types [MOUNT_TYPE_NORMAL].hash);
+        free (index->types [MOUNT_TYPE_DEFAULT].hash);
+        free (index->entries);
+        free (index);
+    }
+}
+
+
+static mount_proxy *_find_indexed_mount (mount_type_index_t *type_index, const char *mount)
+{
+    mount_index_entry_t *entry, *found = NULL;
+
+    if (mount == NULL)
+        return type_index->first;
+
+    entry = type_index->hash [_mount_hash (mount) & (type_index->hash_size - 1)];
+    for (; entry; entry = entry->next)
+    {
+        if (strcmp (entry->mount->mountname, mount) == 0)
+        {
+            found = entry;
+            break;
+        }
+    }
+    for (entry = type_index->wildcards; entry; entry = entry->next)
+    {
+        if (found && entry->pos > found->pos)
+            break;
+        if (entry->mount->mountname == NULL)
+            return entry->mount;
+#ifndef _WIN32
+        if (strncmp (entry->mount->mountname, mount, entry->prefix_len) != 0)
+            continue;
+        if (fnmatch (entry->mount->mountname, mount, FNM_PATHNAME) == 0)
+            return entry->mount;
+#endif
+    }
+    return found ? found->mount : NULL;
+}
+
+
 /* return the mount details that match the supplied mountpoint */
 mount_proxy *config_find_mount (ice_config_t *config, const char *mount, mount_type type)
 {
     mount_proxy *mountinfo = config->mounts;
 
+    if (config->mount_index && (type == MOUNT_TYPE_NORMAL || type == MOUNT_TYPE_DEFAULT))
+    {
+        mountinfo = _find_indexed_mount (&config->mount_index->types [type], mount);
+        if (!mountinfo && type == MOUNT_TYPE_NORMAL)
+            mountinfo = _find_indexed_mount (&config->mount_index->types [MOUNT_TYPE_DEFAULT], mount);
+        return mountinfo;
+    }
+
+    /* until the index is built, walk the list */
     for (; mountinfo; mountinfo = mountinfo->next)
     {
         if (mountinfo->mounttype != type)
@@ -59,6 +59,8 @@ typedef struct _mount_proxy {
 
     char *dumpfile; /* Filename to dump this stream to (will be appended). NULL
                        to not dump. */
+    char *timeshift_file;   /* ring file for listeners starting in the past */
+    unsigned int timeshift_size;
     char *intro_filename;   /* Send contents of file to client before the stream */
     int fallback_when_full; /* switch new listener to fallback source
                                when max listeners reached */
@@ -73,6 +75,10 @@ typedef struct _mount_proxy {
     int burst_size; /* amount to send to a new client if possible, -1 take
                      * from global setting */
     unsigned int queue_size_limit;
+    int skip_slow_listeners; /* move listeners on at the queue limit rather
+                                than dropping them */
+    int skip_interval; /* drop listeners needing to skip again within this
+                          many seconds, -1 for the default */
     int hidden; /* Do we list this on the xsl pages */
     unsigned int source_timeout;  /* source timeout in seconds */
     char *charset;  /* character set if not utf8 */
@@ -126,7 +132,10 @@ typedef struct ice_config_tag
     int client_limit;
     int source_limit;
     unsigned int queue_size_limit;
+    uint64_t queue_memory_limit; /* total for all queues, 0 for no limit */
     int threadpool_size;
+    int accept_threads;
+    int dispatch_threads;
     unsigned int burst_size;
     int client_timeout;
     int header_timeout;
@@ -161,6 +170,8 @@ typedef struct ice_config_tag
     relay_server *relay;
 
     mount_proxy *mounts;
+    /* built from mounts for config_find_mount once parsed */
+    struct mount_index_tag *mount_index;
 
     char *server_id;
     char *base_dir;
@@ -188,11 +199,15 @@ typedef struct ice_config_tag
     char *yp_url[MAX_YP_DIRECTORIES];
     int    yp_url_timeout[MAX_YP_DIRECTORIES];
     int    yp_touch_interval[MAX_YP_DIRECTORIES];
+    int    yp_max_requests[MAX_YP_DIRECTORIES];
     int num_yp_directories;
 } ice_config_t;
 
 typedef struct {
-    rwlock_t config_lock;
+    /* serialises config reloads, readers never wait on it */
+    mutex_t reload_lock;
+    /* held only while taking a reference on the current config */
+    spin_t snapshot_lock;
     mutex_t relay_lock;
 } ice_config_locks;
 
@@ -212,11 +227,19 @@ int config_rehash(void);
 
 ice_config_locks *config_locks(void);
 
+/* The config is published as a read-only snapshot. config_get_config takes
+ * a reference on the current one, which is kept until the matching
+ * config_release_config. Nested calls on the same thread see the same
+ * snapshot. A reload swaps in a new snapshot and the old one is retired
+ * once the last reader releases it, to be freed by config_free_retired.
+ */
 ice_config_t *config_get_config(void);
 ice_config_t *config_grab_config(void);
 void config_release_config(void);
+void config_free_retired(void);
 
-/* To be used ONLY in one-time startup code */
+/* the snapshot already held by this thread, or the current one. To be used
+ * ONLY in one-time startup code or while a reference is held */
 ice_config_t *config_get_config_unlocked(void);
 
 #endif  /* __CFGFILE_H__ */
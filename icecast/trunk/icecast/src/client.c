@@ -34,6 +34,7 @@
 #include "format.h"
 #include "stats.h"
 #include "fserve.h"
+#include "timeshift.h"
 
 #include "client.h"
 #include "logging.h"
@@ -71,7 +72,7 @@ int client_create (client_t **c_ptr, connection_t *con, http_parser_t *parser)
 
     config_release_config ();
 
-    stats_event_args (NULL, "clients", "%d", global.clients);
+    stats_global_inc (STATS_CLIENTS);
     client->con = con;
     client->parser = parser;
     client->refbuf = refbuf_new (PER_CLIENT_REFBUF_SIZE);
@@ -95,6 +96,8 @@ void client_destroy(client_t *client)
         refbuf_release (client->refbuf);
         client->refbuf = NULL;
     }
+    timeshift_release (client->timeshift);
+    client->timeshift = NULL;
 
     if (auth_release_listener (client))
         return;
@@ -112,7 +115,7 @@ void client_destroy(client_t *client)
 
     global_lock ();
     global.clients--;
-    stats_event_args (NULL, "clients", "%d", global.clients);
+    stats_global_dec (STATS_CLIENTS);
     global_unlock ();
 
     /* we need to free client specific format data (if any) */
@@ -240,6 +243,17 @@ int client_send_bytes (client_t *client, const void *buf, unsigned len)
     return ret;
 }
 
+/* send several blocks in one go, returns the number of bytes written or -1 */
+int client_send_vector (client_t *client, const struct iovec *iov, size_t count)
+{
+    int ret = client->con->sendv (client->con, iov, count);
+
+    if (client->con->error)
+        DEBUG0 ("Client connection died");
+
+    return ret;
+}
+
 void client_set_queue (client_t *client, refbuf_t *refbuf)
 {
     refbuf_t *to_release = client->refbuf;
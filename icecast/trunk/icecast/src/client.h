@@ -45,6 +45,16 @@ typedef struct _client_tag
     /* position in first buffer */
     unsigned int pos;
 
+    /* slot in the source client list the client is on */
+    unsigned int list_pos;
+
+    /* when the client last skipped ahead in the queue */
+    time_t skip_time;
+
+    /* rewind buffer being read from, and the stream offset reached in it */
+    struct timeshift_tag *timeshift;
+    uint64_t timeshift_pos;
+
     /* auth used for this client */
     struct auth_tag *auth;
 
@@ -76,6 +86,7 @@ void client_send_401(client_t *client);
 void client_send_403(client_t *client, const char *message);
 void client_send_400(client_t *client, const char *message);
 int client_send_bytes (client_t *client, const void *buf, unsigned len);
+int client_send_vector (client_t *client, const struct iovec *iov, size_t count);
 int client_read_bytes (client_t *client, void *buf, unsigned len);
 void client_set_queue (client_t *client, refbuf_t *refbuf);
 int client_check_source_auth (client_t *client, const char *mount);
@@ -0,0 +1,194 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* clientlist.c
+ *
+ * Dense arrays of clients used for the listeners and pending listeners of
+ * a source.  Each client records its slot in the array, so adding and
+ * removing are constant time and walking the listeners is a linear scan
+ * instead of following tree nodes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread/thread.h"
+
+#include "client.h"
+#include "connection.h"
+#include "clientlist.h"
+#include "logging.h"
+
+#undef CATMODULE
+#define CATMODULE "clientlist"
+
+#define CLIENT_LIST_MIN_SIZE    16
+
+#define client_hash_id(id,size) ((unsigned int)((id) * 2654435761UL) & ((size) - 1))
+
+
+client_list_t *client_list_create (void)
+{
+    client_list_t *list = calloc (1, sizeof (client_list_t));
+
+    if (list)
+        thread_rwlock_create (&list->lock);
+    return list;
+}
+
+
+void client_list_free (client_list_t *list, int (*free_func)(void *))
+{
+    if (list == NULL)
+        return;
+    if (free_func)
+    {
+        while (list->count)
+        {
+            client_t *client = list->clients [list->count-1];
+            client_list_remove (list, client);
+            free_func (client);
+        }
+    }
+    thread_rwlock_destroy (&list->lock);
+    free (list->clients);
+    free (list->hash);
+    free (list);
+}
+
+
+static void hash_insert (client_t **hash, unsigned int size, client_t *client)
+{
+    unsigned int slot = client_hash_id (client->con->id, size);
+
+    while (hash [slot])
+        slot = (slot + 1) & (size - 1);
+    hash [slot] = client;
+}
+
+
+/* drop the entry and shift back any following entries in the same run that
+ * would otherwise become unreachable */
+static void hash_remove (client_list_t *list, client_t *client)
+{
+    unsigned int mask = list->hash_size - 1;
+    unsigned int slot = client_hash_id (client->con->id, list->hash_size);
+    unsigned int next;
+
+    while (list->hash [slot] != client)
+    {
+        if (list->hash [slot] == NULL)
+            return;
+        slot = (slot + 1) & mask;
+    }
+    list->hash [slot] = NULL;
+    next = (slot + 1) & mask;
+    while (list->hash [next])
+    {
+        client_t *entry = list->hash [next];
+        unsigned int home = client_hash_id (entry->con->id, list->hash_size);
+
+        /* move it back if its home slot is not in the range (slot, next] */
+        if ((next > slot && (home <= slot || home > next)) ||
+                (next < slot && (home <= slot && home > next)))
+        {
+            list->hash [slot] = entry;
+            list->hash [next] = NULL;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+
+static int client_list_grow (client_list_t *list)
+{
+    unsigned int size = list->size ? list->size * 2 : CLIENT_LIST_MIN_SIZE;
+    unsigned int hash_size = size * 2, i;
+    client_t **clients, **hash;
+
+    clients = realloc (list->clients, size * sizeof (client_t *));
+    if (clients == NULL)
+        return -1;
+    list->clients = clients;
+
+    hash = calloc (hash_size, sizeof (client_t *));
+    if (hash == NULL)
+        return -1;
+    for (i = 0; i < list->count; i++)
+        hash_insert (hash, hash_size, list->clients [i]);
+    free (list->hash);
+    list->hash = hash;
+    list->hash_size = hash_size;
+    list->size = size;
+    return 0;
+}
+
+
+int client_list_add (client_list_t *list, client_t *client)
+{
+    if (list->count == list->size && client_list_grow (list) < 0)
+    {
+        ERROR1 ("unable to add client %lu, out of memory", client->con->id);
+        return -1;
+    }
+    client->list_pos = list->count;
+    list->clients [list->count++] = client;
+    hash_insert (list->hash, list->hash_size, client);
+    return 0;
+}
+
+
+void client_list_remove (client_list_t *list, client_t *client)
+{
+    unsigned int pos = client->list_pos;
+
+    if (pos >= list->count || list->clients [pos] != client)
+        return;
+    hash_remove (list, client);
+    list->count--;
+    if (pos != list->count)
+    {
+        list->clients [pos] = list->clients [list->count];
+        list->clients [pos]->list_pos = pos;
+    }
+}
+
+
+/* forget all the clients on the list, they are not released */
+void client_list_clear (client_list_t *list)
+{
+    list->count = 0;
+    if (list->hash)
+        memset (list->hash, 0, list->hash_size * sizeof (client_t *));
+}
+
+
+client_t *client_list_find (client_list_t *list, unsigned long id)
+{
+    unsigned int slot;
+
+    if (list->hash_size == 0)
+        return NULL;
+    slot = client_hash_id (id, list->hash_size);
+    while (list->hash [slot])
+    {
+        if (list->hash [slot]->con->id == id)
+            return list->hash [slot];
+        slot = (slot + 1) & (list->hash_size - 1);
+    }
+    return NULL;
+}
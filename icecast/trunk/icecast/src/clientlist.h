@@ -0,0 +1,55 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __CLIENTLIST_H__
+#define __CLIENTLIST_H__
+
+#include "thread/thread.h"
+#include "client.h"
+
+/* An unordered set of clients kept in a dense array so the listeners on a
+ * source can be walked by index.  Removal swaps the last entry into the
+ * freed slot, so when removing while walking, walk from the end.  A hash
+ * on the connection id is kept alongside for lookups by id.
+ */
+typedef struct client_list_tag
+{
+    rwlock_t lock;
+
+    client_t **clients;
+    unsigned int count;
+    unsigned int size;
+
+    /* open addressed, connection id to client */
+    client_t **hash;
+    unsigned int hash_size;
+} client_list_t;
+
+#define client_list_rlock(x)    thread_rwlock_rlock(&(x)->lock)
+#define client_list_wlock(x)    thread_rwlock_wlock(&(x)->lock)
+#define client_list_unlock(x)   thread_rwlock_unlock(&(x)->lock)
+
+#define client_list_count(x)    ((x)->count)
+#define client_list_get(x,i)    ((x)->clients[(i)])
+
+client_list_t *client_list_create (void);
+void client_list_free (client_list_t *list, int (*free_func)(void *));
+
+/* these need the list write locked */
+int  client_list_add (client_list_t *list, client_t *client);
+void client_list_remove (client_list_t *list, client_t *client);
+void client_list_clear (client_list_t *list);
+
+/* needs at least a read lock on the list */
+client_t *client_list_find (client_list_t *list, unsigned long id);
+
+#endif  /* __CLIENTLIST_H__ */
@@ -46,6 +46,8 @@ void _dump_config(ice_config_t *config)
     printf("client_limit = %d\n", config->client_limit);
     printf("source_limit = %d\n", config->source_limit);
     printf("threadpool_size = %d\n", config->threadpool_size);
+    printf("accept_threads = %d\n", config->accept_threads);
+    printf("dispatch_threads = %d\n", config->dispatch_threads);
     printf("client_timeout = %d\n", config->client_timeout);
     printf("source_password = %s\n", config->source_password);
     printf("touch_interval = %d\n", config->touch_interval);
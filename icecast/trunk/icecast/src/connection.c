@@ -41,6 +41,7 @@
 
 #include "thread/thread.h"
 #include "avl/avl.h"
+#include "timing/timing.h"
 #include "net/sock.h"
 #include "httpp/httpp.h"
 
@@ -63,6 +64,8 @@
 #include "event.h"
 #include "admin.h"
 #include "auth.h"
+#include "timers.h"
+#include "ipfilter.h"
 
 #define CATMODULE "connection"
 
@@ -87,11 +90,47 @@ typedef struct client_queue_tag {
     client_t *client;
     int offset;
     int stream_offset;
+    /* how far the headers have been scanned, so only new data is checked */
+    int scan_offset;
+    int scan_blank;
+    /* set once parsed if handling the request may block */
+    int slow;
+    uint64_t queued;
     int shoutcast;
     char *shoutcast_mount;
     struct client_queue_tag *next;
 } client_queue_t;
 
+/* Each accept thread has its own socket on every listener when the system
+ * allows several sockets on the same port, otherwise the sockets are shared.
+ * Clients stay on the thread which accepted them until the request headers
+ * have been read.
+ */
+typedef struct accept_thread_tag {
+    int id;
+    thread_type *thread;
+    /* same order as global.serversock, SOCK_ERROR once a socket fails */
+    sock_t *serversock;
+    client_queue_t *req_queue, **req_queue_tail;
+    stats_counter_t *accepted;
+    stats_counter_t *dropped;
+} accept_thread_t;
+
+/* Complete requests are handled by a pool of dispatch workers. Requests
+ * which may block for a while (admin, stats, playlist transforms and source
+ * logins) are put on a separate queue once parsed and at most all but one
+ * of the workers will take from it, so listeners can always be attached.
+ */
+typedef struct dispatch_worker_tag {
+    int id;
+    thread_type *thread;
+    stats_counter_t *requests;
+    stats_counter_t *busy_ms;
+} dispatch_worker_t;
+
+/* how long an idle dispatch worker waits before checking the queues */
+#define DISPATCH_IDLE_WAIT 200
+
 typedef struct _thread_queue_tag {
     thread_type *thread_id;
     struct _thread_queue_tag *next;
@@ -100,44 +139,39 @@ typedef struct _thread_queue_tag {
 typedef struct
 {
     char *filename;
-    time_t file_recheck;
     time_t file_mtime;
-    avl_tree *contents;
+    ip_tree_t *contents;
 } cache_file_contents;
 
-static spin_t _connection_lock; // protects _current_id, _con_queue, _con_queue_tail
+static spin_t _connection_lock; // protects _current_id, _con_queue, _slow_queue, _dispatch_slow_busy
 static volatile unsigned long _current_id = 0;
 static int _initialized = 0;
 
-static volatile client_queue_t *_req_queue = NULL, **_req_queue_tail = &_req_queue;
 static volatile client_queue_t *_con_queue = NULL, **_con_queue_tail = &_con_queue;
+static volatile client_queue_t *_slow_queue = NULL, **_slow_queue_tail = &_slow_queue;
+static dispatch_worker_t *_dispatch_workers;
+static int _dispatch_count;
+static int _dispatch_slow_busy;
+static cond_t _dispatch_cond;
+static stats_counter_t *_dispatch_wait_ms;
 static int ssl_ok;
 #ifdef HAVE_OPENSSL
 static SSL_CTX *ssl_ctx;
 #endif
 
+static accept_thread_t *_accept_threads;
+static int _accept_threads_count;
+
 /* filtering client connection based on IP */
 static cache_file_contents banned_ip, allowed_ip;
+static spin_t _ip_filter_lock; // protects the fields of banned_ip, allowed_ip
 
 rwlock_t _source_shutdown_rwlock;
 
-static void _handle_connection(void);
-
-static int compare_ip (void *arg, void *a, void *b)
-{
-    const char *ip = (const char *)a;
-    const char *pattern = (const char *)b;
-
-    return strcmp (pattern, ip);
-}
-
-
-static int free_filtered_ip (void*x)
-{
-    free (x);
-    return 1;
-}
-
+static void _handle_connection (client_queue_t *node);
+static void _handle_shoutcast_compatible (accept_thread_t *at, client_queue_t *node);
+static void _dispatch_start (void);
+static void _dispatch_stop (void);
 
 void connection_initialize(void)
 {
@@ -147,16 +181,15 @@ void connection_initialize(void)
     thread_mutex_create(&move_clients_mutex);
     thread_rwlock_create(&_source_shutdown_rwlock);
     thread_cond_create(&global.shutdown_cond);
-    _req_queue = NULL;
-    _req_queue_tail = &_req_queue;
+    thread_spin_create (&_ip_filter_lock);
+    thread_cond_create (&_dispatch_cond);
     _con_queue = NULL;
     _con_queue_tail = &_con_queue;
+    _slow_queue = NULL;
+    _slow_queue_tail = &_slow_queue;
 
-    banned_ip.contents = NULL;
-    banned_ip.file_mtime = 0;
-
-    allowed_ip.contents = NULL;
-    allowed_ip.file_mtime = 0;
+    memset (&banned_ip, 0, sizeof (banned_ip));
+    memset (&allowed_ip, 0, sizeof (allowed_ip));
 
     _initialized = 1;
 }
@@ -168,10 +201,13 @@ void connection_shutdown(void)
 #ifdef HAVE_OPENSSL
     SSL_CTX_free (ssl_ctx);
 #endif
-    if (banned_ip.contents)  avl_tree_free (banned_ip.contents, free_filtered_ip);
-    if (allowed_ip.contents) avl_tree_free (allowed_ip.contents, free_filtered_ip);
+    ip_tree_release (banned_ip.contents);
+    ip_tree_release (allowed_ip.contents);
+    banned_ip.contents = allowed_ip.contents = NULL;
  
     thread_cond_destroy(&global.shutdown_cond);
+    thread_spin_destroy (&_ip_filter_lock);
+    thread_cond_destroy (&_dispatch_cond);
     thread_rwlock_destroy(&_source_shutdown_rwlock);
     thread_spin_destroy (&_connection_lock);
     thread_mutex_destroy(&move_clients_mutex);
@@ -276,6 +312,23 @@ static int connection_send_ssl (connection_t *con, const void *buf, size_t len)
         con->sent_bytes += bytes;
     return bytes;
 }
+
+/* no vectored write through the SSL layer, so send each block in turn */
+static int connection_sendv_ssl (connection_t *con, const struct iovec *iov, size_t count)
+{
+    int written = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        int ret = connection_send_ssl (con, iov[i].iov_base, iov[i].iov_len);
+        if (ret > 0)
+            written += ret;
+        if (ret < (int)iov[i].iov_len)
+            break;
+    }
+    return written ? written : -1;
+}
 #else
 
 /* SSL not compiled in, so at least log it */
@@ -307,105 +360,216 @@ static int connection_send (connection_t *con, const void *buf, size_t len)
     {
         if (!sock_recoverable (sock_error()))
             con->error = 1;
+        else
+            con->blocked = 1;
+    }
+    else
+    {
+        if ((size_t)bytes < len)
+            con->blocked = 1;
+        con->sent_bytes += bytes;
+    }
+    return bytes;
+}
+
+static int connection_sendv (connection_t *con, const struct iovec *iov, size_t count)
+{
+    size_t i, len = 0;
+    int bytes = sock_writev (con->sock, iov, count);
+
+    for (i = 0; i < count; i++)
+        len += iov[i].iov_len;
+    if (bytes < 0)
+    {
+        if (!sock_recoverable (sock_error()))
+            con->error = 1;
+        else
+            con->blocked = 1;
     }
     else
+    {
+        if ((size_t)bytes < len)
+            con->blocked = 1;
         con->sent_bytes += bytes;
+    }
     return bytes;
 }
 
 
-/* function to handle the re-populating of the avl tree containing IP addresses
- * for deciding whether a connection of an incoming request is to be dropped.
+/* how often in seconds the allow and deny files are checked for changes */
+#define IP_FILE_RECHECK 10
+
+
+/* build a tree from the file and swap it in for the current one, which
+ * is freed once no accept thread is using it.
  */
-static void recheck_ip_file (cache_file_contents *cache)
+static void ip_file_load (cache_file_contents *cache, const char *filename)
 {
-    time_t now = time(NULL);
-    if (now >= cache->file_recheck)
+    FILE *file;
+    ip_tree_t *new_ips, *old_ips = NULL;
+    int count = 0, invalid = 0;
+    char line [MAX_LINE_LEN];
+
+    file = fopen (filename, "r");
+    if (file == NULL)
     {
-        struct stat file_stat;
-        FILE *file = NULL;
-        int count = 0;
-        avl_tree *new_ips;
-        char line [MAX_LINE_LEN];
-
-        cache->file_recheck = now + 10;
-        if (cache->filename == NULL)
-        {
-            if (cache->contents)
-            {
-                avl_tree_free (cache->contents, free_filtered_ip);
-                cache->contents = NULL;
-            }
-            return;
-        }
-        if (stat (cache->filename, &file_stat) < 0)
+        WARN2("Failed to open file \"%s\": %s", filename, strerror (errno));
+        return;
+    }
+    new_ips = ip_tree_create ();
+    if (new_ips == NULL)
+    {
+        fclose (file);
+        return;
+    }
+    while (get_line (file, line, MAX_LINE_LEN))
+    {
+        if(!line[0] || line[0] == '#')
+            continue;
+        if (ip_tree_add (new_ips, line) < 0)
         {
-            WARN2 ("failed to check status of \"%s\": %s", cache->filename, strerror(errno));
-            return;
+            DEBUG2 ("skipping entry \"%s\" in \"%s\"", line, filename);
+            invalid++;
+            continue;
         }
-        if (file_stat.st_mtime == cache->file_mtime)
-            return; /* common case, no update to file */
+        count++;
+    }
+    fclose (file);
+    INFO2 ("%d entries read from file \"%s\"", count, filename);
+    if (invalid)
+        WARN2 ("%d invalid entries ignored in file \"%s\"", invalid, filename);
+
+    thread_spin_lock (&_ip_filter_lock);
+    /* the file may have been changed in the config meanwhile */
+    if (cache->filename && strcmp (cache->filename, filename) == 0)
+    {
+        old_ips = cache->contents;
+        cache->contents = new_ips;
+        new_ips = NULL;
+    }
+    thread_spin_unlock (&_ip_filter_lock);
+    ip_tree_release (old_ips);
+    ip_tree_release (new_ips);
+}
 
-        cache->file_mtime = file_stat.st_mtime;
 
-        file = fopen (cache->filename, "r");
-        if (file == NULL)
-        {
-            WARN2("Failed to open file \"%s\": %s", cache->filename, strerror (errno));
-            return;
-        }
-
-        new_ips = avl_tree_new (compare_ip, NULL);
+/* check whether the file has changed and reload it if so */
+static void recheck_ip_file (cache_file_contents *cache)
+{
+    struct stat file_stat;
+    char *filename = NULL;
+    ip_tree_t *old_ips = NULL;
 
-        while (get_line (file, line, MAX_LINE_LEN))
-        {
-            char *str;
-            if(!line[0] || line[0] == '#')
-                continue;
-            count++;
-            str = strdup (line);
-            if (str)
-                avl_insert (new_ips, str);
-        }
-        fclose (file);
-        INFO2 ("%d entries read from file \"%s\"", count, cache->filename);
+    thread_spin_lock (&_ip_filter_lock);
+    if (cache->filename)
+        filename = strdup (cache->filename);
+    else
+    {
+        old_ips = cache->contents;
+        cache->contents = NULL;
+    }
+    thread_spin_unlock (&_ip_filter_lock);
+    ip_tree_release (old_ips);
 
-        if (cache->contents) avl_tree_free (cache->contents, free_filtered_ip);
-        cache->contents = new_ips;
+    if (filename == NULL)
+        return;
+    if (stat (filename, &file_stat) < 0)
+    {
+        WARN2 ("failed to check status of \"%s\": %s", filename, strerror(errno));
+        free (filename);
+        return;
     }
+    thread_spin_lock (&_ip_filter_lock);
+    if (file_stat.st_mtime == cache->file_mtime)
+    {
+        /* common case, no update to file */
+        thread_spin_unlock (&_ip_filter_lock);
+        free (filename);
+        return;
+    }
+    cache->file_mtime = file_stat.st_mtime;
+    thread_spin_unlock (&_ip_filter_lock);
+
+    ip_file_load (cache, filename);
+    free (filename);
 }
 
 
-/* return 0 if the passed ip address is not to be handled by icecast, non-zero otherwise */
-static int accept_ip_address (char *ip)
+/* called every so often from the slave thread, so reading a large file
+ * does not hold up the accept threads or the timers */
+void connection_recheck_ip_files (void)
 {
-    void *result;
+    static time_t next_check;
+    time_t now = time (NULL);
 
+    if (now < next_check)
+        return;
+    next_check = now + IP_FILE_RECHECK;
     recheck_ip_file (&banned_ip);
     recheck_ip_file (&allowed_ip);
+}
+
+
+static void ip_file_set (cache_file_contents *cache, const char *filename)
+{
+    char *new_file = filename ? strdup (filename) : NULL, *old_file;
+
+    thread_spin_lock (&_ip_filter_lock);
+    old_file = cache->filename;
+    cache->filename = new_file;
+    cache->file_mtime = 0;
+    thread_spin_unlock (&_ip_filter_lock);
+    free (old_file);
+}
+
 
-    if (banned_ip.contents)
+/* return 0 if the address of the accepted connection is not to be handled
+ * by icecast, non-zero otherwise */
+static int accept_ip_address (const struct sockaddr *sa, size_t salen)
+{
+    ip_tree_t *banned, *allowed;
+    char ip [MAX_ADDR_LEN];
+    int ret = 1;
+
+    /* the lists are shared by all the accept threads, hold a reference on
+     * each so a reload can swap them meanwhile */
+    thread_spin_lock (&_ip_filter_lock);
+    banned = banned_ip.contents;
+    allowed = allowed_ip.contents;
+    ip_tree_addref (banned);
+    ip_tree_addref (allowed);
+    thread_spin_unlock (&_ip_filter_lock);
+
+    if (banned && ip_tree_match (banned, sa))
     {
-        if (avl_get_by_key (banned_ip.contents, ip, &result) == 0)
-        {
-            DEBUG1 ("%s is banned", ip);
-            return 0;
-        }
+        sock_addr_ip (sa, salen, ip, sizeof (ip));
+        DEBUG1 ("%s is banned", ip);
+        ret = 0;
     }
-    if (allowed_ip.contents)
+    else if (allowed && ip_tree_match (allowed, sa) == 0)
     {
-        if (avl_get_by_key (allowed_ip.contents, ip, &result) == 0)
-        {
-            DEBUG1 ("%s is allowed", ip);
-            return 1;
-        }
-        else
-        {
-            DEBUG1 ("%s is not allowed", ip);
-            return 0;
-        }
+        sock_addr_ip (sa, salen, ip, sizeof (ip));
+        DEBUG1 ("%s is not allowed", ip);
+        ret = 0;
     }
-    return 1;
+    ip_tree_release (banned);
+    ip_tree_release (allowed);
+    return ret;
+}
+
+
+/* fired from the timer thread for the header timeout and listener time
+ * limit, the connection is dropped by whichever thread is handling it */
+static int connection_timeout (timer_entry_t *timer)
+{
+    connection_t *con = timer->arg;
+
+    if (con->discon_time)
+        INFO1 ("time limit reached for client #%lu", con->id);
+    else
+        DEBUG1 ("header timeout on client #%lu", con->id);
+    con->error = 1;
+    return 0;
 }
 
 
@@ -422,6 +586,8 @@ connection_t *connection_create (sock_t sock, sock_t serversock, char *ip)
         con->ip = ip;
         con->read = connection_read;
         con->send = connection_send;
+        con->sendv = connection_sendv;
+        timer_entry_init (&con->timer, connection_timeout, con);
     }
 
     return con;
@@ -434,57 +600,47 @@ void connection_uses_ssl (connection_t *con)
 #ifdef HAVE_OPENSSL
     con->read = connection_read_ssl;
     con->send = connection_send_ssl;
+    con->sendv = connection_sendv_ssl;
     con->ssl = SSL_new (ssl_ctx);
     SSL_set_accept_state (con->ssl);
     SSL_set_fd (con->ssl, con->sock);
 #endif
 }
 
-static sock_t wait_for_serversock(int timeout)
+/* wait for a connection on one of the listening sockets of this thread,
+ * returns the listener index or -1 if nothing is pending */
+static int wait_for_serversock (accept_thread_t *at, int timeout)
 {
 #ifdef HAVE_POLL
     struct pollfd ufds [global.server_sockets];
     int i, ret;
 
     for(i=0; i < global.server_sockets; i++) {
-        ufds[i].fd = global.serversock[i];
+        /* poll ignores negative descriptors, so failed sockets drop out */
+        ufds[i].fd = at->serversock[i];
         ufds[i].events = POLLIN;
         ufds[i].revents = 0;
     }
 
     ret = poll(ufds, global.server_sockets, timeout);
-    if(ret < 0) {
-        return SOCK_ERROR;
-    }
-    else if(ret == 0) {
-        return SOCK_ERROR;
+    if(ret <= 0) {
+        return -1;
     }
     else {
-        int dst;
         for(i=0; i < global.server_sockets; i++) {
             if(ufds[i].revents & POLLIN)
-                return ufds[i].fd;
+                return i;
             if(ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
             {
-                if (ufds[i].revents & (POLLHUP|POLLERR))
-                {
-                    sock_close (global.serversock[i]);
-                    WARN0("Had to close a listening socket");
-                }
-                global.serversock[i] = SOCK_ERROR;
+                /* sockets shared with other threads are closed at shutdown */
+                if ((ufds[i].revents & (POLLHUP|POLLERR)) &&
+                        at->serversock[i] != global.serversock[i])
+                    sock_close (at->serversock[i]);
+                WARN1 ("Had to close a listening socket on accept thread %d", at->id);
+                at->serversock[i] = SOCK_ERROR;
             }
         }
-        /* remove any closed sockets */
-        for(i=0, dst=0; i < global.server_sockets; i++)
-        {
-            if (global.serversock[i] == SOCK_ERROR)
-                continue;
-            if (i!=dst)
-                global.serversock[dst] = global.serversock[i];
-            dst++;
-        }
-        global.server_sockets = dst;
-        return SOCK_ERROR;
+        return -1;
     }
 #else
     fd_set rfds;
@@ -495,9 +651,11 @@ static sock_t wait_for_serversock(int timeout)
     FD_ZERO(&rfds);
 
     for(i=0; i < global.server_sockets; i++) {
-        FD_SET(global.serversock[i], &rfds);
-        if (max == SOCK_ERROR || global.serversock[i] > max)
-            max = global.serversock[i];
+        if (at->serversock[i] == SOCK_ERROR)
+            continue;
+        FD_SET(at->serversock[i], &rfds);
+        if (max == SOCK_ERROR || at->serversock[i] > max)
+            max = at->serversock[i];
     }
 
     if(timeout >= 0) {
@@ -507,46 +665,53 @@ static sock_t wait_for_serversock(int timeout)
     }
 
     ret = select(max+1, &rfds, NULL, NULL, p);
-    if(ret < 0) {
-        return SOCK_ERROR;
-    }
-    else if(ret == 0) {
-        return SOCK_ERROR;
+    if(ret <= 0) {
+        return -1;
     }
     else {
         for(i=0; i < global.server_sockets; i++) {
-            if(FD_ISSET(global.serversock[i], &rfds))
-                return global.serversock[i];
+            if(at->serversock[i] != SOCK_ERROR && FD_ISSET(at->serversock[i], &rfds))
+                return i;
         }
-        return SOCK_ERROR; /* Should be impossible, stop compiler warnings */
+        return -1; /* Should be impossible, stop compiler warnings */
     }
 #endif
 }
 
-static connection_t *_accept_connection(int duration)
+static connection_t *_accept_connection (accept_thread_t *at, int duration)
 {
-    sock_t sock, serversock;
-    char *ip;
-
-    serversock = wait_for_serversock (duration);
-    if (serversock == SOCK_ERROR)
+    sock_t sock;
+    struct sockaddr_storage sa;
+    size_t salen = sizeof (sa);
+    char ip [MAX_ADDR_LEN];
+    int i;
+
+    i = wait_for_serversock (at, duration);
+    if (i < 0)
         return NULL;
 
-    /* malloc enough room for a full IP address (including ipv6) */
-    ip = (char *)malloc(MAX_ADDR_LEN);
-
-    sock = sock_accept(serversock, ip, MAX_ADDR_LEN);
+    sock = sock_accept_addr (at->serversock[i], (struct sockaddr *)&sa, &salen);
     if (sock != SOCK_ERROR)
     {
-        connection_t *con = NULL;
-        /* Make any IPv4 mapped IPv6 address look like a normal IPv4 address */
-        if (strncmp (ip, "::ffff:", 7) == 0)
-            memmove (ip, ip+7, strlen (ip+7)+1);
-
-        if (accept_ip_address (ip))
-            con = connection_create (sock, serversock, ip);
-        if (con)
-            return con;
+        stats_counter_inc (at->accepted);
+        /* filter on the address as accept returned it, before formatting */
+        if (accept_ip_address ((struct sockaddr *)&sa, salen))
+        {
+            char *addr;
+
+            sock_addr_ip ((struct sockaddr *)&sa, salen, ip, sizeof (ip));
+            /* Make any IPv4 mapped IPv6 address look like a normal IPv4 address */
+            if (strncmp (ip, "::ffff:", 7) == 0)
+                memmove (ip, ip+7, strlen (ip+7)+1);
+            addr = strdup (ip);
+            /* identify the listener by the socket in global.serversock, not
+             * the one for this thread */
+            connection_t *con = connection_create (sock, global.serversock[i], addr);
+            if (con)
+                return con;
+            free (addr);
+        }
+        stats_counter_inc (at->dropped);
         sock_close (sock);
     }
     else
@@ -557,26 +722,49 @@ static connection_t *_accept_connection(int duration)
             thread_sleep (500000);
         }
     }
-    free(ip);
     return NULL;
 }
 
 
+/* wake a dispatch worker.  Workers check the queues with the cond lock
+ * held before waiting, so one that has just found nothing cannot miss it */
+static void _dispatch_wakeup (void)
+{
+    thread_cond_lock (&_dispatch_cond);
+    thread_cond_signal (&_dispatch_cond);
+    thread_cond_unlock (&_dispatch_cond);
+}
+
+
 /* add client to connection queue. At this point some header information
- * has been collected, so we now pass it onto the connection thread for
+ * has been collected, so we now pass it onto the dispatch workers for
  * further processing
  */
 static void _add_connection (client_queue_t *node)
 {
+    node->queued = timing_get_time();
     thread_spin_lock (&_connection_lock);
     *_con_queue_tail = node;
     _con_queue_tail = (volatile client_queue_t **)&node->next;
     thread_spin_unlock (&_connection_lock);
+    _dispatch_wakeup ();
+}
+
+
+/* queue a parsed request which may block whichever worker handles it */
+static void _add_slow_connection (client_queue_t *node)
+{
+    thread_spin_lock (&_connection_lock);
+    *_slow_queue_tail = node;
+    _slow_queue_tail = (volatile client_queue_t **)&node->next;
+    thread_spin_unlock (&_connection_lock);
+    _dispatch_wakeup ();
 }
 
 
-/* this returns queued clients for the connection thread. headers are
- * already provided, but need to be parsed.
+/* this returns queued clients for the dispatch workers. New requests are
+ * taken first, a slow one is only returned if that leaves a worker free
+ * for new requests.
  */
 static client_queue_t *_get_connection(void)
 {
@@ -592,20 +780,65 @@ static client_queue_t *_get_connection(void)
             _con_queue_tail = &_con_queue;
         node->next = NULL;
     }
+    else if (_slow_queue && (_dispatch_slow_busy < _dispatch_count - 1 || _dispatch_count == 1))
+    {
+        node = (client_queue_t *)_slow_queue;
+        _slow_queue = node->next;
+        if (_slow_queue == NULL)
+            _slow_queue_tail = &_slow_queue;
+        node->next = NULL;
+        _dispatch_slow_busy++;
+    }
 
     thread_spin_unlock (&_connection_lock);
     return node;
 }
 
 
-/* run along queue checking for any data that has come in or a timeout */
-static void process_request_queue (void)
+/* look at the data read since the last call for the blank line which ends
+ * the http style headers. Lines may end in \n, \r\n or the \r\r\n that
+ * nsvcap sends. Returns 1 when the headers are complete.
+ */
+static int _scan_request_headers (client_queue_t *node)
 {
-    client_queue_t **node_ref = (client_queue_t **)&_req_queue;
-    ice_config_t *config = config_get_config ();
-    int timeout = config->header_timeout;
-    config_release_config();
+    const char *data = node->client->refbuf->data;
+    int pos = node->scan_offset;
 
+    if (node->shoutcast == 1)
+    {
+        /* password line */
+        if (memchr (data + pos, '\n', node->offset - pos))
+            return 1;
+        node->scan_offset = node->offset;
+        return 0;
+    }
+    while (pos < node->offset)
+    {
+        char c = data [pos++];
+
+        if (c == '\n')
+        {
+            if (node->scan_blank)
+            {
+                /* stream_offset refers to the start of any data sent after
+                 * the headers, we don't want to lose those */
+                node->stream_offset = pos;
+                return 1;
+            }
+            node->scan_blank = 1;
+        }
+        else if (c != '\r')
+            node->scan_blank = 0;
+    }
+    node->scan_offset = pos;
+    return 0;
+}
+
+
+/* run along queue checking for any data that has come in or a timeout */
+static void process_request_queue (accept_thread_t *at)
+{
+    client_queue_t **node_ref = &at->req_queue;
     while (*node_ref)
     {
         client_queue_t *node = *node_ref;
@@ -615,7 +848,8 @@ static void process_request_queue (void)
 
         if (len > 0)
         {
-            if (client->con->con_time + timeout <= time(NULL))
+            /* flagged by the header timeout */
+            if (client->con->error)
                 len = 0;
             else
                 len = client_read_bytes (client, buf, len);
@@ -623,55 +857,22 @@ static void process_request_queue (void)
 
         if (len > 0)
         {
-            int pass_it = 1;
-            char *ptr;
-
-            /* handle \n, \r\n and nsvcap which for some strange reason has
-             * EOL as \r\r\n */
             node->offset += len;
             client->refbuf->data [node->offset] = '\000';
-            do
-            {
-                if (node->shoutcast == 1)
-                {
-                    /* password line */
-                    if (strstr (client->refbuf->data, "\r\r\n") != NULL)
-                        break;
-                    if (strstr (client->refbuf->data, "\r\n") != NULL)
-                        break;
-                    if (strstr (client->refbuf->data, "\n") != NULL)
-                        break;
-                }
-                /* stream_offset refers to the start of any data sent after the
-                 * http style headers, we don't want to lose those */
-                ptr = strstr (client->refbuf->data, "\r\r\n\r\r\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+6) - client->refbuf->data;
-                    break;
-                }
-                ptr = strstr (client->refbuf->data, "\r\n\r\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+4) - client->refbuf->data;
-                    break;
-                }
-                ptr = strstr (client->refbuf->data, "\n\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+2) - client->refbuf->data;
-                    break;
-                }
-                pass_it = 0;
-            } while (0);
 
-            if (pass_it)
+            if (_scan_request_headers (node))
             {
-                if ((client_queue_t **)_req_queue_tail == &(node->next))
-                    _req_queue_tail = (volatile client_queue_t **)node_ref;
+                if (at->req_queue_tail == &node->next)
+                    at->req_queue_tail = node_ref;
                 *node_ref = node->next;
                 node->next = NULL;
-                _add_connection (node);
+                timers_cancel (&client->con->timer);
+                /* the shoutcast password check is quick and may send the
+                 * client back to this queue */
+                if (node->shoutcast == 1)
+                    _handle_shoutcast_compatible (at, node);
+                else
+                    _add_connection (node);
                 continue;
             }
         }
@@ -679,8 +880,8 @@ static void process_request_queue (void)
         {
             if (len == 0 || client->con->error)
             {
-                if ((client_queue_t **)_req_queue_tail == &node->next)
-                    _req_queue_tail = (volatile client_queue_t **)node_ref;
+                if (at->req_queue_tail == &node->next)
+                    at->req_queue_tail = node_ref;
                 *node_ref = node->next;
                 client_destroy (client);
                 free (node);
@@ -689,33 +890,27 @@ static void process_request_queue (void)
         }
         node_ref = &node->next;
     }
-    _handle_connection();
 }
 
 
 /* add node to the queue of requests. This is where the clients are when
  * initial http details are read.
  */
-static void _add_request_queue (client_queue_t *node)
+static void _add_request_queue (accept_thread_t *at, client_queue_t *node)
 {
-    *_req_queue_tail = node;
-    _req_queue_tail = (volatile client_queue_t **)&node->next;
+    *at->req_queue_tail = node;
+    at->req_queue_tail = &node->next;
 }
 
 
-void connection_accept_loop (void)
+static void _accept_connections (accept_thread_t *at)
 {
     connection_t *con;
-    ice_config_t *config;
     int duration = 300;
 
-    config = config_get_config ();
-    get_ssl_certificate (config);
-    config_release_config ();
-
     while (global.running == ICE_RUNNING)
     {
-        con = _accept_connection (duration);
+        con = _accept_connection (at, duration);
 
         if (con)
         {
@@ -728,6 +923,7 @@ void connection_accept_loop (void)
             if (client_create (&client, con, NULL) < 0)
             {
                 global_unlock();
+                stats_counter_inc (at->dropped);
                 client_send_403 (client, "Icecast connection limit reached");
                 /* don't be too eager as this is an imposed hard limit */
                 thread_sleep (400000);
@@ -737,10 +933,12 @@ void connection_accept_loop (void)
             /* setup client for reading incoming http */
             client->refbuf->data [PER_CLIENT_REFBUF_SIZE-1] = '\000';
 
-            if (sock_set_blocking (client->con->sock, 0) || sock_set_nodelay (client->con->sock))
+            /* the accepted socket is already non-blocking */
+            if (sock_set_nodelay (client->con->sock))
             {
                 global_unlock();
                 WARN0 ("failed to set tcp options on client connection, dropping");
+                stats_counter_inc (at->dropped);
                 client_destroy (client);
                 continue;
             }
@@ -749,6 +947,7 @@ void connection_accept_loop (void)
             if (node == NULL)
             {
                 global_unlock();
+                stats_counter_inc (at->dropped);
                 client_destroy (client);
                 continue;
             }
@@ -766,20 +965,74 @@ void connection_accept_loop (void)
                 if (listener->shoutcast_mount)
                     node->shoutcast_mount = strdup (listener->shoutcast_mount);
             }
+            timers_add (&client->con->timer, config->header_timeout * 1000);
             global_unlock();
             config_release_config();
 
-            _add_request_queue (node);
-            stats_event_inc (NULL, "connections");
+            _add_request_queue (at, node);
+            stats_global_inc (STATS_CONNECTIONS);
             duration = 5;
         }
         else
         {
-            if (_req_queue == NULL)
+            if (at->req_queue == NULL)
                 duration = 300; /* use longer timeouts when nothing waiting */
         }
-        process_request_queue ();
+        process_request_queue (at);
+    }
+}
+
+
+static void *_accept_thread (void *arg)
+{
+    accept_thread_t *at = arg;
+
+    DEBUG1 ("accept thread %d started", at->id);
+    _accept_connections (at);
+    DEBUG1 ("accept thread %d exiting", at->id);
+    return NULL;
+}
+
+
+void connection_accept_loop (void)
+{
+    ice_config_t *config;
+    int i;
+
+    config = config_get_config ();
+    get_ssl_certificate (config);
+    config_release_config ();
+
+    for (i = 0; i < _accept_threads_count; i++)
+    {
+        accept_thread_t *at = &_accept_threads[i];
+        char name [40];
+
+        snprintf (name, sizeof (name), "accept_thread%d_connections", i);
+        at->accepted = stats_counter (NULL, name);
+        snprintf (name, sizeof (name), "accept_thread%d_dropped", i);
+        at->dropped = stats_counter (NULL, name);
+        if (i)
+            at->thread = thread_create ("Accept Thread", _accept_thread,
+                    at, THREAD_ATTACHED);
     }
+    stats_event_args (NULL, "accept_threads", "%d", _accept_threads_count);
+    _dispatch_start();
+
+    /* have the allow and deny lists in place before accepting */
+    recheck_ip_file (&banned_ip);
+    recheck_ip_file (&allowed_ip);
+
+    /* the first accept thread is this one */
+    _accept_connections (&_accept_threads[0]);
+
+    for (i = 1; i < _accept_threads_count; i++)
+    {
+        if (_accept_threads[i].thread)
+            thread_join (_accept_threads[i].thread);
+        _accept_threads[i].thread = NULL;
+    }
+    _dispatch_stop();
 
     /* Give all the other threads notification to shut down */
     thread_cond_broadcast(&global.shutdown_cond);
@@ -1106,7 +1359,7 @@ void source_startup (client_t *client, const char *uri, int auth_style)
 
 static void _handle_stats_request (client_t *client, char *uri)
 {
-    stats_event_inc(NULL, "stats_connections");
+    stats_global_inc (STATS_STATS_CONNECTIONS);
 
     if (connection_check_admin_pass (client->parser) == 0)
     {
@@ -1164,7 +1417,7 @@ static void _handle_get_request (client_t *client, char *passed_uri)
     }
     config_release_config();
 
-    stats_event_inc(NULL, "client_connections");
+    stats_global_inc (STATS_CLIENT_CONNECTIONS);
 
     /* Dispatch all admin requests */
     if ((strcmp(uri, "/admin.cgi") == 0) ||
@@ -1177,7 +1430,10 @@ static void _handle_get_request (client_t *client, char *passed_uri)
     if (uri != passed_uri) free (uri);
 }
 
-static void _handle_shoutcast_compatible (client_queue_t *node)
+/* the password line is checked on the accept thread at, which then reads the
+ * headers that follow. The login itself is done by a dispatch worker.
+ */
+static void _handle_shoutcast_compatible (accept_thread_t *at, client_queue_t *node)
 {
     char *http_compliant;
     int http_compliant_len = 0;
@@ -1195,6 +1451,7 @@ static void _handle_shoutcast_compatible (client_queue_t *node)
     {
         char *source_password, *ptr, *headers;
         mount_proxy *mountinfo = config_find_mount (config, shoutcast_mount, MOUNT_TYPE_NORMAL);
+        int header_timeout = config->header_timeout;
 
         if (mountinfo && mountinfo->password)
             source_password = strdup (mountinfo->password);
@@ -1243,8 +1500,11 @@ static void _handle_shoutcast_compatible (client_queue_t *node)
             node->offset -= (headers - client->refbuf->data);
             memmove (client->refbuf->data, headers, node->offset+1);
             node->shoutcast = 2;
+            node->scan_offset = 0;
+            node->scan_blank = 0;
             /* we've checked the password, now send it back for reading headers */
-            _add_request_queue (node);
+            timers_add (&client->con->timer, header_timeout * 1000);
+            _add_request_queue (at, node);
             free (source_password);
             return;
         }
@@ -1294,113 +1554,270 @@ static void _handle_shoutcast_compatible (client_queue_t *node)
 }
 
 
-/* Connection thread. Here we take clients off the connection queue and check
- * the contents provided. We set up the parser then hand off to the specific
- * request handler.
+/* parse the request headers and work out whether handling the request may
+ * block for a while. Returns -1 if the request is dropped, 1 if it should
+ * go on the slow queue and 0 otherwise.
  */
-static void _handle_connection(void)
+static int _prepare_request (client_queue_t *node)
 {
+    client_t *client = node->client;
     http_parser_t *parser;
+    const char *uri, *ext;
+    source_t *source;
+
+    /* the shoutcast source login builds its own request */
+    if (node->shoutcast)
+        return 1;
+
+    /* process normal HTTP headers */
+    parser = httpp_create_parser();
+    httpp_initialize(parser, NULL);
+    client->parser = parser;
+    if (httpp_parse (parser, client->refbuf->data, node->stream_offset) == 0)
+    {
+        ERROR0("HTTP request parsing failed");
+        client_destroy (client);
+        free (node->shoutcast_mount);
+        free (node);
+        return -1;
+    }
+
+    /* we may have more than just headers, so prepare for it */
+    if (node->stream_offset == node->offset)
+        client->refbuf->len = 0;
+    else
+    {
+        char *ptr = client->refbuf->data;
+        client->refbuf->len = node->offset - node->stream_offset;
+        memmove (ptr, ptr + node->stream_offset, client->refbuf->len);
+    }
+
+    if (parser->req_type != httpp_req_get)
+        return 1;
+    uri = httpp_getvar (parser, HTTPP_VAR_URI);
+    if (strcmp (uri, "/admin.cgi") == 0 || strncmp (uri, "/admin/", 7) == 0)
+        return 1;
+    /* stylesheet and playlist transforms are done by the requesting thread */
+    ext = strrchr (uri, '.');
+    if (ext && (strcmp (ext, ".xsl") == 0 || strcmp (ext, ".xspf") == 0 ||
+                strcmp (ext, ".vclt") == 0))
+        return 1;
+    /* only attaches to an existing mount stay here, anything else may be
+     * served from disk which means a stat and file open */
+    avl_tree_rlock (global.source_tree);
+    source = source_find_mount_raw (uri);
+    avl_tree_unlock (global.source_tree);
+    if (source == NULL)
+        return 1;
+    return 0;
+}
+
+
+/* Here we take a parsed request and check the contents provided, then hand
+ * off to the specific request handler.
+ */
+static void _handle_connection (client_queue_t *node)
+{
+    client_t *client = node->client;
+    http_parser_t *parser = client->parser;
     const char *rawuri;
-    client_queue_t *node;
+    char *uri;
 
-    while (1)
+    /* Check for special shoutcast compatability processing */
+    if (node->shoutcast)
     {
-        node = _get_connection();
-        if (node)
-        {
-            client_t *client = node->client;
+        _handle_shoutcast_compatible (NULL, node);
+        return;
+    }
 
-            /* Check for special shoutcast compatability processing */
-            if (node->shoutcast)
-            {
-                _handle_shoutcast_compatible (node);
-                continue;
-            }
+    rawuri = httpp_getvar(parser, HTTPP_VAR_URI);
 
-            /* process normal HTTP headers */
-            parser = httpp_create_parser();
-            httpp_initialize(parser, NULL);
-            client->parser = parser;
-            if (httpp_parse (parser, client->refbuf->data, node->offset))
-            {
-                char *uri;
+    /* assign a port-based shoutcast mountpoint if required */
+    if (node->shoutcast_mount && strcmp (rawuri, "/admin.cgi") == 0)
+        httpp_set_query_param (client->parser, "mount", node->shoutcast_mount);
 
-                /* we may have more than just headers, so prepare for it */
-                if (node->stream_offset == node->offset)
-                    client->refbuf->len = 0;
-                else
-                {
-                    char *ptr = client->refbuf->data;
-                    client->refbuf->len = node->offset - node->stream_offset;
-                    memmove (ptr, ptr + node->stream_offset, client->refbuf->len);
-                }
+    free (node->shoutcast_mount);
+    free (node);
 
-                rawuri = httpp_getvar(parser, HTTPP_VAR_URI);
+    if (strcmp("ICE",  httpp_getvar(parser, HTTPP_VAR_PROTOCOL)) &&
+        strcmp("HTTP", httpp_getvar(parser, HTTPP_VAR_PROTOCOL))) {
+        ERROR0("Bad HTTP protocol detected");
+        client_destroy (client);
+        return;
+    }
 
-                /* assign a port-based shoutcast mountpoint if required */
-                if (node->shoutcast_mount && strcmp (rawuri, "/admin.cgi") == 0)
-                    httpp_set_query_param (client->parser, "mount", node->shoutcast_mount);
+    uri = util_normalise_uri(rawuri);
 
-                free (node->shoutcast_mount);
-                free (node);
+    if (uri == NULL)
+    {
+        client_destroy (client);
+        return;
+    }
 
-                if (strcmp("ICE",  httpp_getvar(parser, HTTPP_VAR_PROTOCOL)) &&
-                    strcmp("HTTP", httpp_getvar(parser, HTTPP_VAR_PROTOCOL))) {
-                    ERROR0("Bad HTTP protocol detected");
-                    client_destroy (client);
-                    continue;
-                }
+    if (parser->req_type == httpp_req_source || parser->req_type == httpp_req_put) {
+        _handle_source_request (client, uri);
+    }
+    else if (parser->req_type == httpp_req_stats) {
+        _handle_stats_request (client, uri);
+    }
+    else if (parser->req_type == httpp_req_get) {
+        _handle_get_request (client, uri);
+    }
+    else {
+        ERROR0("Wrong request type from client");
+        client_send_400 (client, "unknown request");
+    }
 
-                uri = util_normalise_uri(rawuri);
+    free(uri);
+}
 
-                if (uri == NULL)
-                {
-                    client_destroy (client);
-                    continue;
-                }
 
-                if (parser->req_type == httpp_req_source || parser->req_type == httpp_req_put) {
-                    _handle_source_request (client, uri);
-                }
-                else if (parser->req_type == httpp_req_stats) {
-                    _handle_stats_request (client, uri);
-                }
-                else if (parser->req_type == httpp_req_get) {
-                    _handle_get_request (client, uri);
-                }
-                else {
-                    ERROR0("Wrong request type from client");
-                    client_send_400 (client, "unknown request");
-                }
+static void *_dispatch_thread (void *arg)
+{
+    dispatch_worker_t *worker = arg;
 
-                free(uri);
-            } 
-            else
+    DEBUG1 ("dispatch worker %d started", worker->id);
+    while (global.running == ICE_RUNNING)
+    {
+        client_queue_t *node = _get_connection();
+        uint64_t start;
+        int slow;
+
+        if (node == NULL)
+        {
+            thread_cond_lock (&_dispatch_cond);
+            node = _get_connection();
+            if (node == NULL && global.running == ICE_RUNNING)
+                thread_cond_timedwait_locked (&_dispatch_cond, DISPATCH_IDLE_WAIT);
+            thread_cond_unlock (&_dispatch_cond);
+            if (node == NULL)
+                continue;
+        }
+        start = timing_get_time();
+        slow = node->slow;
+        if (slow == 0)
+        {
+            stats_counter_add (_dispatch_wait_ms, (long)(start - node->queued));
+            switch (_prepare_request (node))
             {
-                free (node);
-                ERROR0("HTTP request parsing failed");
-                client_destroy (client);
+                case -1:
+                    continue;
+                case 1:
+                    node->slow = 1;
+                    _add_slow_connection (node);
+                    continue;
             }
-            continue;
         }
-        break;
+        _handle_connection (node);
+
+        if (slow)
+        {
+            thread_spin_lock (&_connection_lock);
+            _dispatch_slow_busy--;
+            thread_spin_unlock (&_connection_lock);
+            /* a queued slow request may have been held back for this */
+            _dispatch_wakeup ();
+        }
+        stats_counter_inc (worker->requests);
+        stats_counter_add (worker->busy_ms, (long)(timing_get_time() - start));
+    }
+    DEBUG1 ("dispatch worker %d exiting", worker->id);
+    return NULL;
+}
+
+
+static void _dispatch_start (void)
+{
+    ice_config_t *config = config_get_config();
+    int i, count = config->dispatch_threads;
+
+    config_release_config();
+    if (count < 1)
+        count = 1;
+
+    _dispatch_wait_ms = stats_counter (NULL, "dispatch_queue_wait_ms");
+    _dispatch_workers = calloc (count, sizeof (dispatch_worker_t));
+    _dispatch_count = count;
+    for (i = 0; i < count; i++)
+    {
+        dispatch_worker_t *worker = &_dispatch_workers[i];
+        char name [40];
+
+        worker->id = i;
+        snprintf (name, sizeof (name), "dispatch_worker%d_requests", i);
+        worker->requests = stats_counter (NULL, name);
+        snprintf (name, sizeof (name), "dispatch_worker%d_busy_ms", i);
+        worker->busy_ms = stats_counter (NULL, name);
+        worker->thread = thread_create ("Dispatch Worker", _dispatch_thread,
+                worker, THREAD_ATTACHED);
+    }
+    stats_event_args (NULL, "dispatch_threads", "%d", count);
+}
+
+
+/* called once the server is no longer running */
+static void _dispatch_stop (void)
+{
+    int i;
+
+    thread_cond_lock (&_dispatch_cond);
+    thread_cond_broadcast (&_dispatch_cond);
+    thread_cond_unlock (&_dispatch_cond);
+    for (i = 0; i < _dispatch_count; i++)
+    {
+        if (_dispatch_workers[i].thread)
+            thread_join (_dispatch_workers[i].thread);
     }
+    free (_dispatch_workers);
+    _dispatch_workers = NULL;
+    _dispatch_count = 0;
+}
+
+
+/* create a listening socket for the listener details provided */
+static sock_t _listener_socket (listener_t *listener, int flags)
+{
+    sock_t sock = sock_get_server_socket_opts (listener->port, listener->bind_address, flags);
+    if (sock == SOCK_ERROR)
+        return SOCK_ERROR;
+    if (sock_listen (sock, ICE_LISTEN_QUEUE) == SOCK_ERROR)
+    {
+        sock_close (sock);
+        return SOCK_ERROR;
+    }
+    /* some win32 setups do not do TCP win scaling well, so allow an override */
+    if (listener->so_sndbuf)
+        sock_set_send_buffer (sock, listener->so_sndbuf);
+    sock_set_blocking (sock, 0);
+    return sock;
 }
 
 
 /* called when listening thread is not checking for incoming connections */
 int connection_setup_sockets (ice_config_t *config)
 {
-    int count = 0;
+    int count = 0, flags = 0, shared = 0, t;
     listener_t *listener, **prev;
 
-    free (banned_ip.filename);
-    banned_ip.filename = NULL;
-    free (allowed_ip.filename);
-    allowed_ip.filename = NULL;
-
     global_lock();
+    if (_accept_threads)
+    {
+        for (t = 0; t < _accept_threads_count; t++)
+        {
+            accept_thread_t *at = &_accept_threads[t];
+            int i;
+
+            for (i = 0; i < global.server_sockets; i++)
+            {
+                if (at->serversock[i] != SOCK_ERROR && at->serversock[i] != global.serversock[i])
+                    sock_close (at->serversock[i]);
+            }
+            free (at->serversock);
+        }
+        free (_accept_threads);
+        _accept_threads = NULL;
+        _accept_threads_count = 0;
+    }
     if (global.serversock)
     {
         for (; count < global.server_sockets; count++)
@@ -1411,44 +1828,35 @@ int connection_setup_sockets (ice_config_t *config)
     if (config == NULL)
     {
         global_unlock();
+        ip_file_set (&banned_ip, NULL);
+        ip_file_set (&allowed_ip, NULL);
         return 0;
     }
 
     /* setup the banned/allowed IP filenames from the xml */
-    if (config->banfile)
-        banned_ip.filename = strdup (config->banfile);
-
-    if (config->allowfile)
-        allowed_ip.filename = strdup (config->allowfile);
+    ip_file_set (&banned_ip, config->banfile);
+    ip_file_set (&allowed_ip, config->allowfile);
 
     count = 0;
     global.serversock = calloc (config->listen_sock_count, sizeof (sock_t));
 
+    /* every accept thread needs its own socket on the same port */
+    if (config->accept_threads > 1)
+        flags = SOCK_REUSEPORT;
+
     listener = config->listen_sock; 
     prev = &config->listen_sock;
     while (listener)
     {
-        int successful = 0;
+        sock_t sock = _listener_socket (listener, flags);
 
-        do
+        if (sock == SOCK_ERROR && flags)
         {
-            sock_t sock = sock_get_server_socket (listener->port, listener->bind_address);
-            if (sock == SOCK_ERROR)
-                break;
-            if (sock_listen (sock, ICE_LISTEN_QUEUE) == SOCK_ERROR)
-            {
-                sock_close (sock);
-                break;
-            }
-            /* some win32 setups do not do TCP win scaling well, so allow an override */
-            if (listener->so_sndbuf)
-                sock_set_send_buffer (sock, listener->so_sndbuf);
-            sock_set_blocking (sock, 0);
-            successful = 1;
-            global.serversock [count] = sock;
-            count++;
-        } while(0);
-        if (successful == 0)
+            /* no SO_REUSEPORT, the accept threads will share this one */
+            sock = _listener_socket (listener, 0);
+            shared = 1;
+        }
+        if (sock == SOCK_ERROR)
         {
             if (listener->bind_address)
                 ERROR2 ("Could not create listener socket on port %d bind %s",
@@ -1460,6 +1868,8 @@ int connection_setup_sockets (ice_config_t *config)
             listener = *prev;
             continue;
         }
+        global.serversock [count] = sock;
+        count++;
         if (listener->bind_address)
             INFO2 ("listener socket on port %d address %s", listener->port, listener->bind_address);
         else
@@ -1468,6 +1878,36 @@ int connection_setup_sockets (ice_config_t *config)
         listener = listener->next;
     }
     global.server_sockets = count;
+
+    _accept_threads_count = config->accept_threads > 0 ? config->accept_threads : 1;
+    _accept_threads = calloc (_accept_threads_count, sizeof (accept_thread_t));
+    for (t = 0; t < _accept_threads_count; t++)
+    {
+        accept_thread_t *at = &_accept_threads[t];
+        int i;
+
+        at->id = t;
+        at->req_queue_tail = &at->req_queue;
+        at->serversock = calloc (count + 1, sizeof (sock_t));
+        listener = config->listen_sock;
+        for (i = 0; i < count; i++, listener = listener->next)
+        {
+            sock_t sock = SOCK_ERROR;
+
+            if (t && shared == 0)
+                sock = _listener_socket (listener, SOCK_REUSEPORT);
+            if (sock == SOCK_ERROR)
+            {
+                sock = global.serversock [i];
+                if (t)
+                    shared = 1;
+            }
+            at->serversock [i] = sock;
+        }
+    }
+    if (_accept_threads_count > 1)
+        INFO2 ("%d accept threads, %s listening sockets", _accept_threads_count,
+                shared ? "sharing" : "separate");
     global_unlock();
 
     if (count == 0)
@@ -1479,6 +1919,7 @@ int connection_setup_sockets (ice_config_t *config)
 
 void connection_close(connection_t *con)
 {
+    timers_cancel (&con->timer);
     sock_close(con->sock);
     if (con->ip) free(con->ip);
     if (con->host) free(con->host);
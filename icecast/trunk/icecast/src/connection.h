@@ -24,6 +24,7 @@
 #include "httpp/httpp.h"
 #include "thread/thread.h"
 #include "net/sock.h"
+#include "timing/timer.h"
 
 struct _client_tag;
 struct source_tag;
@@ -35,16 +36,19 @@ typedef struct connection_tag
 
     time_t con_time;
     time_t discon_time;
+    timer_entry_t timer;    /* header timeout, then any time limit */
     uint64_t sent_bytes;
 
     sock_t sock;
     sock_t serversock;
     int error;
+    int blocked;    /* last send came up short, socket buffer is full */
 
 #ifdef HAVE_OPENSSL
     SSL *ssl;   /* SSL handler */
 #endif
     int (*send)(struct connection_tag *handle, const void *buf, size_t len);
+    int (*sendv)(struct connection_tag *handle, const struct iovec *iov, size_t count);
     int (*read)(struct connection_tag *handle, void *buf, size_t len);
 
     char *ip;
@@ -56,6 +60,7 @@ void connection_initialize(void);
 void connection_shutdown(void);
 void connection_accept_loop(void);
 int  connection_setup_sockets (struct ice_config_tag *config);
+void connection_recheck_ip_files (void);
 void connection_close(connection_t *con);
 connection_t *connection_create (sock_t sock, sock_t serversock, char *ip);
 int connection_complete_source (struct source_tag *source, int response);
@@ -35,8 +35,8 @@ void event_config_read(void *arg)
     ice_config_t new_config;
     /* reread config file */
 
-    config = config_grab_config(); /* Both to get the lock, and to be able
-                                     to find out the config filename */
+    config = config_grab_config(); /* Both to stop other reloads, and to be
+                                     able to find out the config filename */
     xmlSetGenericErrorFunc ("config", log_parse_failure);
     ret = config_parse_file(config->config_filename, &new_config);
     if(ret < 0) {
@@ -59,13 +59,14 @@ void event_config_read(void *arg)
         config_release_config();
     }
     else {
-        config_clear(config);
+        /* the old config is freed once the last reader is done with it */
         config_set_config(&new_config);
         config = config_get_config_unlocked();
         restart_logging (config);
         yp_recheck_config (config);
         fserve_recheck_mime_types (config);
         stats_global (config);
+        refbuf_set_memory_limit (config->queue_memory_limit);
         config_release_config();
         slave_update_all_mounts();
     }
@@ -0,0 +1,359 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* filecache.c
+ *
+ * Shared copies of intro and fallback files.  Each file is read once into
+ * a set of refbufs, listeners reference those blocks in turn rather than
+ * reading their own copy from disk.  Files too large to hold in memory are
+ * kept open and read a block at a time as listeners need them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "thread/thread.h"
+#include "avl/avl.h"
+
+#include "refbuf.h"
+#include "filecache.h"
+
+#define CATMODULE "filecache"
+
+#include "logging.h"
+
+/* same amount as a listener would of read from the file each time */
+#define FILECACHE_BLOCK     4096
+/* files are held in memory, anything larger is read from disk instead */
+#define FILECACHE_MAX_SIZE  (32*1024*1024)
+
+struct filecache_tag
+{
+    char *path;
+    int refcount;       /* changed with the tree locked */
+
+    /* the blocks are swapped under the lock when the file is reloaded */
+    spin_t lock;
+    time_t mtime;
+    off_t size;
+    refbuf_t **blocks;
+    unsigned int count;
+
+    /* set instead of the blocks for a file too large to cache, reads and
+     * swapping the file are done with file_lock held */
+    mutex_t file_lock;
+    FILE *file;
+};
+
+static avl_tree *filecache_tree;
+
+
+static int filecache_compare (void *arg, void *a, void *b)
+{
+    filecache_t *fc_a = a, *fc_b = b;
+
+    return strcmp (fc_a->path, fc_b->path);
+}
+
+
+static void filecache_free_blocks (refbuf_t **blocks, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        refbuf_release (blocks [i]);
+    free (blocks);
+}
+
+
+static int filecache_free (void *arg)
+{
+    filecache_t *fc = arg;
+
+    filecache_free_blocks (fc->blocks, fc->count);
+    if (fc->file)
+        fclose (fc->file);
+    thread_mutex_destroy (&fc->file_lock);
+    thread_spin_destroy (&fc->lock);
+    free (fc->path);
+    free (fc);
+    return 1;
+}
+
+
+/* read the whole file into blocks, st is filled in from the opened file so
+ * the size and time match what was read.  A file over the size limit is
+ * not read but returned open in file_p.  Returns 0 on success */
+static int filecache_load (const char *path, struct stat *st,
+        refbuf_t ***blocks_p, unsigned int *count_p, FILE **file_p)
+{
+    FILE *file = fopen (path, "rb");
+    refbuf_t **blocks = NULL;
+    unsigned int count = 0, total;
+
+    if (file == NULL)
+    {
+        WARN2 ("Cannot open file \"%s\": %s", path, strerror (errno));
+        return -1;
+    }
+    if (fstat (fileno (file), st) < 0)
+    {
+        fclose (file);
+        return -1;
+    }
+    *file_p = NULL;
+    if (st->st_size > FILECACHE_MAX_SIZE)
+    {
+        INFO2 ("file \"%s\" is larger than %d bytes, reading from disk", path, FILECACHE_MAX_SIZE);
+        *blocks_p = NULL;
+        *count_p = 0;
+        *file_p = file;
+        return 0;
+    }
+    total = (unsigned int)((st->st_size + FILECACHE_BLOCK - 1) / FILECACHE_BLOCK);
+    if (total)
+    {
+        blocks = calloc (total, sizeof (refbuf_t *));
+        if (blocks == NULL)
+        {
+            fclose (file);
+            return -1;
+        }
+    }
+    while (count < total)
+    {
+        refbuf_t *refbuf = refbuf_new (FILECACHE_BLOCK);
+        size_t bytes = fread (refbuf->data, 1, FILECACHE_BLOCK, file);
+
+        if (bytes == 0)
+        {
+            /* file shrunk while reading, keep what we have */
+            refbuf_release (refbuf);
+            break;
+        }
+        refbuf->len = (unsigned int)bytes;
+        refbuf_account (refbuf, REFBUF_MEM_INTRO);
+        blocks [count++] = refbuf;
+    }
+    fclose (file);
+    *blocks_p = blocks;
+    *count_p = count;
+    DEBUG2 ("loaded %s, %u blocks", path, count);
+    return 0;
+}
+
+
+/* reload the file if it has changed.  Listeners already holding blocks of
+ * the old contents keep them until released */
+static void filecache_check (filecache_t *fc)
+{
+    struct stat st;
+    refbuf_t **blocks, **old;
+    unsigned int count, old_count;
+    FILE *file, *old_file;
+
+    if (stat (fc->path, &st) < 0 || (st.st_mtime == fc->mtime && st.st_size == fc->size))
+        return;
+    if (filecache_load (fc->path, &st, &blocks, &count, &file) < 0)
+        return;
+    INFO1 ("file %s has changed, reloaded", fc->path);
+
+    thread_mutex_lock (&fc->file_lock);
+    thread_spin_lock (&fc->lock);
+    old = fc->blocks;
+    old_count = fc->count;
+    old_file = fc->file;
+    fc->blocks = blocks;
+    fc->count = count;
+    fc->file = file;
+    thread_spin_unlock (&fc->lock);
+    thread_mutex_unlock (&fc->file_lock);
+    fc->mtime = st.st_mtime;
+    fc->size = st.st_size;
+    filecache_free_blocks (old, old_count);
+    if (old_file)
+        fclose (old_file);
+}
+
+
+void filecache_initialize (void)
+{
+    filecache_tree = avl_tree_new (filecache_compare, NULL);
+}
+
+
+void filecache_shutdown (void)
+{
+    avl_tree_free (filecache_tree, filecache_free);
+    filecache_tree = NULL;
+}
+
+
+/* check the cached files for changes, called periodically from a thread
+ * which is not serving clients as a reload reads the whole file */
+void filecache_recheck (void)
+{
+    filecache_t **list = NULL;
+    unsigned int count = 0, i;
+    avl_node *node;
+
+    if (filecache_tree == NULL)
+        return;
+    /* take a reference on each so the tree is not locked while reading */
+    avl_tree_wlock (filecache_tree);
+    if (filecache_tree->length)
+        list = calloc (filecache_tree->length, sizeof (filecache_t *));
+    for (node = avl_get_first (filecache_tree); list && node; node = avl_get_next (node))
+    {
+        filecache_t *fc = node->key;
+
+        fc->refcount++;
+        list [count++] = fc;
+    }
+    avl_tree_unlock (filecache_tree);
+
+    for (i = 0; i < count; i++)
+    {
+        filecache_check (list [i]);
+        filecache_release (list [i]);
+    }
+    free (list);
+}
+
+
+/* get the shared copy of the file at path, loading it if no other mount
+ * refers to it.  Returns NULL if the file cannot be read */
+filecache_t *filecache_open (const char *path)
+{
+    filecache_t search, *fc = NULL;
+    void *result;
+    struct stat st;
+    refbuf_t **blocks;
+    unsigned int count;
+    FILE *file;
+
+    search.path = (char *)path;
+    avl_tree_wlock (filecache_tree);
+    if (avl_get_by_key (filecache_tree, &search, &result) == 0)
+    {
+        fc = result;
+        fc->refcount++;
+    }
+    avl_tree_unlock (filecache_tree);
+    if (fc)
+        return fc;
+
+    if (filecache_load (path, &st, &blocks, &count, &file) < 0)
+        return NULL;
+    fc = calloc (1, sizeof (filecache_t));
+    if (fc == NULL)
+    {
+        filecache_free_blocks (blocks, count);
+        if (file)
+            fclose (file);
+        return NULL;
+    }
+    fc->path = strdup (path);
+    fc->refcount = 1;
+    fc->mtime = st.st_mtime;
+    fc->size = st.st_size;
+    fc->blocks = blocks;
+    fc->count = count;
+    fc->file = file;
+    thread_spin_create (&fc->lock);
+    thread_mutex_create (&fc->file_lock);
+
+    avl_tree_wlock (filecache_tree);
+    if (avl_get_by_key (filecache_tree, &search, &result) == 0)
+    {
+        /* loaded at the same time elsewhere, use that one */
+        filecache_free (fc);
+        fc = result;
+        fc->refcount++;
+    }
+    else
+        avl_insert (filecache_tree, fc);
+    avl_tree_unlock (filecache_tree);
+    return fc;
+}
+
+
+void filecache_release (filecache_t *fc)
+{
+    /* anything left after shutdown has already been freed */
+    if (fc == NULL || filecache_tree == NULL)
+        return;
+    avl_tree_wlock (filecache_tree);
+    fc->refcount--;
+    if (fc->refcount == 0)
+    {
+        DEBUG1 ("dropping cached %s", fc->path);
+        avl_delete (filecache_tree, fc, filecache_free);
+    }
+    avl_tree_unlock (filecache_tree);
+}
+
+
+/* read the block at offset from a file too large to cache, the caller
+ * holds file_lock */
+static refbuf_t *filecache_read_block (filecache_t *fc, uint64_t offset)
+{
+    refbuf_t *refbuf;
+    size_t bytes;
+
+    if (fseek (fc->file, (long)offset, SEEK_SET) < 0)
+        return NULL;
+    refbuf = refbuf_new (FILECACHE_BLOCK);
+    bytes = fread (refbuf->data, 1, FILECACHE_BLOCK, fc->file);
+    if (bytes == 0)
+    {
+        refbuf_release (refbuf);
+        return NULL;
+    }
+    refbuf->len = (unsigned int)bytes;
+    refbuf_account (refbuf, REFBUF_MEM_INTRO);
+    return refbuf;
+}
+
+
+refbuf_t *filecache_get_block (filecache_t *fc, uint64_t offset)
+{
+    uint64_t block = offset / FILECACHE_BLOCK;
+    refbuf_t *refbuf = NULL;
+
+    thread_spin_lock (&fc->lock);
+    if (fc->file == NULL)
+    {
+        if (block < fc->count)
+        {
+            refbuf = fc->blocks [block];
+            refbuf_addref (refbuf);
+        }
+        thread_spin_unlock (&fc->lock);
+        return refbuf;
+    }
+    thread_spin_unlock (&fc->lock);
+
+    thread_mutex_lock (&fc->file_lock);
+    if (fc->file)
+        refbuf = filecache_read_block (fc, offset);
+    thread_mutex_unlock (&fc->file_lock);
+    return refbuf;
+}
@@ -0,0 +1,39 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include "refbuf.h"
+
+typedef struct filecache_tag filecache_t;
+
+/* Intro and fallback files held in memory, once per path however many
+ * mounts refer to them.  The contents are split into refbufs which
+ * listeners reference directly, and are reloaded in the background when
+ * the file changes.  Files too large to hold are read from disk instead.
+ */
+void filecache_initialize (void);
+void filecache_shutdown (void);
+
+/* reload changed files, not to be called from a thread serving clients */
+void filecache_recheck (void);
+
+/* may read the whole file, so best called without other locks held */
+filecache_t *filecache_open (const char *path);
+void filecache_release (filecache_t *fc);
+
+/* the block starting at offset, with a reference added for the caller,
+ * or NULL at the end of the file */
+refbuf_t *filecache_get_block (filecache_t *fc, uint64_t offset);
+
+#endif  /* __FILECACHE_H__ */
@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifdef HAVE_STRINGS_H
 # include <strings.h>
 #endif
@@ -41,6 +42,8 @@
 #include "format_ogg.h"
 #include "format_mp3.h"
 #include "format_ebml.h"
+#include "timeshift.h"
+#include "filecache.h"
 
 #include "logging.h"
 #include "stats.h"
@@ -109,63 +112,28 @@ int format_get_plugin(format_type_t type, source_t *source)
 
 
 /* clients need to be start from somewhere in the queue so we will look for
- * a refbuf which has been previously marked as a sync point. 
+ * a refbuf which has been previously marked as a sync point. Any intro
+ * already sent counts against the burst, and we only want to attempt a
+ * burst at connection time, not midstream, so moved clients (intro_offset
+ * of -1) start at the most recent sync point.
  */
 static void find_client_start (source_t *source, client_t *client)
 {
-    refbuf_t *refbuf = source->burst_point;
-
-    /* we only want to attempt a burst at connection time, not midstream
-     * however streams like theora may not have the most recent page marked as
-     * a starting point, so look for one from the burst point */
-    if (client->intro_offset == -1 && source->stream_data_tail
-            && source->stream_data_tail->sync_point)
-        refbuf = source->stream_data_tail;
-    else
-    {
-        size_t size = client->intro_offset;
-        refbuf = source->burst_point;
-        while (size > 0 && refbuf && refbuf->next)
-        {
-            size -= refbuf->len;
-            refbuf = refbuf->next;
-        }
-    }
+    refbuf_t *refbuf = source_find_sync_point (source, client->intro_offset, NULL);
 
-    while (refbuf)
+    if (refbuf)
     {
-        if (refbuf->sync_point)
-        {
-            client_set_queue (client, refbuf);
-            client->check_buffer = format_advance_queue;
-            client->write_to_client = source->format->write_buf_to_client;
-            client->intro_offset = -1;
-            break;
-        }
-        refbuf = refbuf->next;
+        client_set_queue (client, refbuf);
+        client->check_buffer = format_advance_queue;
+        client->write_to_client = source->format->write_buf_to_client;
+        client->intro_offset = -1;
     }
 }
 
 
-static int get_file_data (FILE *intro, client_t *client)
-{
-    refbuf_t *refbuf = client->refbuf;
-    size_t bytes;
-
-    if (intro == NULL || fseek (intro, client->intro_offset, SEEK_SET) < 0)
-        return 0;
-    bytes = fread (refbuf->data, 1, 4096, intro);
-    if (bytes == 0)
-        return 0;
-
-    refbuf->len = (unsigned int)bytes;
-    return 1;
-}
-
-
-/* call to check the buffer contents for file reading. move the client
- * to right place in the queue at end of file else repeat file if queue
- * is not ready yet.
+/* call to check the buffer contents for file reading. The client refers
+ * to the shared file blocks in turn, moving to the right place in the
+ * queue at end of file else repeating the file if queue is not ready yet.
  */
 int format_check_file_buffer (source_t *source, client_t *client)
 {
@@ -179,33 +147,54 @@ int format_check_file_buffer (source_t *source, client_t *client)
             find_client_start (source, client);
             return -1;
         }
-        /* source -> file fallback, need a refbuf for data */
-        refbuf = refbuf_new (PER_CLIENT_REFBUF_SIZE);
-        client->refbuf = refbuf;
-        client->pos = refbuf->len;
+        /* source -> file fallback, start at the beginning */
         client->intro_offset = 0;
     }
-    if (client->pos == refbuf->len)
+    else if (client->pos < refbuf->len)
+        return 0;
+
+    refbuf = NULL;
+    if (source->intro_file)
+        refbuf = filecache_get_block (source->intro_file, client->intro_offset);
+    if (refbuf)
     {
-        if (get_file_data (source->intro_file, client))
-        {
-            client->pos = 0;
-            client->intro_offset += refbuf->len;
-        }
-        else
-        {
-            if (source->stream_data_tail)
-            {
-                /* better find the right place in queue for this client */
-                client_set_queue (client, NULL);
-                find_client_start (source, client);
-            }
-            else
-                client->intro_offset = 0;  /* replay intro file */
-            return -1;
-        }
+        client->intro_offset += refbuf->len;
+        client_set_queue (client, refbuf);
+        refbuf_release (refbuf);
+        return 0;
     }
-    return 0;
+    if (source->stream_data_tail)
+    {
+        /* better find the right place in queue for this client */
+        client_set_queue (client, NULL);
+        find_client_start (source, client);
+    }
+    else
+        client->intro_offset = 0;  /* replay intro file */
+    return -1;
+}
+
+
+/* a listener can ask to start some seconds in the past, eg ?t=-600, if the
+ * mount keeps a timeshift ring.  It reads from the ring from then on.
+ */
+static void format_check_timeshift (source_t *source, client_t *client)
+{
+    const char *t;
+    long seconds;
+    uint64_t offset;
+
+    if (source->timeshift == NULL)
+        return;
+    t = httpp_get_query_param (client->parser, "t");
+    if (t == NULL || (seconds = atol (t)) >= 0)
+        return;
+    if (timeshift_find (source->timeshift, time (NULL) + seconds, &offset) < 0)
+        return;
+    timeshift_addref (source->timeshift);
+    client->timeshift = source->timeshift;
+    client->timeshift_pos = offset;
+    DEBUG2 ("client %lu starting %ld seconds back", client->con->id, -seconds);
 }
 
 
@@ -223,6 +212,7 @@ int format_check_http_buffer (source_t *source, client_t *client)
     {
         DEBUG0("processing pending client headers");
 
+        format_check_timeshift (source, client);
         if (format_prepare_headers (source, client) < 0)
         {
             ERROR0 ("internal problem, dropping client");
@@ -230,13 +220,20 @@ int format_check_http_buffer (source_t *source, client_t *client)
             return -1;
         }
         client->respcode = 200;
-        stats_event_inc (NULL, "listeners");
-        stats_event_inc (NULL, "listener_connections");
-        stats_event_inc (source->mount, "listener_connections");
+        stats_global_inc (STATS_LISTENERS);
+        stats_global_inc (STATS_LISTENER_CONNECTIONS);
+        stats_counter_inc (source->listener_connections_stat);
     }
 
     if (client->pos == refbuf->len)
     {
+        if (client->timeshift)
+        {
+            client_set_queue (client, NULL);
+            client->write_to_client = timeshift_write_to_client;
+            client->check_buffer = timeshift_check_buffer;
+            return -1;
+        }
         client->write_to_client = source->format->write_buf_to_client;
         client->check_buffer = format_check_file_buffer;
         client->intro_offset = 0;
@@ -247,6 +244,59 @@ int format_check_http_buffer (source_t *source, client_t *client)
 }
 
 
+/* Send from the client position onward through the following queued
+ * buffers with one vectored write, then move the client along the queue by
+ * the amount written.  If same_associated is set then the gathering stops
+ * at a buffer with different associated data.  Returns the bytes written,
+ * 0 if there was nothing to send or -1.
+ */
+int format_write_queue (client_t *client, int same_associated)
+{
+    struct iovec iov [FORMAT_IOV_MAX];
+    refbuf_t *segment [FORMAT_IOV_MAX];
+    refbuf_t *refbuf = client->refbuf;
+    unsigned int pos = client->pos;
+    size_t total = 0;
+    int count = 0, ret, i;
+
+    while (count < FORMAT_IOV_MAX && total < FORMAT_IOV_BYTES)
+    {
+        if (pos < refbuf->len)
+        {
+            segment [count] = refbuf;
+            iov [count].iov_base = refbuf->data + pos;
+            iov [count].iov_len = refbuf->len - pos;
+            total += iov [count++].iov_len;
+        }
+        if (refbuf->next == NULL)
+            break;
+        if (same_associated && refbuf->next->associated != refbuf->associated)
+            break;
+        refbuf = refbuf->next;
+        pos = 0;
+    }
+    if (count == 0)
+        return 0;
+
+    ret = client_send_vector (client, iov, count);
+    if (ret <= 0)
+        return ret;
+
+    for (i = 0, total = ret; i < count && total; i++)
+    {
+        size_t len = iov[i].iov_len;
+
+        if (len > total)
+            len = total;
+        total -= len;
+        if (segment [i] != client->refbuf)
+            client_set_queue (client, segment [i]);
+        client->pos += len;
+    }
+    return ret;
+}
+
+
 int format_generic_write_to_client (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
@@ -254,6 +304,11 @@ int format_generic_write_to_client (client_t *client)
     const char *buf = refbuf->data + client->pos;
     unsigned int len = refbuf->len - client->pos;
 
+    /* stream data on the queue can go out several buffers at a time, other
+     * buffer chains (eg file serving) are not ours to walk */
+    if (client->check_buffer == format_advance_queue)
+        return format_write_queue (client, 0);
+
     ret = client_send_bytes (client, buf, len);
 
     if (ret > 0)
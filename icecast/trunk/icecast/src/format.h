@@ -57,11 +57,16 @@ typedef struct _format_plugin_tag
     void *_state;
 } format_plugin_t;
 
+/* limits on what a client writer gathers into one vectored write */
+#define FORMAT_IOV_MAX      16
+#define FORMAT_IOV_BYTES    65536
+
 format_type_t format_get_type(const char *contenttype);
 char *format_get_mimetype(format_type_t type);
 int format_get_plugin(format_type_t type, struct source_tag *source);
 
 int format_generic_write_to_client (client_t *client);
+int format_write_queue (client_t *client, int same_associated);
 int format_advance_queue (struct source_tag *source, client_t *client);
 int format_check_http_buffer (struct source_tag *source, client_t *client);
 int format_check_file_buffer (struct source_tag *source, client_t *client);
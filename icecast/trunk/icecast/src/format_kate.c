@@ -158,7 +158,7 @@ static refbuf_t *process_kate_page (ogg_state_t *ogg_info, ogg_codec_t *codec, o
            start whenever we have to, video's more important and in the majority
            of the cases it's ok if we lose an event we're seeking in the middle
            of, as we won't have display artifacts as we'd have with video */
-        codec->possible_start->sync_point = 1;
+        format_ogg_mark_sync (ogg_info, codec->possible_start);
         refbuf_release (codec->possible_start);
         codec->possible_start = NULL;
     }
@@ -312,136 +312,126 @@ static void mp3_set_title (source_t *source)
 }
 
 
-/* send the appropriate metadata, and return the number of bytes written
- * which is 0 or greater.  Check the client in_metadata value afterwards
- * to see if all metadata has been sent
+/* add the metadata block for this point in the stream to the write, a
+ * changed title is sent in full, else a single zero byte is used in its
+ * place.  offset is how much of the block has already been sent.
  */
-static int send_stream_metadata (client_t *client, refbuf_t *associated)
+static size_t mp3_meta_block (struct iovec *iov, refbuf_t *associated,
+        refbuf_t *last_sent, unsigned int offset)
 {
-    int ret = 0;
-    char *metadata;
-    int meta_len;
-    mp3_client_data *client_mp3 = client->format_data;
+    static char no_change[] = "\0";
+    static char blank_title[] = "\001StreamTitle='';";
 
-    /* If there is a change in metadata then send it else
-     * send a single zero value byte in its place
-     */
-    if (associated && associated != client_mp3->associated)
+    if (associated && associated != last_sent)
     {
-        metadata = associated->data + client_mp3->metadata_offset;
-        meta_len = associated->len - client_mp3->metadata_offset;
+        iov->iov_base = associated->data + offset;
+        iov->iov_len = associated->len - offset;
     }
-    else
+    else if (associated)
     {
-        if (associated)
-        {
-            metadata = "\0";
-            meta_len = 1;
-        }
-        else
-        {
-            char *meta = "\001StreamTitle='';";
-            metadata = meta + client_mp3->metadata_offset;
-            meta_len = 17 - client_mp3->metadata_offset;
-        }
+        iov->iov_base = no_change;
+        iov->iov_len = 1;
     }
-    ret = client_send_bytes (client, metadata, meta_len);
-
-    if (ret == meta_len)
+    else
     {
-        client_mp3->associated = associated;
-        client_mp3->metadata_offset = 0;
-        client_mp3->in_metadata = 0;
-        client_mp3->since_meta_block = 0;
-        return ret;
+        iov->iov_base = blank_title + offset;
+        iov->iov_len = 17 - offset;
     }
-    if (ret > 0)
-        client_mp3->metadata_offset += ret;
-    else
-        ret = 0;
-    client_mp3->in_metadata = 1;
-
-    return ret;
+    return iov->iov_len;
 }
 
 
 /* Handler for writing mp3 data to a client, taking into account whether
- * client has requested shoutcast style metadata updates
+ * client has requested shoutcast style metadata updates.  The mp3 from this
+ * and following queued buffers, and any metadata blocks due in between, are
+ * gathered up and sent with one vectored write.
  */
 static int format_mp3_write_buf_to_client(client_t *client)
 {
-    int ret, written = 0;
     mp3_client_data *client_mp3 = client->format_data;
-    refbuf_t *refbuf = client->refbuf;
-    char *buf = refbuf->data + client->pos;
-    unsigned int len = refbuf->len - client->pos;
-
-    do
+    struct iovec iov [FORMAT_IOV_MAX];
+    refbuf_t *segment [FORMAT_IOV_MAX];  /* NULL marks a metadata block */
+    refbuf_t *refbuf = client->refbuf, *last_sent = client_mp3->associated;
+    unsigned int pos = client->pos, since_meta = client_mp3->since_meta_block;
+    unsigned int meta_offset = client_mp3->metadata_offset;
+    int count = 0, ret, i;
+    size_t total = 0;
+
+    /* an unfinished metadata block, or one due before any more mp3 */
+    if (client_mp3->in_metadata ||
+            (client_mp3->interval && since_meta == client_mp3->interval))
     {
-        /* send any unwritten metadata to the client */
-        if (client_mp3->in_metadata)
-        {
-            refbuf_t *associated = refbuf->associated;
-            ret = send_stream_metadata (client, associated);
+        segment [count] = NULL;
+        total += mp3_meta_block (&iov [count++], refbuf->associated, last_sent, meta_offset);
+        last_sent = refbuf->associated;
+        since_meta = 0;
+    }
+    while (count < FORMAT_IOV_MAX-1 && total < FORMAT_IOV_BYTES)
+    {
+        unsigned int len;
 
-            if (client_mp3->in_metadata)
+        if (pos == refbuf->len)
+        {
+            /* only queued stream buffers are linked */
+            if (refbuf->next == NULL)
                 break;
-            written += ret;
+            refbuf = refbuf->next;
+            pos = 0;
+            continue;
         }
-        /* see if we need to send the current metadata to the client */
-        if (client_mp3->interval)
+        len = refbuf->len - pos;
+        if (client_mp3->interval && len > client_mp3->interval - since_meta)
+            len = client_mp3->interval - since_meta;
+        segment [count] = refbuf;
+        iov [count].iov_base = refbuf->data + pos;
+        iov [count++].iov_len = len;
+        total += len;
+        pos += len;
+        since_meta += len;
+
+        if (client_mp3->interval && since_meta == client_mp3->interval)
         {
-            unsigned int remaining = client_mp3->interval -
-                client_mp3->since_meta_block;
-
-            /* leading up to sending the metadata block */
-            if (remaining <= len)
-            {
-                /* send any mp3 before the metadata block */
-                if (remaining)
-                {
-                    ret = client_send_bytes (client, buf, remaining);
-
-                    if (ret > 0)
-                    {
-                        client_mp3->since_meta_block += ret;
-                        client->pos += ret;
-                    }
-                    if (ret < (int)remaining)
-                        break;
-                    written += ret;
-                }
-                ret = send_stream_metadata (client, refbuf->associated);
-                if (client_mp3->in_metadata)
-                    break;
-                written += ret;
-                buf += remaining;
-                len -= remaining;
-                /* limit how much mp3 we send if using small intervals */
-                if (len > client_mp3->interval)
-                    len = client_mp3->interval;
-            }
+            segment [count] = NULL;
+            total += mp3_meta_block (&iov [count++], refbuf->associated, last_sent, 0);
+            last_sent = refbuf->associated;
+            since_meta = 0;
         }
-        /* write any mp3, maybe after the metadata block */
-        if (len)
-        {
-            ret = client_send_bytes (client, buf, len);
+    }
+    if (count == 0)
+        return 0;
+
+    ret = client_send_vector (client, iov, count);
+    if (ret <= 0)
+        return ret;
+
+    /* now account for what was actually written */
+    for (i = 0, total = ret; i < count && total; i++)
+    {
+        size_t len = iov[i].iov_len;
 
-            if (ret > 0)
+        if (len > total)
+            len = total;
+        total -= len;
+        if (segment [i] == NULL)
+        {
+            if (len == iov[i].iov_len)
             {
-                client_mp3->since_meta_block += ret;
-                client->pos += ret;
+                client_mp3->associated = client->refbuf->associated;
+                client_mp3->metadata_offset = 0;
+                client_mp3->in_metadata = 0;
+                client_mp3->since_meta_block = 0;
+                continue;
             }
-            if (ret < (int)len)
-                break;
-            written += ret;
+            client_mp3->metadata_offset += len;
+            client_mp3->in_metadata = 1;
+            break;
         }
-        ret = 0;
-    } while (0);
-
-    if (ret > 0)
-        written += ret;
-    return written;
+        if (segment [i] != client->refbuf)
+            client_set_queue (client, segment [i]);
+        client->pos += len;
+        client_mp3->since_meta_block += len;
+    }
+    return ret;
 }
 
 static void format_mp3_free_plugin(format_plugin_t *self)
@@ -683,8 +673,9 @@ static int format_mp3_create_client_data(source_t *source, client_t *client)
 
     client->format_data = client_mp3;
     client->free_client_data = free_mp3_client_data;
+    /* the timeshift ring holds just the stream, without the metadata */
     metadata = httpp_getvar(client->parser, "icy-metadata");
-    if (metadata && atoi(metadata))
+    if (metadata && atoi(metadata) && client->timeshift == NULL)
     {
         if (source_mp3->interval >= 0)
             client_mp3->interval = source_mp3->interval;
@@ -129,6 +129,20 @@ void format_ogg_free_headers (ogg_state_t *ogg_info)
 }
 
 
+/* a codec has found that an earlier page, which may already be queued, is
+ * a starting point. The source is told about it when the next buffer is
+ * completed.
+ */
+void format_ogg_mark_sync (ogg_state_t *ogg_info, refbuf_t *refbuf)
+{
+    refbuf->sync_point = 1;
+    if (ogg_info->sync_marked)
+        refbuf_release (ogg_info->sync_marked);
+    refbuf_addref (refbuf);
+    ogg_info->sync_marked = refbuf;
+}
+
+
 /* release the memory used for the codec and header pages from the module */
 static void free_ogg_codecs (ogg_state_t *ogg_info)
 {
@@ -192,6 +206,8 @@ static void format_ogg_free_plugin (format_plugin_t *plugin)
 
     /* free memory associated with this plugin instance */
     free_ogg_codecs (state);
+    if (state->sync_marked)
+        refbuf_release (state->sync_marked);
     free (state->artist);
     free (state->title);
 
@@ -360,6 +376,15 @@ static refbuf_t *complete_buffer (source_t *source, refbuf_t *refbuf)
      * marking starting points */
     if (ogg_info->codec_sync == NULL)
         refbuf->sync_point = 1;
+
+    /* the new buffer itself is indexed as it is queued */
+    if (ogg_info->sync_marked)
+    {
+        if (ogg_info->sync_marked != refbuf)
+            source_sync_mark (source, ogg_info->sync_marked);
+        refbuf_release (ogg_info->sync_marked);
+        ogg_info->sync_marked = NULL;
+    }
     return refbuf;
 }
 
@@ -521,13 +546,12 @@ static int send_ogg_headers (client_t *client, refbuf_t *headers)
 
 
 /* main client write routine for sending ogg data. Each refbuf has a
- * single page so we only need to determine if there are new headers
+ * single page so we only need to determine if there are new headers,
+ * following pages with the same headers are sent along in the same write
  */
 static int write_buf_to_client (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
-    char *buf = refbuf->data + client->pos;
-    unsigned len = refbuf->len - client->pos;
     struct ogg_client *client_data = client->format_data;
     int ret, written = 0;
 
@@ -540,20 +564,11 @@ static int write_buf_to_client (client_t *client)
                 break;
             written += ret;
         }
-        ret = client_send_bytes (client, buf, len);
-
+        ret = format_write_queue (client, 1);
         if (ret > 0)
-            client->pos += ret;
-
-        if (ret < (int)len)
-            break;
-        written += ret;
-        /* we have now written the page(s) */
-        ret = 0;
+            written += ret;
     } while (0);
 
-    if (ret > 0)
-       written += ret;
     return written;
 }
 
@@ -41,6 +41,7 @@ typedef struct ogg_state_tag
     long bitrate;
     struct ogg_codec_tag *current;
     struct ogg_codec_tag *codec_sync;
+    refbuf_t *sync_marked;
 } ogg_state_t;
 
 
@@ -65,6 +66,7 @@ typedef struct ogg_codec_tag
 refbuf_t *make_refbuf_with_page (ogg_page *page);
 void format_ogg_attach_header (ogg_state_t *ogg_info, ogg_page *page);
 void format_ogg_free_headers (ogg_state_t *ogg_info);
+void format_ogg_mark_sync (ogg_state_t *ogg_info, refbuf_t *refbuf);
 int format_ogg_get_plugin (source_t *source);
 
 #endif  /* __FORMAT_OGG_H__ */
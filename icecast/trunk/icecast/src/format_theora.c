@@ -134,7 +134,7 @@ static refbuf_t *process_theora_page (ogg_state_t *ogg_info, ogg_codec_t *codec,
     theora->prev_granulepos = granulepos;
     if (has_keyframe && codec->possible_start)
     {
-        codec->possible_start->sync_point = 1;
+        format_ogg_mark_sync (ogg_info, codec->possible_start);
         refbuf_release (codec->possible_start);
         codec->possible_start = NULL;
     }
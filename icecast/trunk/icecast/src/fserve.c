@@ -22,7 +22,13 @@
 #include <sys/stat.h>
 #include <errno.h>
 
-#ifdef HAVE_POLL
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#elif defined(HAVE_POLL)
 #include <sys/poll.h>
 #endif
 
@@ -67,6 +73,17 @@
 
 #define BUFSIZE 4096
 
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#define FSERVE_SENDFILE
+/* most to hand to the kernel in one go, so other clients get a turn */
+#define FSERVE_SENDFILE_CHUNK (256*1024)
+#ifdef HAVE_OPENSSL
+#define fserve_plain_connection(con) ((con)->ssl == NULL)
+#else
+#define fserve_plain_connection(con) 1
+#endif
+#endif
+
 static fserve_t *active_list = NULL;
 static fserve_t *pending_list = NULL;
 
@@ -77,7 +94,11 @@ static volatile int run_fserv = 0;
 static unsigned int fserve_clients;
 static int client_tree_changed=0;
 
-#ifdef HAVE_POLL
+#if defined(HAVE_SYS_EPOLL_H)
+#define FSERVE_EPOLL_EVENTS 256
+static int epoll_fd = -1;
+static fserve_t *ready_list = NULL;
+#elif defined(HAVE_POLL)
 static struct pollfd *ufds = NULL;
 #else
 static fd_set fds;
@@ -101,6 +122,11 @@ void fserve_initialize(void)
     active_list = NULL;
     pending_list = NULL;
     thread_spin_create (&pending_lock);
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_fd = epoll_create (FSERVE_EPOLL_EVENTS);
+    if (epoll_fd < 0)
+        ERROR1 ("unable to create epoll descriptor: %s", strerror (errno));
+#endif
 
     fserve_recheck_mime_types (config);
     config_release_config();
@@ -132,10 +158,48 @@ void fserve_shutdown(void)
 
     thread_spin_unlock (&pending_lock);
     thread_spin_destroy (&pending_lock);
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd >= 0)
+        close (epoll_fd);
+    epoll_fd = -1;
+    ready_list = NULL;
+#endif
     INFO0("file serving stopped");
 }
 
-#ifdef HAVE_POLL
+#if defined(HAVE_SYS_EPOLL_H)
+/* edge triggered, so a client stays on the ready list until a write on it
+ * comes up short, only those clients are touched on each pass */
+int fserve_client_waiting (void)
+{
+    struct epoll_event events[FSERVE_EPOLL_EVENTS];
+    int i, count, timeout = 200;
+
+    if (fserve_clients == 0)
+    {
+        thread_spin_lock (&pending_lock);
+        if (pending_list == NULL)
+            run_fserv = 0;
+        thread_spin_unlock (&pending_lock);
+        return run_fserv ? 0 : -1;
+    }
+    if (ready_list)
+        timeout = 0;
+    count = epoll_wait (epoll_fd, events, FSERVE_EPOLL_EVENTS, timeout);
+    for (i = 0; i < count; i++)
+    {
+        fserve_t *fclient = events[i].data.ptr;
+
+        if (fclient->ready == 0)
+        {
+            fclient->ready = 1;
+            fclient->ready_next = ready_list;
+            ready_list = fclient;
+        }
+    }
+    return ready_list ? 1 : 0;
+}
+#elif defined(HAVE_POLL)
 int fserve_client_waiting (void)
 {
     fserve_t *fclient;
@@ -246,8 +310,28 @@ static int wait_for_fds(void)
             {
                 fserve_t *to_move = fclient;
                 fclient = fclient->next;
+                to_move->prev = NULL;
                 to_move->next = active_list;
+                if (active_list)
+                    active_list->prev = to_move;
                 active_list = to_move;
+#ifdef HAVE_SYS_EPOLL_H
+                {
+                    struct epoll_event ev;
+
+                    ev.events = EPOLLOUT | EPOLLET;
+                    ev.data.ptr = to_move;
+                    if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, to_move->client->con->sock, &ev) < 0)
+                        to_move->client->con->error = 1;
+                    if (to_move->client->con->error)
+                    {
+                        /* let the send pass drop it */
+                        to_move->ready = 1;
+                        to_move->ready_next = ready_list;
+                        ready_list = to_move;
+                    }
+                }
+#endif
                 client_tree_changed = 1;
                 fserve_clients++;
             }
@@ -262,73 +346,153 @@ static int wait_for_fds(void)
     return -1;
 }
 
-static void *fserv_thread_function(void *arg)
+/* take the client off the active list and finish with it */
+static void fserve_remove_client (fserve_t *fclient)
+{
+    if (fclient->prev)
+        fclient->prev->next = fclient->next;
+    else
+        active_list = fclient->next;
+    if (fclient->next)
+        fclient->next->prev = fclient->prev;
+#ifdef HAVE_SYS_EPOLL_H
+    /* the socket may live on if the client is handed back by a callback */
+    epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fclient->client->con->sock, NULL);
+#endif
+    fserve_clients--;
+    client_tree_changed = 1;
+    fserve_client_destroy (fclient);
+}
+
+#ifdef FSERVE_SENDFILE
+/* send file data straight from the page cache once any buffered data has
+ * gone, returns as fserve_send_chunk or 2 if the file is finished with */
+static int fserve_sendfile (fserve_t *fclient)
 {
-    fserve_t *fclient, **trail;
+    client_t *client = fclient->client;
+    ssize_t bytes = sendfile (client->con->sock, fileno (fclient->file),
+            &fclient->offset, FSERVE_SENDFILE_CHUNK);
+
+    if (bytes > 0)
+    {
+        client->con->sent_bytes += bytes;
+        return 1;
+    }
+    if (bytes == 0)
+        return 2;
+    if (sock_recoverable (sock_error()))
+        return 0;
+    if (errno == EINVAL || errno == ENOSYS)
+    {
+        /* file type not supported, carry on with buffered reads */
+        DEBUG1 ("sendfile not possible, %s", strerror (errno));
+        fclient->use_sendfile = 0;
+        if (fseeko (fclient->file, fclient->offset, SEEK_SET) == 0)
+            return 1;
+    }
+    client->con->error = 1;
+    return -1;
+}
+#endif
+
+/* Send what we can of the current chunk to the client, reading the next one
+ * from the file if needed.  Returns -1 if the client is finished with, 1 if
+ * all of the chunk went out so more can be sent, else 0.
+ */
+static int fserve_send_chunk (fserve_t *fclient)
+{
+    client_t *client = fclient->client;
+    refbuf_t *refbuf = client->refbuf;
     size_t bytes;
 
+#ifdef FSERVE_SENDFILE
+    if (fclient->use_sendfile && client->pos == refbuf->len)
+    {
+        int ret = fserve_sendfile (fclient);
+        if (ret != 2)
+            return ret;
+        fclose (fclient->file);
+        fclient->file = NULL;
+        fclient->use_sendfile = 0;
+    }
+#endif
+    if (client->pos == refbuf->len)
+    {
+        /* Grab a new chunk */
+        if (fclient->file)
+            bytes = fread (refbuf->data, 1, BUFSIZE, fclient->file);
+        else
+            bytes = 0;
+        if (bytes == 0)
+        {
+            if (refbuf->next == NULL)
+                return -1;
+            refbuf = refbuf->next;
+            client->refbuf->next = NULL;
+            refbuf_release (client->refbuf);
+            client->refbuf = refbuf;
+            bytes = refbuf->len;
+        }
+        refbuf->len = (unsigned int)bytes;
+        client->pos = 0;
+    }
+
+    /* Now try and send current chunk. */
+    format_generic_write_to_client (client);
+
+    if (client->con->error)
+        return -1;
+    return client->pos == refbuf->len ? 1 : 0;
+}
+
+static void *fserv_thread_function(void *arg)
+{
+    fserve_t *fclient;
+
     while (1)
     {
         if (wait_for_fds() < 0)
             break;
 
-        fclient = active_list;
-        trail = &active_list;
+#ifdef HAVE_SYS_EPOLL_H
+        fclient = ready_list;
+        ready_list = NULL;
+        while (fclient)
+        {
+            fserve_t *next = fclient->ready_next;
+            int ret = fserve_send_chunk (fclient);
 
+            if (ret < 0)
+                fserve_remove_client (fclient);
+            else if (ret > 0)
+            {
+                /* still writable, so keep it ready for the next pass */
+                fclient->ready_next = ready_list;
+                ready_list = fclient;
+            }
+            else
+                fclient->ready = 0;
+            fclient = next;
+        }
+#else
+        fclient = active_list;
         while (fclient)
         {
             /* process this client, if it is ready */
             if (fclient->ready)
             {
-                client_t *client = fclient->client;
-                refbuf_t *refbuf = client->refbuf;
                 fclient->ready = 0;
-                if (client->pos == refbuf->len)
-                {
-                    /* Grab a new chunk */
-                    if (fclient->file)
-                        bytes = fread (refbuf->data, 1, BUFSIZE, fclient->file);
-                    else
-                        bytes = 0;
-                    if (bytes == 0)
-                    {
-                        if (refbuf->next == NULL)
-                        {
-                            fserve_t *to_go = fclient;
-                            fclient = fclient->next;
-                            *trail = fclient;
-                            fserve_client_destroy (to_go);
-                            fserve_clients--;
-                            client_tree_changed = 1;
-                            continue;
-                        }
-                        refbuf = refbuf->next;
-                        client->refbuf->next = NULL;
-                        refbuf_release (client->refbuf);
-                        client->refbuf = refbuf;
-                        bytes = refbuf->len;
-                    }
-                    refbuf->len = (unsigned int)bytes;
-                    client->pos = 0;
-                }
-
-                /* Now try and send current chunk. */
-                format_generic_write_to_client (client);
-
-                if (client->con->error)
+                if (fserve_send_chunk (fclient) < 0)
                 {
                     fserve_t *to_go = fclient;
                     fclient = fclient->next;
-                    *trail = fclient;
-                    fserve_clients--;
-                    fserve_client_destroy (to_go);
-                    client_tree_changed = 1;
+                    fserve_remove_client (to_go);
                     continue;
                 }
             }
-            trail = &fclient->next;
             fclient = fclient->next;
         }
+#endif
     }
     DEBUG0 ("fserve handler exit");
     return NULL;
@@ -601,7 +765,7 @@ int fserve_client_create (client_t *httpclient, const char *path)
     httpclient->refbuf->len = bytes;
     httpclient->pos = 0;
 
-    stats_event_inc (NULL, "file_connections");
+    stats_global_inc (STATS_FILE_CONNECTIONS);
     fserve_add_client (httpclient, file);
 
     return 0;
@@ -621,6 +785,12 @@ fail:
  */
 static void fserve_add_pending (fserve_t *fclient)
 {
+    refbuf_t *refbuf = fclient->client->refbuf;
+
+    /* the buffers held while sending count towards the queue memory */
+    for (; refbuf; refbuf = refbuf->next)
+        refbuf_account (refbuf, REFBUF_MEM_FSERVE);
+
     thread_spin_lock (&pending_lock);
     fclient->next = (fserve_t *)pending_list;
     pending_list = fclient;
@@ -650,6 +820,15 @@ int fserve_add_client (client_t *client, FILE *file)
     fclient->file = file;
     fclient->client = client;
     fclient->ready = 0;
+#ifdef FSERVE_SENDFILE
+    /* TLS needs the data to pass through the library so stay buffered */
+    if (file && fserve_plain_connection (client->con))
+    {
+        fclient->offset = ftello (file);
+        if (fclient->offset >= 0)
+            fclient->use_sendfile = 1;
+    }
+#endif
     fserve_add_pending (fclient);
 
     return 0;
@@ -14,6 +14,7 @@
 #define __FSERVE_H__
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "cfgfile.h"
 
 typedef void (*fserve_callback_t)(client_t *, void *);
@@ -23,10 +24,14 @@ typedef struct _fserve_t
     client_t *client;
 
     FILE *file;
+    off_t offset;       /* file position when using sendfile */
+    int use_sendfile;
     int ready;
     void (*callback)(client_t *, void *);
     void *arg;
     struct _fserve_t *next;
+    struct _fserve_t *prev;
+    struct _fserve_t *ready_next;
 } fserve_t;
 
 void fserve_initialize(void);
@@ -0,0 +1,316 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* ipfilter.c
+ *
+ * The address sets used for the allow and deny files.  Each entry is an
+ * address with an optional prefix length, eg 192.168.0.0/16 or 2001:db8::/32,
+ * and a lookup walks at most one node per differing bit of the address.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#endif
+
+#include "thread/thread.h"
+#include "net/sock.h"
+
+#include "ipfilter.h"
+
+#define IP_KEY_LEN      16
+#define IP_KEY_BITS     (IP_KEY_LEN*8)
+#define IP_BLOCK_NODES  64
+
+typedef struct ip_node_tag
+{
+    unsigned char addr [IP_KEY_LEN];
+    unsigned short bits;        /* prefix length of this node */
+    unsigned short terminal;    /* prefix is an entry in the set */
+    struct ip_node_tag *child [2];
+} ip_node_t;
+
+/* nodes are handed out from blocks so the tree is freed in a few calls */
+typedef struct ip_block_tag
+{
+    struct ip_block_tag *next;
+    unsigned int used;
+    ip_node_t nodes [IP_BLOCK_NODES];
+} ip_block_t;
+
+struct ip_tree_tag
+{
+    int refcount;
+    unsigned int entries;
+    ip_node_t *root;
+    ip_block_t *blocks;
+};
+
+
+#define ip_key_bit(k,b)     (((k)[(b)>>3] >> (7 - ((b)&7))) & 1)
+
+/* number of leading bits, up to max, which are the same in both keys */
+static unsigned int ip_key_common (const unsigned char *a, const unsigned char *b, unsigned int max)
+{
+    unsigned int i, bits = 0;
+
+    for (i = 0; bits < max; i++, bits += 8)
+    {
+        unsigned char diff = a[i] ^ b[i];
+        if (diff)
+        {
+            while ((diff & 0x80) == 0)
+            {
+                diff <<= 1;
+                bits++;
+            }
+            break;
+        }
+    }
+    return bits < max ? bits : max;
+}
+
+
+static void ip_key_mask (unsigned char *key, unsigned int bits)
+{
+    unsigned int i = bits >> 3;
+
+    if (i >= IP_KEY_LEN)
+        return;
+    if (bits & 7)
+        key[i++] &= (unsigned char)(0xFF << (8 - (bits & 7)));
+    memset (key+i, 0, IP_KEY_LEN-i);
+}
+
+
+static void ip_key_map4 (unsigned char *key, const void *in4)
+{
+    memset (key, 0, 10);
+    key[10] = key[11] = 0xFF;
+    memcpy (key+12, in4, 4);
+}
+
+
+static ip_node_t *ip_node_new (ip_tree_t *tree, const unsigned char *key, unsigned int bits, int terminal)
+{
+    ip_block_t *block = tree->blocks;
+    ip_node_t *node;
+
+    if (block == NULL || block->used == IP_BLOCK_NODES)
+    {
+        block = calloc (1, sizeof (ip_block_t));
+        if (block == NULL)
+            return NULL;
+        block->next = tree->blocks;
+        tree->blocks = block;
+    }
+    node = &block->nodes [block->used++];
+    memcpy (node->addr, key, IP_KEY_LEN);
+    ip_key_mask (node->addr, bits);
+    node->bits = bits;
+    node->terminal = terminal;
+    return node;
+}
+
+
+ip_tree_t *ip_tree_create (void)
+{
+    ip_tree_t *tree = calloc (1, sizeof (ip_tree_t));
+
+    if (tree)
+        tree->refcount = 1;
+    return tree;
+}
+
+
+/* parse an address with optional /bits suffix into a key and prefix length */
+static int ip_parse_prefix (const char *prefix, unsigned char *key, unsigned int *bits)
+{
+    char str [MAX_ADDR_LEN+5], *slash;
+    size_t len = strlen (prefix);
+    unsigned int max, offset;
+
+    while (len && isspace ((unsigned char)prefix[len-1]))
+        len--;
+    if (len == 0 || len >= sizeof (str))
+        return -1;
+    memcpy (str, prefix, len);
+    str[len] = '\0';
+
+    slash = strchr (str, '/');
+    if (slash)
+        *slash++ = '\0';
+
+    if (strchr (str, ':'))
+    {
+#if defined(HAVE_INET_PTON) && defined(AF_INET6)
+        if (inet_pton (AF_INET6, str, key) <= 0)
+            return -1;
+        max = IP_KEY_BITS;
+        offset = 0;
+#else
+        return -1;
+#endif
+    }
+    else
+    {
+        struct in_addr in4;
+
+        if (inet_aton (str, &in4) == 0)
+            return -1;
+        ip_key_map4 (key, &in4);
+        max = 32;
+        offset = IP_KEY_BITS - 32;
+    }
+    *bits = max;
+    if (slash)
+    {
+        char *end;
+        long v = strtol (slash, &end, 10);
+
+        if (end == slash || *end || v < 0 || v > (long)max)
+            return -1;
+        *bits = (unsigned int)v;
+    }
+    *bits += offset;
+    return 0;
+}
+
+
+/* add an entry, returns -1 if the prefix could not be parsed */
+int ip_tree_add (ip_tree_t *tree, const char *prefix)
+{
+    unsigned char key [IP_KEY_LEN];
+    unsigned int bits;
+    ip_node_t **slot = &tree->root;
+
+    if (ip_parse_prefix (prefix, key, &bits) < 0)
+        return -1;
+
+    while (1)
+    {
+        ip_node_t *node = *slot, *leaf, *branch;
+        unsigned int common;
+
+        if (node == NULL)
+        {
+            if ((*slot = ip_node_new (tree, key, bits, 1)) == NULL)
+                return -1;
+            break;
+        }
+        common = ip_key_common (node->addr, key, node->bits < bits ? node->bits : bits);
+        if (common < node->bits)
+        {
+            /* the new entry diverges part way along this node, so insert
+             * either the entry itself or a branch above it */
+            if (common == bits)
+            {
+                leaf = ip_node_new (tree, key, bits, 1);
+                if (leaf == NULL)
+                    return -1;
+                leaf->child [ip_key_bit (node->addr, bits)] = node;
+                *slot = leaf;
+                break;
+            }
+            branch = ip_node_new (tree, key, common, 0);
+            leaf = ip_node_new (tree, key, bits, 1);
+            if (branch == NULL || leaf == NULL)
+                return -1;
+            branch->child [ip_key_bit (key, common)] = leaf;
+            branch->child [ip_key_bit (node->addr, common)] = node;
+            *slot = branch;
+            break;
+        }
+        if (node->bits == bits)
+        {
+            if (node->terminal)
+                return 0;   /* duplicate */
+            node->terminal = 1;
+            break;
+        }
+        if (node->terminal)
+            return 0;       /* already covered by a shorter prefix */
+        slot = &node->child [ip_key_bit (key, node->bits)];
+    }
+    tree->entries++;
+    return 0;
+}
+
+
+/* return non-zero if the address is covered by an entry in the tree */
+int ip_tree_match (ip_tree_t *tree, const struct sockaddr *sa)
+{
+    unsigned char key [IP_KEY_LEN];
+    const ip_node_t *node;
+
+    if (tree == NULL || sa == NULL)
+        return 0;
+    if (sa->sa_family == AF_INET)
+        ip_key_map4 (key, &((const struct sockaddr_in *)sa)->sin_addr);
+#ifdef AF_INET6
+    else if (sa->sa_family == AF_INET6)
+        memcpy (key, &((const struct sockaddr_in6 *)sa)->sin6_addr, IP_KEY_LEN);
+#endif
+    else
+        return 0;
+
+    node = tree->root;
+    while (node)
+    {
+        if (ip_key_common (node->addr, key, node->bits) < node->bits)
+            return 0;
+        if (node->terminal)
+            return 1;
+        node = node->child [ip_key_bit (key, node->bits)];
+    }
+    return 0;
+}
+
+
+unsigned int ip_tree_entries (ip_tree_t *tree)
+{
+    return tree ? tree->entries : 0;
+}
+
+
+void ip_tree_addref (ip_tree_t *tree)
+{
+    if (tree)
+        thread_atomic_add (&tree->refcount, 1);
+}
+
+
+void ip_tree_release (ip_tree_t *tree)
+{
+    if (tree == NULL || thread_atomic_sub (&tree->refcount, 1) > 0)
+        return;
+    while (tree->blocks)
+    {
+        ip_block_t *block = tree->blocks;
+        tree->blocks = block->next;
+        free (block);
+    }
+    free (tree);
+}
@@ -0,0 +1,31 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __IPFILTER_H__
+#define __IPFILTER_H__
+
+struct sockaddr;
+typedef struct ip_tree_tag ip_tree_t;
+
+/* A set of IPv4 and IPv6 address prefixes held in a path compressed binary
+ * trie.  IPv4 addresses are stored in their IPv4 mapped IPv6 form so one
+ * tree covers both families.  A tree is built by one thread and is then
+ * only read, it is freed when the last reference is released.
+ */
+ip_tree_t *ip_tree_create (void);
+int  ip_tree_add (ip_tree_t *tree, const char *prefix);
+int  ip_tree_match (ip_tree_t *tree, const struct sockaddr *sa);
+unsigned int ip_tree_entries (ip_tree_t *tree);
+void ip_tree_addref (ip_tree_t *tree);
+void ip_tree_release (ip_tree_t *tree);
+
+#endif  /* __IPFILTER_H__ */
@@ -66,6 +66,9 @@
 #include "logging.h"
 #include "xslt.h"
 #include "fserve.h"
+#include "workers.h"
+#include "timers.h"
+#include "filecache.h"
 #include "yp.h"
 #include "auth.h"
 
@@ -102,6 +105,7 @@ static void _print_usage(void)
 
 static void _stop_logging(void)
 {
+    log_async_stop();
     log_close(errorlog);
     log_close(accesslog);
     log_close(playlistlog);
@@ -117,6 +121,7 @@ void initialize_subsystems(void)
     connection_initialize();
     global_initialize();
     refbuf_initialize();
+    filecache_initialize();
 
     xslt_initialize();
 #ifdef HAVE_CURL_GLOBAL_INIT
@@ -129,12 +134,17 @@ void shutdown_subsystems(void)
     fserve_shutdown();
     refbuf_shutdown();
     slave_shutdown();
+    /* relay threads joined above detach from their workers and drop their
+     * cached files as they finish */
+    workers_shutdown();
+    filecache_shutdown();
     auth_shutdown();
     yp_shutdown();
     stats_shutdown();
 
     global_shutdown();
     connection_shutdown();
+    timers_shutdown();
     config_shutdown();
     resolver_shutdown();
     sock_shutdown();
@@ -481,6 +491,8 @@ int main(int argc, char **argv)
 
     stats_initialize(); /* We have to do this later on because of threading */
     fserve_initialize(); /* This too */
+    workers_initialize();
+    timers_initialize();
 
 #ifdef HAVE_SETUID 
     /* We'll only have getuid() if we also have setuid(), it's reasonable to
@@ -502,6 +514,9 @@ int main(int argc, char **argv)
         shutdown_subsystems();
         return 1;
     }
+    /* from here on log lines are written out by a separate thread */
+    if (log_async_start() < 0)
+        WARN0 ("log lines will be written directly");
 
     INFO1 ("%s server started", ICECAST_VERSION_STRING);
 
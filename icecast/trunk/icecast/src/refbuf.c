@@ -23,35 +23,141 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "thread/thread.h"
+
 #include "refbuf.h"
 
 #define CATMODULE "refbuf"
 
 #include "logging.h"
 
+/* Each refbuf is a single allocation, the header followed by the data.
+ * Requests are rounded up to one of these size classes and released blocks
+ * are kept on a per class free list for reuse, anything larger than the
+ * last class is allocated and freed directly.
+ */
+static const unsigned int refbuf_class_size[] = { 256, 1536, 4096, 8192, 16384 };
+
+#define REFBUF_CLASSES  (sizeof (refbuf_class_size) / sizeof (refbuf_class_size[0]))
+
+/* upper limit on the memory kept idle on each free list */
+#define REFBUF_POOL_MAX_FREE  (1024*1024)
+
+typedef struct
+{
+    spin_t lock;
+    unsigned int size;
+    unsigned int free_count;
+    unsigned int max_free;
+    refbuf_t *free_list;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t allocated;
+} refbuf_pool_t;
+
+static refbuf_pool_t refbuf_pools [REFBUF_CLASSES];
+static int refbuf_pools_active;
+
+/* bytes currently charged to each memory category, and the limit on the
+ * total, 0 for no limit */
+static uint64_t refbuf_memory [REFBUF_MEM_CATEGORIES];
+static uint64_t refbuf_memory_limit;
+
 
 void refbuf_initialize(void)
 {
+    unsigned int i;
+
+    for (i = 0; i < REFBUF_CLASSES; i++)
+    {
+        refbuf_pool_t *pool = &refbuf_pools[i];
+
+        memset (pool, 0, sizeof (refbuf_pool_t));
+        thread_spin_create (&pool->lock);
+        pool->size = refbuf_class_size[i];
+        pool->max_free = REFBUF_POOL_MAX_FREE / pool->size;
+    }
+    refbuf_pools_active = 1;
 }
 
+/* blocks still in use are freed directly when they are released, other
+ * subsystems shut down after this one may still be holding some */
 void refbuf_shutdown(void)
 {
+    unsigned int i;
+
+    if (refbuf_pools_active == 0)
+        return;
+    for (i = 0; i < REFBUF_CLASSES; i++)
+    {
+        refbuf_pool_t *pool = &refbuf_pools[i];
+
+        thread_spin_lock (&pool->lock);
+        while (pool->free_list)
+        {
+            refbuf_t *to_go = pool->free_list;
+            pool->free_list = to_go->next;
+            pool->allocated -= pool->size;
+            free (to_go);
+        }
+        pool->free_count = 0;
+        pool->max_free = 0;
+        thread_spin_unlock (&pool->lock);
+    }
+}
+
+
+static int refbuf_size_class (unsigned int size)
+{
+    unsigned int i;
+
+    if (refbuf_pools_active == 0)
+        return -1;
+    for (i = 0; i < REFBUF_CLASSES; i++)
+        if (size <= refbuf_class_size[i])
+            return i;
+    return -1;
 }
 
+
 refbuf_t *refbuf_new (unsigned int size)
 {
-    refbuf_t *refbuf;
+    refbuf_t *refbuf = NULL;
+    int class = refbuf_size_class (size);
+
+    if (class >= 0)
+    {
+        refbuf_pool_t *pool = &refbuf_pools[class];
+
+        thread_spin_lock (&pool->lock);
+        refbuf = pool->free_list;
+        if (refbuf)
+        {
+            pool->free_list = refbuf->next;
+            pool->free_count--;
+            pool->hits++;
+        }
+        else
+        {
+            pool->misses++;
+            pool->allocated += pool->size;
+        }
+        thread_spin_unlock (&pool->lock);
+
+        if (refbuf == NULL)
+            refbuf = malloc (sizeof (refbuf_t) + pool->size);
+    }
+    else
+        refbuf = malloc (sizeof (refbuf_t) + size);
 
-    refbuf = (refbuf_t *)malloc(sizeof(refbuf_t));
     if (refbuf == NULL)
         abort();
     refbuf->data = NULL;
     if (size)
-    {
-        refbuf->data = malloc (size);
-        if (refbuf->data == NULL)
-            abort();
-    }
+        refbuf->data = (char *)(refbuf + 1);
+    refbuf->pool = class;
+    refbuf->account = REFBUF_MEM_NONE;
+    refbuf->account_len = 0;
     refbuf->len = size;
     refbuf->sync_point = 0;
     refbuf->_count = 1;
@@ -61,9 +167,122 @@ refbuf_t *refbuf_new (unsigned int size)
     return refbuf;
 }
 
+
+/* hand the block back to its free list, or to the system */
+static void refbuf_free (refbuf_t *refbuf)
+{
+    if (refbuf->account)
+        thread_atomic_sub (&refbuf_memory [refbuf->account], refbuf->account_len);
+    if (refbuf->pool >= 0)
+    {
+        refbuf_pool_t *pool = &refbuf_pools [refbuf->pool];
+
+        thread_spin_lock (&pool->lock);
+        if (pool->free_count < pool->max_free)
+        {
+            refbuf->next = pool->free_list;
+            pool->free_list = refbuf;
+            pool->free_count++;
+            refbuf = NULL;
+        }
+        else
+            pool->allocated -= pool->size;
+        thread_spin_unlock (&pool->lock);
+    }
+    free (refbuf);
+}
+
+
+void refbuf_pool_stats (refbuf_pool_stats_t *stats)
+{
+    unsigned int i;
+
+    memset (stats, 0, sizeof (refbuf_pool_stats_t));
+    for (i = 0; i < REFBUF_CLASSES; i++)
+    {
+        refbuf_pool_t *pool = &refbuf_pools[i];
+
+        thread_spin_lock (&pool->lock);
+        stats->hits += pool->hits;
+        stats->misses += pool->misses;
+        stats->allocated += pool->allocated;
+        stats->free_bytes += (uint64_t)pool->free_count * pool->size;
+        thread_spin_unlock (&pool->lock);
+    }
+}
+
+/* charge the block to a memory category, replacing any previous one.  Only
+ * the holder of the block should do this, the charge is dropped when the
+ * block is freed.
+ */
+void refbuf_account (refbuf_t *refbuf, refbuf_memory_t category)
+{
+    if (refbuf == NULL || refbuf->account == (int)category)
+        return;
+    if (refbuf->account)
+        thread_atomic_sub (&refbuf_memory [refbuf->account], refbuf->account_len);
+    refbuf->account = category;
+    refbuf->account_len = 0;
+    if (category)
+    {
+        refbuf->account_len = refbuf->pool >= 0 ? refbuf_class_size [refbuf->pool] : refbuf->len;
+        thread_atomic_add (&refbuf_memory [category], refbuf->account_len);
+    }
+}
+
+
+/* adjust a category which is not charged per block */
+void refbuf_memory_add (refbuf_memory_t category, long bytes)
+{
+    if (bytes < 0)
+        thread_atomic_sub (&refbuf_memory [category], (uint64_t)-bytes);
+    else
+        thread_atomic_add (&refbuf_memory [category], (uint64_t)bytes);
+}
+
+
+uint64_t refbuf_memory_used (refbuf_memory_t category)
+{
+    return refbuf_memory [category];
+}
+
+
+/* the total held against the limit, the burst is part of the queue */
+uint64_t refbuf_memory_total (void)
+{
+    return refbuf_memory [REFBUF_MEM_QUEUE] + refbuf_memory [REFBUF_MEM_INTRO] +
+        refbuf_memory [REFBUF_MEM_FSERVE];
+}
+
+
+void refbuf_set_memory_limit (uint64_t limit)
+{
+    refbuf_memory_limit = limit;
+}
+
+
+/* how close the total is to the limit, 0 if there is room, 1 once past 90%
+ * of it, 2 when at or over the limit */
+int refbuf_memory_pressure (void)
+{
+    uint64_t limit = refbuf_memory_limit, used;
+
+    if (limit == 0)
+        return 0;
+    used = refbuf_memory_total ();
+    if (used >= limit)
+        return 2;
+    if (used >= limit - limit/10)
+        return 1;
+    return 0;
+}
+
+
+/* buffers on a stream queue are referenced from the source thread and any
+ * number of workers, so the count is only ever changed atomically */
 void refbuf_addref(refbuf_t *self)
 {
-    self->_count++;
+    thread_atomic_add (&self->_count, 1);
 }
 
 static void refbuf_release_associated (refbuf_t *ref)
@@ -84,14 +303,12 @@ void refbuf_release(refbuf_t *self)
 {
     if (self == NULL)
         return;
-    self->_count--;
-    if (self->_count == 0)
+    if (thread_atomic_sub (&self->_count, 1) == 0)
     {
         refbuf_release_associated (self->associated);
         if (self->next)
             ERROR0 ("next not null");
-        free(self->data);
-        free(self);
+        refbuf_free (self);
     }
 }
 
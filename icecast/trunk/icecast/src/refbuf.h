@@ -18,6 +18,8 @@
 #ifndef __REFBUF_H__
 #define __REFBUF_H__
 
+#include "compat.h"
+
 typedef struct _refbuf_tag
 {
     unsigned int len;
@@ -26,15 +28,50 @@ typedef struct _refbuf_tag
     struct _refbuf_tag *associated;
     struct _refbuf_tag *next;
     int sync_point;
+    int pool;   /* size class the block came from, -1 if not pooled */
+    int account;                /* memory category charged for this block */
+    unsigned int account_len;   /* bytes charged to that category */
 
 } refbuf_t;
 
+/* What buffers are held for, for the server wide queue memory budget. The
+ * burst is the part of the stream queue kept for new listeners so it is
+ * adjusted directly rather than charged by buffer, and is not counted again
+ * in the total.
+ */
+typedef enum
+{
+    REFBUF_MEM_NONE = 0,
+    REFBUF_MEM_QUEUE,       /* on a stream queue or still held by listeners */
+    REFBUF_MEM_BURST,
+    REFBUF_MEM_INTRO,       /* intro file data being sent to listeners */
+    REFBUF_MEM_FSERVE,      /* data being sent by the file server */
+    REFBUF_MEM_CATEGORIES
+} refbuf_memory_t;
+
+/* allocator counters, summed over all size classes */
+typedef struct
+{
+    uint64_t hits;          /* allocations satisfied from a free list */
+    uint64_t misses;        /* allocations that went to malloc */
+    uint64_t allocated;     /* bytes of pooled blocks currently held */
+    uint64_t free_bytes;    /* bytes of those sitting on free lists */
+} refbuf_pool_stats_t;
+
 void refbuf_initialize(void);
 void refbuf_shutdown(void);
 
 refbuf_t *refbuf_new(unsigned int size);
 void refbuf_addref(refbuf_t *self);
 void refbuf_release(refbuf_t *self);
+void refbuf_pool_stats (refbuf_pool_stats_t *stats);
+
+void refbuf_account (refbuf_t *refbuf, refbuf_memory_t category);
+void refbuf_memory_add (refbuf_memory_t category, long bytes);
+uint64_t refbuf_memory_used (refbuf_memory_t category);
+uint64_t refbuf_memory_total (void);
+void refbuf_set_memory_limit (uint64_t limit);
+int  refbuf_memory_pressure (void);
 
 #define PER_CLIENT_REFBUF_SIZE  4096
 
@@ -56,6 +56,7 @@
 #include "source.h"
 #include "format.h"
 #include "event.h"
+#include "filecache.h"
 
 #define CATMODULE "slave"
 
@@ -451,7 +452,22 @@ static void check_relay_stream (relay_server *relay)
             if (source->on_demand_req == 0)
                 break;
         }
+        /* on-demand starts wait while queue memory is short, whether from
+         * a fallback or a listener asking for it */
+        if (relay->on_demand && refbuf_memory_pressure ())
+        {
+            if (relay->refused == 0)
+            {
+                WARN1 ("queue memory is short, not starting on-demand relay %s",
+                        relay->localmount);
+                stats_global_inc (STATS_RELAYS_REFUSED);
+                relay->refused = 1;
+            }
+            relay->start = time(NULL) + 5;
+            break;
+        }
 
+        relay->refused = 0;
         relay->start = time(NULL) + 5;
         relay->running = 1;
         relay->thread = thread_create ("Relay Thread", start_relay_stream,
@@ -734,6 +750,7 @@ static void *_slave_thread(void *arg)
 
     config = config_get_config();
     stats_global (config);
+    refbuf_set_memory_limit (config->queue_memory_limit);
     config_release_config();
     source_recheck_mounts (1);
 
@@ -750,6 +767,11 @@ static void *_slave_thread(void *arg)
             global . schedule_config_reread = 0;
         }
         global_unlock();
+        /* old configs are cleared and changed intro, fallback, allow and
+         * deny files reloaded here rather than on a listener thread */
+        config_free_retired();
+        filecache_recheck();
+        connection_recheck_ip_files();
 
         thread_sleep (1000000);
         if (slave_running == 0)
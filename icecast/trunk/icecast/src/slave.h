@@ -28,6 +28,7 @@ typedef struct _relay_server {
     int on_demand;
     int running;
     int cleanup;
+    int refused;    /* start held back while queue memory is short */
     time_t start;
     thread_type *thread;
     struct _relay_server *next;
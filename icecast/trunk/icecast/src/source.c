@@ -21,6 +21,9 @@
 #include <sys/types.h>
 #include <ogg/ogg.h>
 #include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -51,17 +54,28 @@
 #include "format.h"
 #include "fserve.h"
 #include "auth.h"
+#include "workers.h"
+#include "timers.h"
+#include "timeshift.h"
+#include "filecache.h"
 #include "compat.h"
 
 #undef CATMODULE
 #define CATMODULE "source"
 
 #define MAX_FALLBACK_DEPTH 10
+#define SOURCE_SYNC_INITIAL 64
+#define SOURCE_SKIP_INTERVAL 10
+
+#ifdef HAVE_SYS_EPOLL_H
+#define SOURCE_EPOLL_EVENTS 64
+#define listener_blocked(source,client) ((source)->epoll_fd >= 0 && (client)->con->blocked)
+#else
+#define listener_blocked(source,client) 0
+#endif
 
 mutex_t move_clients_mutex;
 
-/* avl tree helper */
-static int _compare_clients(void *compare_arg, void *a, void *b);
 static int _free_client(void *key);
 static void _parse_audio_info (source_t *source, const char *s);
 static void source_shutdown (source_t *source);
@@ -71,6 +85,56 @@ static void source_shutdown (source_t *source);
 static void source_run_script (char *command, char *mountpoint);
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+/* listeners are registered edge triggered, so after a short write the
+ * listener is left alone until the socket reports as writable again */
+static void source_watch_listener (source_t *source, client_t *client)
+{
+    struct epoll_event ev;
+
+    if (source->epoll_fd < 0)
+        return;
+    client->con->blocked = 0;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.ptr = client;
+    if (epoll_ctl (source->epoll_fd, EPOLL_CTL_ADD, client->con->sock, &ev) < 0)
+    {
+        WARN2 ("unable to watch client %lu, %s", client->con->id, strerror (errno));
+        client->con->error = 1;
+    }
+}
+
+static void source_unwatch_listener (source_t *source, client_t *client)
+{
+    if (source->epoll_fd >= 0)
+        epoll_ctl (source->epoll_fd, EPOLL_CTL_DEL, client->con->sock, NULL);
+}
+
+/* unblock the listeners whose sockets have drained since the last pass */
+static void source_check_writable (source_t *source)
+{
+    struct epoll_event events [SOURCE_EPOLL_EVENTS];
+    int i, count;
+
+    if (source->epoll_fd < 0)
+        return;
+    do
+    {
+        count = epoll_wait (source->epoll_fd, events, SOURCE_EPOLL_EVENTS, 0);
+        for (i = 0; i < count; i++)
+        {
+            client_t *client = events[i].data.ptr;
+            client->con->blocked = 0;
+        }
+    } while (count == SOURCE_EPOLL_EVENTS);
+}
+#else
+#define source_watch_listener(source,client)
+#define source_unwatch_listener(source,client)
+#define source_check_writable(source)
+#endif
+
+
 /* Allocate a new source with the stated mountpoint, if one already
  * exists with that mountpoint in the global source tree then return
  * NULL.
@@ -97,13 +161,17 @@ source_t *source_reserve (const char *mount)
         if (src == NULL)
             break;
 
-        src->client_tree = avl_tree_new(_compare_clients, NULL);
-        src->pending_tree = avl_tree_new(_compare_clients, NULL);
+        src->client_list = client_list_create();
+        src->pending_list = client_list_create();
 
         /* make duplicates for strings or similar */
         src->mount = strdup (mount);
         src->max_listeners = -1;
+#ifdef HAVE_SYS_EPOLL_H
+        src->epoll_fd = -1;
+#endif
         thread_mutex_create(&src->lock);
+        thread_spin_create (&src->sync_lock);
 
         avl_insert (global.source_tree, src);
 
@@ -199,7 +267,7 @@ void source_clear_source (source_t *source)
 
     DEBUG1 ("clearing source \"%s\"", source->mount);
 
-    avl_tree_wlock (source->pending_tree);
+    client_list_wlock (source->pending_list);
     client_destroy(source->client);
     source->client = NULL;
     source->parser = NULL;
@@ -216,33 +284,36 @@ void source_clear_source (source_t *source)
         source->dumpfile = NULL;
     }
 
+    /* listeners still reading it hold their own reference */
+    timeshift_release (source->timeshift);
+    source->timeshift = NULL;
+
     /* lets kick off any clients that are left on here */
-    avl_tree_wlock (source->client_tree);
+    client_list_wlock (source->client_list);
     c=0;
-    while (1)
+    while (client_list_count (source->client_list))
     {
-        avl_node *node = avl_get_first (source->client_tree);
-        if (node)
-        {
-            client_t *client = node->key;
-            if (client->respcode == 200)
-                c++; /* only count clients that have had some processing */
-            avl_delete (source->client_tree, client, _free_client);
-            continue;
-        }
-        break;
+        client_t *client = client_list_get (source->client_list,
+                client_list_count (source->client_list) - 1);
+
+        if (client->respcode == 200)
+            c++; /* only count clients that have had some processing */
+        client_list_remove (source->client_list, client);
+        _free_client (client);
     }
     if (c)
     {
-        stats_event_sub (NULL, "listeners", source->listeners);
+        stats_global_add (STATS_LISTENERS, -(long)source->listeners);
         INFO2 ("%d active listeners on %s released", c, source->mount);
     }
-    avl_tree_unlock (source->client_tree);
+    client_list_unlock (source->client_list);
 
-    while (avl_get_first (source->pending_tree))
+    while (client_list_count (source->pending_list))
     {
-        avl_delete (source->pending_tree,
-                avl_get_first(source->pending_tree)->key, _free_client);
+        client_t *client = client_list_get (source->pending_list, 0);
+
+        client_list_remove (source->pending_list, client);
+        _free_client (client);
     }
 
     if (source->format && source->format->free_plugin)
@@ -261,10 +332,22 @@ void source_clear_source (source_t *source)
         refbuf_release (p);
     }
     source->stream_data_tail = NULL;
+    source->queue_offset = 0;
 
     source->burst_point = NULL;
     source->burst_size = 0;
+    refbuf_memory_add (REFBUF_MEM_BURST, -(long)source->burst_offset);
     source->burst_offset = 0;
+
+    thread_spin_lock (&source->sync_lock);
+    free (source->sync_index);
+    source->sync_index = NULL;
+    source->sync_size = 0;
+    source->sync_start = 0;
+    source->sync_count = 0;
+    source->stream_offset = 0;
+    source->burst_start = 0;
+    thread_spin_unlock (&source->sync_lock);
     source->queue_size = 0;
     source->queue_size_limit = 0;
     source->listeners = 0;
@@ -282,14 +365,19 @@ void source_clear_source (source_t *source)
     free(source->dumpfilename);
     source->dumpfilename = NULL;
 
-    if (source->intro_file)
-    {
-        fclose (source->intro_file);
-        source->intro_file = NULL;
-    }
+    free (source->timeshift_filename);
+    source->timeshift_filename = NULL;
+
+    filecache_release (source->intro_file);
+    source->intro_file = NULL;
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (source->epoll_fd >= 0)
+        close (source->epoll_fd);
+    source->epoll_fd = -1;
+#endif
     source->on_demand_req = 0;
-    avl_tree_unlock (source->pending_tree);
+    client_list_unlock (source->pending_list);
 }
 
 
@@ -301,12 +389,14 @@ void source_free_source (source_t *source)
     avl_delete (global.source_tree, source, NULL);
     avl_tree_unlock (global.source_tree);
 
-    avl_tree_free(source->pending_tree, _free_client);
-    avl_tree_free(source->client_tree, _free_client);
+    client_list_free (source->pending_list, _free_client);
+    client_list_free (source->client_list, _free_client);
 
     /* make sure all YP entries have gone */
     yp_remove (source->mount);
 
+    thread_spin_destroy (&source->sync_lock);
+    free (source->sync_index);
     free (source->mount);
     free (source);
 
@@ -316,22 +406,13 @@ void source_free_source (source_t *source)
 
 client_t *source_find_client(source_t *source, int id)
 {
-    client_t fakeclient;
-    void *result;
-    connection_t fakecon;
-
-    fakeclient.con = &fakecon;
-    fakeclient.con->id = id;
+    client_t *client;
 
-    avl_tree_rlock(source->client_tree);
-    if(avl_get_by_key(source->client_tree, &fakeclient, &result) == 0)
-    {
-        avl_tree_unlock(source->client_tree);
-        return result;
-    }
+    client_list_rlock (source->client_list);
+    client = client_list_find (source->client_list, (unsigned long)id);
+    client_list_unlock (source->client_list);
 
-    avl_tree_unlock(source->client_tree);
-    return NULL;
+    return client;
 }
 
 
@@ -353,11 +434,11 @@ void source_move_clients (source_t *source, source_t *dest)
 
     /* if the destination is not running then we can't move clients */
 
-    avl_tree_wlock (dest->pending_tree);
+    client_list_wlock (dest->pending_list);
     if (dest->running == 0 && dest->on_demand == 0)
     {
         WARN1 ("destination mount %s not running, unable to move clients ", dest->mount);
-        avl_tree_unlock (dest->pending_tree);
+        client_list_unlock (dest->pending_list);
         thread_mutex_unlock (&move_clients_mutex);
         return;
     }
@@ -366,10 +447,10 @@ void source_move_clients (source_t *source, source_t *dest)
     {
         client_t *client;
 
-        /* we need to move the client and pending trees - we must take the
+        /* we need to move the client and pending lists - we must take the
          * locks in this order to avoid deadlocks */
-        avl_tree_wlock (source->pending_tree);
-        avl_tree_wlock (source->client_tree);
+        client_list_wlock (source->pending_list);
+        client_list_wlock (source->client_list);
 
         if (source->on_demand == 0 && source->format == NULL)
         {
@@ -385,13 +466,10 @@ void source_move_clients (source_t *source, source_t *dest)
             }
         }
 
-        while (1)
+        while (client_list_count (source->pending_list))
         {
-            avl_node *node = avl_get_first (source->pending_tree);
-            if (node == NULL)
-                break;
-            client = (client_t *)(node->key);
-            avl_delete (source->pending_tree, client, NULL);
+            client = client_list_get (source->pending_list, 0);
+            client_list_remove (source->pending_list, client);
 
             /* when switching a client to a different queue, be wary of the 
              * refbuf it's referring to, if it's http headers then we need
@@ -400,23 +478,23 @@ void source_move_clients (source_t *source, source_t *dest)
             if (client->check_buffer != format_check_http_buffer)
             {
                 client_set_queue (client, NULL);
+                timeshift_release (client->timeshift);
+                client->timeshift = NULL;
                 client->check_buffer = format_check_file_buffer;
                 if (source->con == NULL)
                     client->intro_offset = -1;
             }
 
-            avl_insert (dest->pending_tree, (void *)client);
+            if (client_list_add (dest->pending_list, client) < 0)
+                _free_client (client);
             count++;
         }
 
-        while (1)
+        while (client_list_count (source->client_list))
         {
-            avl_node *node = avl_get_first (source->client_tree);
-            if (node == NULL)
-                break;
-
-            client = (client_t *)(node->key);
-            avl_delete (source->client_tree, client, NULL);
+            client = client_list_get (source->client_list, 0);
+            client_list_remove (source->client_list, client);
+            source_unwatch_listener (source, client);
 
             /* when switching a client to a different queue, be wary of the 
              * refbuf it's referring to, if it's http headers then we need
@@ -425,11 +503,14 @@ void source_move_clients (source_t *source, source_t *dest)
             if (client->check_buffer != format_check_http_buffer)
             {
                 client_set_queue (client, NULL);
+                timeshift_release (client->timeshift);
+                client->timeshift = NULL;
                 client->check_buffer = format_check_file_buffer;
                 if (source->con == NULL)
                     client->intro_offset = -1;
             }
-            avl_insert (dest->pending_tree, (void *)client);
+            if (client_list_add (dest->pending_list, client) < 0)
+                _free_client (client);
             count++;
         }
         INFO2 ("passing %lu listeners to \"%s\"", count, dest->mount);
@@ -439,18 +520,39 @@ void source_move_clients (source_t *source, source_t *dest)
 
     } while (0);
 
-    avl_tree_unlock (source->pending_tree);
-    avl_tree_unlock (source->client_tree);
+    client_list_unlock (source->pending_list);
+    client_list_unlock (source->client_list);
 
     /* see if we need to wake up an on-demand relay */
     if (dest->running == 0 && dest->on_demand && count)
         dest->on_demand_req = 1;
 
-    avl_tree_unlock (dest->pending_tree);
+    client_list_unlock (dest->pending_list);
     thread_mutex_unlock (&move_clients_mutex);
 }
 
 
+/* timer callback, disconnect the source if nothing has been read within
+ * the timeout or check again when it would next be due.  Run with the
+ * timers locked, so the fields are only read and no other lock is taken */
+static int source_timeout_check (timer_entry_t *timer)
+{
+    source_t *source = timer->arg;
+    time_t now = time (NULL), last_read = source->last_read, due;
+    unsigned int timeout = source->timeout;
+
+    due = last_read + (time_t)timeout;
+    if (due < now)
+    {
+        DEBUG3 ("last %ld, timeout %u, now %ld", (long)last_read, timeout, (long)now);
+        WARN0 ("Disconnecting source due to socket timeout");
+        source->running = 0;
+        return 0;
+    }
+    return (int)(due - now + 1) * 1000;
+}
+
+
 /* get some data from the source. The stream data is placed in a refbuf
  * and sent back, however NULL is also valid as in the case of a short
  * timeout and there's no data pending.
@@ -460,8 +562,6 @@ static refbuf_t *get_next_buffer (source_t *source)
     refbuf_t *refbuf = NULL;
     int delay = 250;
 
-    if (source->short_delay)
-        delay = 0;
     while (global.running == ICE_RUNNING && source->running)
     {
         int fds = 0;
@@ -492,19 +592,9 @@ static refbuf_t *get_next_buffer (source_t *source)
             }
             break;
         }
+        /* the source timeout is handled by source_timeout_check */
         if (fds == 0)
-        {
-            thread_mutex_lock(&source->lock);
-            if ((source->last_read + (time_t)source->timeout) < current)
-            {
-                DEBUG3 ("last %ld, timeout %d, now %ld", (long)source->last_read,
-                        source->timeout, (long)current);
-                WARN0 ("Disconnecting source due to socket timeout");
-                source->running = 0;
-            }
-            thread_mutex_unlock(&source->lock);
             break;
-        }
         source->last_read = current;
         refbuf = source->format->get_buffer (source);
         if (source->client->con && source->client->con->error)
@@ -521,6 +611,42 @@ static refbuf_t *get_next_buffer (source_t *source)
 }
 
 
+/* A listener still on the head of the queue as it is trimmed can be moved
+ * on to the newest sync point instead of being dropped, so long as it has
+ * not needed to skip within the last skip_interval seconds.  Returns 0 if
+ * the listener was moved.
+ */
+static int skip_listener (source_t *source, client_t *client)
+{
+    refbuf_t *refbuf;
+    uint64_t offset, dropped;
+    time_t now;
+
+    if (source->skip_slow_listeners == 0)
+        return -1;
+    now = time (NULL);
+    if (client->skip_time && now - client->skip_time < (time_t)source->skip_interval)
+        return -1;
+    refbuf = source_find_sync_point (source, -1, &offset);
+    if (refbuf == NULL || refbuf == client->refbuf)
+        return -1;
+    /* the client may be part way through sending what is associated with
+     * its current buffer, eg a metadata block, so only move within the
+     * same associated data */
+    if (refbuf->associated != client->refbuf->associated)
+        return -1;
+
+    dropped = offset - source->queue_offset - client->pos;
+    client_set_queue (client, refbuf);
+    client->skip_time = now;
+    stats_counter_inc (source->skipped_listeners_stat);
+    stats_counter_add (source->skipped_bytes_stat, (long)dropped);
+    DEBUG3 ("Client %lu (%s) skipped %" PRIu64 " bytes", client->con->id,
+            client->con->ip, dropped);
+    return 0;
+}
+
+
 /* general send routine per listener.  The deletion_expected tells us whether
  * the last in the queue is about to disappear, so if this client is still
  * referring to it after writing then drop the client as it's fallen too far
@@ -534,18 +660,14 @@ static void send_to_listener (source_t *source, client_t *client, int deletion_e
 
     while (1)
     {
-        /* check for limited listener time */
-        if (client->con->discon_time)
-            if (time(NULL) >= client->con->discon_time)
-            {
-                INFO1 ("time limit reached for client #%lu", client->con->id);
-                client->con->error = 1;
-            }
-
         /* jump out if client connection has died */
         if (client->con->error)
             break;
 
+        /* nothing can be written until the socket drains */
+        if (listener_blocked (source, client))
+            break;
+
         /* lets not send too much to one client in one go, but don't
            sleep for too long if more data can be sent */
         if (total_written > 20000 || loop == 0)
@@ -572,9 +694,11 @@ static void send_to_listener (source_t *source, client_t *client, int deletion_e
      * if so, check to see if this client is still referring to it */
     if (deletion_expected && client->refbuf && client->refbuf == source->stream_data)
     {
+        if (skip_listener (source, client) == 0)
+            return;
         INFO2 ("Client %lu (%s) has fallen too far behind, removing",
                 client->con->id, client->con->ip);
-        stats_event_inc (source->mount, "slow_listeners");
+        stats_counter_inc (source->slow_listeners_stat);
         client->con->error = 1;
     }
 }
@@ -646,6 +770,22 @@ static void source_init (source_t *source)
         }
     }
 
+    if (source->timeshift_filename && source->timeshift_size)
+    {
+        /* other formats need headers sent before joining at a sync point */
+        if (source->format->type == FORMAT_TYPE_GENERIC)
+            source->timeshift = timeshift_open (source->timeshift_filename,
+                    source->timeshift_size);
+        else
+            WARN1 ("timeshift not supported for the stream type on %s", source->mount);
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+    source->epoll_fd = epoll_create (SOURCE_EPOLL_EVENTS);
+    if (source->epoll_fd < 0)
+        WARN2 ("no epoll descriptor for %s, %s", source->mount, strerror (errno));
+#endif
+
     /* grab a read lock, to make sure we get a chance to cleanup */
     thread_rwlock_rlock (source->shutdown_rwlock);
 
@@ -653,6 +793,11 @@ static void source_init (source_t *source)
     source->listeners = 0;
     stats_event_inc (NULL, "source_total_connections");
     stats_event (source->mount, "slow_listeners", "0");
+    source->connections_stat = stats_counter (source->mount, "connections");
+    source->listener_connections_stat = stats_counter (source->mount, "listener_connections");
+    source->slow_listeners_stat = stats_counter (source->mount, "slow_listeners");
+    source->skipped_listeners_stat = stats_counter (source->mount, "slow_listener_skips");
+    source->skipped_bytes_stat = stats_counter (source->mount, "slow_listener_skipped_bytes");
     stats_event_args (source->mount, "listeners", "%lu", source->listeners);
     stats_event_args (source->mount, "listener_peak", "%lu", source->peak_listeners);
     stats_event_time (source->mount, "stream_start");
@@ -694,172 +839,363 @@ static void source_init (source_t *source)
 }
 
 
-void source_main (source_t *source)
+/* Send queued stream data to the listeners of this source, add any pending
+ * listeners and trim the queue of data no longer referenced.  This is run
+ * from the worker thread the source is assigned to, a non-zero return
+ * indicates that more could be sent without waiting.
+ */
+int source_send_to_listeners (source_t *source)
 {
-    refbuf_t *refbuf;
     client_t *client;
-    avl_node *client_node;
+    unsigned int i;
+    int remove_from_q = 0, removals = 0;
 
-    source_init (source);
+    source->short_delay = 0;
 
-    while (global.running == ICE_RUNNING && source->running) {
-        int remove_from_q;
+    /* lets see if we have too much data in the queue, when the server is
+     * over its queue memory limit the slowest listeners are moved on or
+     * dropped at half the usual size */
+    thread_mutex_lock(&source->lock);
+    if (source->queue_size > source->queue_size_limit)
+        remove_from_q = 1;
+    else if (refbuf_memory_pressure () > 1 &&
+            source->queue_size > source->queue_size_limit / 2)
+        remove_from_q = 1;
+    thread_mutex_unlock(&source->lock);
 
-        refbuf = get_next_buffer (source);
+    /* only this worker sends to these clients and the queue is appended to
+     * without locking, so a read lock on the client list is enough here */
+    client_list_rlock (source->client_list);
 
-        remove_from_q = 0;
-        source->short_delay = 0;
+    source_check_writable (source);
 
-        if (refbuf)
-        {
-            /* append buffer to the in-flight data queue,  */
-            if (source->stream_data == NULL)
-            {
-                source->stream_data = refbuf;
-                source->burst_point = refbuf;
-            }
-            if (source->stream_data_tail)
-                source->stream_data_tail->next = refbuf;
-            source->stream_data_tail = refbuf;
-            source->queue_size += refbuf->len;
-            /* new buffer is referenced for burst */
-            refbuf_addref (refbuf);
+    for (i = 0; i < client_list_count (source->client_list); i++)
+    {
+        client = client_list_get (source->client_list, i);
 
-            /* new data on queue, so check the burst point */
-            source->burst_offset += refbuf->len;
-            while (source->burst_offset > source->burst_size)
-            {
-                refbuf_t *to_release = source->burst_point;
-
-                if (to_release->next)
-                {
-                    source->burst_point = to_release->next;
-                    source->burst_offset -= to_release->len;
-                    refbuf_release (to_release);
-                    continue;
-                }
-                break;
-            }
+        send_to_listener (source, client, remove_from_q);
 
-            /* save stream to file */
-            if (source->dumpfile && source->format->write_buf_to_file)
-                source->format->write_buf_to_file (source, refbuf);
+        if (client->con->error)
+            removals++;
+    }
+    client_list_unlock (source->client_list);
+
+    /* acquire write lock on pending_list */
+    client_list_wlock (source->pending_list);
+
+    /* acquire write lock on client_list */
+    client_list_wlock (source->client_list);
+
+    /* drop the clients that failed above, from the end as a removal moves
+     * the last client into the freed slot */
+    i = removals ? client_list_count (source->client_list) : 0;
+    while (i > 0)
+    {
+        client = client_list_get (source->client_list, --i);
+
+        if (client->con->error) {
+            if (client->respcode == 200)
+                stats_global_dec (STATS_LISTENERS);
+            client_list_remove (source->client_list, client);
+            _free_client (client);
+            source->listeners--;
+            DEBUG0("Client removed");
         }
-        /* lets see if we have too much data in the queue, but don't remove it until later */
-        thread_mutex_lock(&source->lock);
-        if (source->queue_size > source->queue_size_limit)
-            remove_from_q = 1;
-        thread_mutex_unlock(&source->lock);
+    }
 
-        /* acquire write lock on pending_tree */
-        avl_tree_wlock(source->pending_tree);
+    /** add pending clients **/
+    for (i = 0; i < client_list_count (source->pending_list); i++)
+    {
+        client = client_list_get (source->pending_list, i);
+
+        if(source->max_listeners != -1 && 
+                source->listeners >= (unsigned long)source->max_listeners) 
+        {
+            /* The common case is caught in the main connection handler,
+             * this deals with rarer cases (mostly concerning fallbacks)
+             * and doesn't give the listening client any information about
+             * why they were disconnected
+             */
+            _free_client (client);
+
+            INFO0("Client deleted, exceeding maximum listeners for this "
+                    "mountpoint.");
+            continue;
+        }
+
+        /* Otherwise, the client is accepted, add it */
+        if (client_list_add (source->client_list, client) < 0)
+        {
+            _free_client (client);
+            continue;
+        }
+        source_watch_listener (source, client);
 
-        /* acquire write lock on client_tree */
-        avl_tree_wlock(source->client_tree);
+        source->listeners++;
+        DEBUG0("Client added");
+        stats_counter_inc (source->connections_stat);
+    }
 
-        client_node = avl_get_first(source->client_tree);
-        while (client_node) {
-            client = (client_t *)client_node->key;
+    /** clear pending list, the clients are now either active or gone **/
+    client_list_clear (source->pending_list);
 
-            send_to_listener (source, client, remove_from_q);
+    /* release write lock on pending_list */
+    client_list_unlock (source->pending_list);
 
-            if (client->con->error) {
-                client_node = avl_get_next(client_node);
-                if (client->respcode == 200)
-                    stats_event_dec (NULL, "listeners");
-                avl_delete(source->client_tree, (void *)client, _free_client);
-                source->listeners--;
-                DEBUG0("Client removed");
-                continue;
-            }
-            client_node = avl_get_next(client_node);
+    /* update the stats if need be */
+    if (source->listeners != source->prev_listeners)
+    {
+        source->prev_listeners = source->listeners;
+        INFO2("listener count on %s now %lu", source->mount, source->listeners);
+        if (source->listeners > source->peak_listeners)
+        {
+            source->peak_listeners = source->listeners;
+            stats_event_args (source->mount, "listener_peak", "%lu", source->peak_listeners);
         }
+        stats_event_args (source->mount, "listeners", "%lu", source->listeners);
+        if (source->listeners == 0 && source->on_demand)
+            source->running = 0;
+    }
+
+    /* release write lock on client_list */
+    client_list_unlock (source->client_list);
 
-        /** add pending clients **/
-        client_node = avl_get_first(source->pending_tree);
-        while (client_node) {
+    /* lets reduce the queue, any lagging clients should of been
+     * terminated by now.  Only this worker removes from the head of the
+     * queue, the source thread only ever appends to the tail.
+     */
+    if (source->stream_data)
+    {
+        /* normal unreferenced queue data will have a refcount 1, but
+         * burst queue data will be at least 2, active clients will also
+         * increase refcount */
+        while (source->stream_data->_count == 1)
+        {
+            refbuf_t *to_go = source->stream_data;
 
-            if(source->max_listeners != -1 && 
-                    source->listeners >= (unsigned long)source->max_listeners) 
+            if (to_go->next == NULL || source->burst_point == to_go)
             {
-                /* The common case is caught in the main connection handler,
-                 * this deals with rarer cases (mostly concerning fallbacks)
-                 * and doesn't give the listening client any information about
-                 * why they were disconnected
-                 */
-                client = (client_t *)client_node->key;
-                client_node = avl_get_next(client_node);
-                avl_delete(source->pending_tree, (void *)client, _free_client);
-
-                INFO0("Client deleted, exceeding maximum listeners for this "
-                        "mountpoint.");
-                continue;
+                /* this should not happen */
+                ERROR0 ("queue state is unexpected");
+                source->running = 0;
+                break;
             }
-            
-            /* Otherwise, the client is accepted, add it */
-            avl_insert(source->client_tree, client_node->key);
+            source->stream_data = to_go->next;
+            source->queue_offset += to_go->len;
+            thread_atomic_sub (&source->queue_size, to_go->len);
+            to_go->next = NULL;
+            refbuf_release (to_go);
+        }
+    }
 
-            source->listeners++;
-            DEBUG0("Client added");
-            stats_event_inc(source->mount, "connections");
+    return source->short_delay;
+}
 
-            client_node = avl_get_next(client_node);
-        }
 
-        /** clear pending tree **/
-        while (avl_get_first(source->pending_tree)) {
-            avl_delete(source->pending_tree, 
-                    avl_get_first(source->pending_tree)->key, 
-                    source_remove_client);
-        }
+/* add a sync point to the end of the index, offset being its position in
+ * the stream.  Only the source thread changes the index.
+ */
+static void source_sync_add (source_t *source, refbuf_t *refbuf, uint64_t offset)
+{
+    source_sync_t *entry, *old = NULL;
+
+    if (source->sync_count == source->sync_size)
+    {
+        unsigned int i, size = source->sync_size ? source->sync_size * 2 : SOURCE_SYNC_INITIAL;
+        source_sync_t *index = malloc (size * sizeof (source_sync_t));
+
+        if (index == NULL)
+            return;
+        /* the worker only reads the entries so copy before taking the lock */
+        for (i = 0; i < source->sync_count; i++)
+            index [i] = source->sync_index [(source->sync_start + i) & (source->sync_size - 1)];
+        thread_spin_lock (&source->sync_lock);
+        old = source->sync_index;
+        source->sync_index = index;
+        source->sync_size = size;
+        source->sync_start = 0;
+    }
+    else
+        thread_spin_lock (&source->sync_lock);
+
+    entry = &source->sync_index [(source->sync_start + source->sync_count) & (source->sync_size - 1)];
+    entry->refbuf = refbuf;
+    entry->offset = offset;
+    source->sync_count++;
+    thread_spin_unlock (&source->sync_lock);
+    free (old);
+}
+
+
+/* a refbuf has been queued and the burst point moved on, so index it if
+ * it is a sync point and drop those now before the burst point. The worker
+ * trimming the head of the queue stops at the burst point so it never
+ * removes anything still in the index.
+ */
+static void source_sync_queued (source_t *source, refbuf_t *refbuf)
+{
+    if (refbuf->sync_point)
+        source_sync_add (source, refbuf, source->stream_offset);
+
+    thread_spin_lock (&source->sync_lock);
+    source->stream_offset += refbuf->len;
+    source->burst_start = source->stream_offset - source->burst_offset;
+    while (source->sync_count &&
+            source->sync_index [source->sync_start].offset < source->burst_start)
+    {
+        source->sync_start = (source->sync_start + 1) & (source->sync_size - 1);
+        source->sync_count--;
+    }
+    thread_spin_unlock (&source->sync_lock);
+}
+
+
+/* Some formats only know a queued refbuf is a sync point once later data
+ * has been read, eg a theora keyframe continued over several pages. Such
+ * a refbuf is newer than any already indexed, so work out its offset from
+ * the last entry. Called from the source thread.
+ */
+void source_sync_mark (source_t *source, refbuf_t *refbuf)
+{
+    refbuf_t *search = source->burst_point;
+    uint64_t offset = source->burst_start;
+
+    if (source->sync_count)
+    {
+        source_sync_t *last = &source->sync_index
+            [(source->sync_start + source->sync_count - 1) & (source->sync_size - 1)];
+
+        if (last->refbuf == refbuf)
+            return;
+        search = last->refbuf;
+        offset = last->offset;
+    }
+    while (search && search != refbuf)
+    {
+        offset += search->len;
+        search = search->next;
+    }
+    if (search)
+        source_sync_add (source, refbuf, offset);
+}
 
-        /* release write lock on pending_tree */
-        avl_tree_unlock(source->pending_tree);
 
-        /* update the stats if need be */
-        if (source->listeners != source->prev_listeners)
+/* Find the refbuf a listener should start from, the first sync point at
+ * least burst_skip bytes past the burst point, or the newest one if none
+ * are that far in.  A negative burst_skip is for a listener that should
+ * not get a burst, so it also gets the newest.  The stream offset of the
+ * refbuf is returned in offset if not NULL.
+ */
+refbuf_t *source_find_sync_point (source_t *source, long burst_skip, uint64_t *offset)
+{
+    refbuf_t *refbuf = NULL;
+
+    thread_spin_lock (&source->sync_lock);
+    if (source->sync_count)
+    {
+        unsigned int mask = source->sync_size - 1;
+        unsigned int low = 0, high = source->sync_count - 1;
+
+        if (burst_skip >= 0)
         {
-            source->prev_listeners = source->listeners;
-            INFO2("listener count on %s now %lu", source->mount, source->listeners);
-            if (source->listeners > source->peak_listeners)
+            uint64_t target = source->burst_start + burst_skip;
+
+            while (low < high)
             {
-                source->peak_listeners = source->listeners;
-                stats_event_args (source->mount, "listener_peak", "%lu", source->peak_listeners);
+                unsigned int mid = (low + high) / 2;
+
+                if (source->sync_index [(source->sync_start + mid) & mask].offset < target)
+                    low = mid + 1;
+                else
+                    high = mid;
             }
-            stats_event_args (source->mount, "listeners", "%lu", source->listeners);
-            if (source->listeners == 0 && source->on_demand)
-                source->running = 0;
         }
+        else
+            low = high;
+        refbuf = source->sync_index [(source->sync_start + low) & mask].refbuf;
+        if (offset)
+            *offset = source->sync_index [(source->sync_start + low) & mask].offset;
+    }
+    thread_spin_unlock (&source->sync_lock);
+    return refbuf;
+}
 
-        /* lets reduce the queue, any lagging clients should of been
-         * terminated by now
-         */
-        if (source->stream_data)
+
+/* The source thread only reads the incoming stream and queues it up, the
+ * listeners are serviced by the worker the source is assigned to.
+ */
+void source_main (source_t *source)
+{
+    refbuf_t *refbuf;
+
+    source_init (source);
+    workers_add_source (source);
+
+    timer_entry_init (&source->timeout_timer, source_timeout_check, source);
+    timers_add (&source->timeout_timer, (source->timeout + 1) * 1000);
+
+    while (global.running == ICE_RUNNING && source->running) {
+
+        refbuf = get_next_buffer (source);
+
+        if (refbuf)
         {
-            /* normal unreferenced queue data will have a refcount 1, but
-             * burst queue data will be at least 2, active clients will also
-             * increase refcount */
-            while (source->stream_data->_count == 1)
+            unsigned int burst_size = source->burst_size;
+            refbuf_t *to_release;
+
+            /* new buffer is referenced for burst */
+            refbuf_addref (refbuf);
+            refbuf_account (refbuf, REFBUF_MEM_QUEUE);
+
+            /* append buffer to the in-flight data queue.  Workers read the
+             * queue without locking, so the buffer must be complete before
+             * it is linked in */
+            thread_atomic_barrier ();
+            if (source->stream_data_tail)
+                source->stream_data_tail->next = refbuf;
+            else
             {
-                refbuf_t *to_go = source->stream_data;
+                source->stream_data = refbuf;
+                source->burst_point = refbuf;
+            }
+            source->stream_data_tail = refbuf;
+            thread_atomic_add (&source->queue_size, refbuf->len);
 
-                if (to_go->next == NULL || source->burst_point == to_go)
-                {
-                    /* this should not happen */
-                    ERROR0 ("queue state is unexpected");
-                    source->running = 0;
-                    break;
-                }
-                source->stream_data = to_go->next;
-                source->queue_size -= to_go->len;
-                to_go->next = NULL;
-                refbuf_release (to_go);
+            /* new data on queue, so check the burst point. The burst is
+             * cut back while the queue memory is short */
+            source->burst_offset += refbuf->len;
+            refbuf_memory_add (REFBUF_MEM_BURST, refbuf->len);
+            burst_size >>= refbuf_memory_pressure ();
+            to_release = source->burst_point;
+            while (source->burst_offset > burst_size && source->burst_point->next)
+            {
+                source->burst_offset -= source->burst_point->len;
+                refbuf_memory_add (REFBUF_MEM_BURST, -(long)source->burst_point->len);
+                source->burst_point = source->burst_point->next;
             }
-        }
+            /* the index must not refer to a block once the worker can free
+             * it, so trim the index before dropping the burst references */
+            source_sync_queued (source, refbuf);
+            while (to_release != source->burst_point)
+            {
+                refbuf_t *next = to_release->next;
 
-        /* release write lock on client_tree */
-        avl_tree_unlock(source->client_tree);
+                refbuf_release (to_release);
+                to_release = next;
+            }
+
+            if (source->timeshift)
+                timeshift_write (source->timeshift, refbuf);
+
+            /* save stream to file */
+            if (source->dumpfile && source->format->write_buf_to_file)
+                source->format->write_buf_to_file (source, refbuf);
+
+            workers_wakeup (source);
+        }
     }
+    timers_cancel (&source->timeout_timer);
+    workers_remove_source (source);
     source_shutdown (source);
 }
 
@@ -898,6 +1234,16 @@ static void source_shutdown (source_t *source)
 
     /* delete this sources stats */
     stats_event(source->mount, NULL, NULL);
+    stats_counter_release (source->connections_stat);
+    stats_counter_release (source->listener_connections_stat);
+    stats_counter_release (source->slow_listeners_stat);
+    stats_counter_release (source->skipped_listeners_stat);
+    stats_counter_release (source->skipped_bytes_stat);
+    source->connections_stat = NULL;
+    source->listener_connections_stat = NULL;
+    source->slow_listeners_stat = NULL;
+    source->skipped_listeners_stat = NULL;
+    source->skipped_bytes_stat = NULL;
 
     /* we don't remove the source from the tree here, it may be a relay and
        therefore reserved */
@@ -913,25 +1259,6 @@ static void source_shutdown (source_t *source)
 }
 
 
-static int _compare_clients(void *compare_arg, void *a, void *b)
-{
-    client_t *clienta = (client_t *)a;
-    client_t *clientb = (client_t *)b;
-
-    connection_t *cona = clienta->con;
-    connection_t *conb = clientb->con;
-
-    if (cona->id < conb->id) return -1;
-    if (cona->id > conb->id) return 1;
-
-    return 0;
-}
-
-int source_remove_client(void *key)
-{
-    return 1;
-}
-
 static int _free_client(void *key)
 {
     client_t *client = (client_t *)key;
@@ -979,14 +1306,14 @@ static void _parse_audio_info (source_t *source, const char *s)
 
 
 /* Apply the mountinfo details to the source */
-static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
+static void source_apply_mount (source_t *source, mount_proxy *mountinfo, filecache_t *intro)
 {
     const char *str;
     int val;
     http_parser_t *parser = NULL;
 
     DEBUG1("Applying mount information for \"%s\"", source->mount);
-    avl_tree_rlock (source->client_tree);
+    client_list_rlock (source->client_list);
     stats_event_args (source->mount, "listener_peak", "%lu", source->peak_listeners);
 
     if (mountinfo)
@@ -1155,35 +1482,31 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
     else
         source->dumpfilename = NULL;
 
-    if (source->intro_file)
+    if (mountinfo && mountinfo->timeshift_file)
     {
-        fclose (source->intro_file);
-        source->intro_file = NULL;
+        char *filename = source->timeshift_filename;
+        source->timeshift_filename = strdup (mountinfo->timeshift_file);
+        source->timeshift_size = mountinfo->timeshift_size;
+        free (filename);
     }
-    if (mountinfo && mountinfo->intro_filename)
+    else
     {
-        ice_config_t *config = config_get_config_unlocked ();
-        unsigned int len  = strlen (config->webroot_dir) +
-            strlen (mountinfo->intro_filename) + 2;
-        char *path = malloc (len);
-        if (path)
-        {
-            FILE *f;
-            snprintf (path, len, "%s" PATH_SEPARATOR "%s", config->webroot_dir,
-                    mountinfo->intro_filename);
-
-            f = fopen (path, "rb");
-            if (f)
-                source->intro_file = f;
-            else
-                WARN2 ("Cannot open intro file \"%s\": %s", path, strerror(errno));
-            free (path);
-        }
+        free (source->timeshift_filename);
+        source->timeshift_filename = NULL;
     }
 
+    filecache_release (source->intro_file);
+    source->intro_file = intro;
+
     if (mountinfo && mountinfo->queue_size_limit)
         source->queue_size_limit = mountinfo->queue_size_limit;
 
+    if (mountinfo && mountinfo->skip_slow_listeners)
+        source->skip_slow_listeners = mountinfo->skip_slow_listeners;
+
+    if (mountinfo && mountinfo->skip_interval >= 0)
+        source->skip_interval = (unsigned int)mountinfo->skip_interval;
+
     if (mountinfo && mountinfo->source_timeout)
         source->timeout = mountinfo->source_timeout;
 
@@ -1193,7 +1516,7 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
     if (mountinfo && mountinfo->fallback_when_full)
         source->fallback_when_full = mountinfo->fallback_when_full;
 
-    avl_tree_unlock (source->client_tree);
+    client_list_unlock (source->client_list);
 }
 
 
@@ -1203,23 +1526,43 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
  */
 void source_update_settings (ice_config_t *config, source_t *source, mount_proxy *mountinfo)
 {
+    filecache_t *intro = NULL;
+
+    /* the intro may need reading in, so open it before taking the lock */
+    if (mountinfo && mountinfo->intro_filename)
+    {
+        unsigned int len  = strlen (config->webroot_dir) +
+            strlen (mountinfo->intro_filename) + 2;
+        char *path = malloc (len);
+        if (path)
+        {
+            snprintf (path, len, "%s" PATH_SEPARATOR "%s", config->webroot_dir,
+                    mountinfo->intro_filename);
+
+            intro = filecache_open (path);
+            free (path);
+        }
+    }
     thread_mutex_lock(&source->lock);
     /*  skip if source is a fallback to file */
     if (source->running && source->client == NULL)
     {
         stats_event_hidden (source->mount, NULL, 1);
         thread_mutex_unlock(&source->lock);
+        filecache_release (intro);
         return;
     }
     /* set global settings first */
     source->queue_size_limit = config->queue_size_limit;
     source->timeout = config->source_timeout;
     source->burst_size = config->burst_size;
+    source->skip_slow_listeners = 0;
+    source->skip_interval = SOURCE_SKIP_INTERVAL;
 
     stats_event_args (source->mount, "listenurl", "http://%s:%d%s",
             config->hostname, config->port, source->mount);
 
-    source_apply_mount (source, mountinfo);
+    source_apply_mount (source, mountinfo, intro);
 
     if (source->fallback_mount)
         DEBUG1 ("fallback %s", source->fallback_mount);
@@ -1260,6 +1603,8 @@ void source_update_settings (ice_config_t *config, source_t *source, mount_proxy
     DEBUG1 ("max listeners to %ld", source->max_listeners);
     DEBUG1 ("queue size to %u", source->queue_size_limit);
     DEBUG1 ("burst size to %u", source->burst_size);
+    if (source->skip_slow_listeners)
+        DEBUG1 ("slow listeners skip ahead, interval %u", source->skip_interval);
     DEBUG1 ("source timeout to %u", source->timeout);
     DEBUG1 ("fallback_when_full to %u", source->fallback_when_full);
     thread_mutex_unlock(&source->lock);
@@ -1351,7 +1696,7 @@ static void *source_fallback_file (void *arg)
     char *type;
     char *path;
     unsigned int len;
-    FILE *file = NULL;
+    filecache_t *file = NULL;
     source_t *source = NULL;
     ice_config_t *config;
     http_parser_t *parser;
@@ -1370,7 +1715,7 @@ static void *source_fallback_file (void *arg)
         if (path == NULL)
             break;
 
-        file = fopen (path, "rb");
+        file = filecache_open (path);
         if (file == NULL)
         {
             WARN1 ("unable to open file \"%s\"", path);
@@ -1402,8 +1747,7 @@ static void *source_fallback_file (void *arg)
         source_client_thread (source);
         httpp_destroy (parser);
     } while (0);
-    if (file)
-        fclose (file);
+    filecache_release (file);
     free (mount);
     return NULL;
 }
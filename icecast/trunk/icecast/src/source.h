@@ -17,10 +17,22 @@
 #include "yp.h"
 #include "util.h"
 #include "format.h"
+#include "clientlist.h"
 #include "thread/thread.h"
 
 #include <stdio.h>
 
+struct worker_tag;
+struct _stats_counter_tag;
+
+/* an entry in the index of queued sync points, offset is the position
+ * in the stream of the first byte of the refbuf */
+typedef struct source_sync_tag
+{
+    refbuf_t *refbuf;
+    uint64_t offset;
+} source_sync_t;
+
 typedef struct source_tag
 {
     mutex_t lock;
@@ -40,17 +52,31 @@ typedef struct source_tag
 
     struct _format_plugin_tag *format;
 
-    avl_tree *client_tree;
-    avl_tree *pending_tree;
+    /* active listeners, and those waiting to be added by the worker */
+    client_list_t *client_list;
+    client_list_t *pending_list;
 
     rwlock_t *shutdown_rwlock;
     util_dict *audio_info;
 
-    FILE *intro_file;
+    /* shared copy of the intro, or the file a fallback source plays */
+    struct filecache_tag *intro_file;
 
     char *dumpfilename; /* Name of a file to dump incoming stream to */
     FILE *dumpfile;
 
+    /* rewind buffer listeners can join in the past from */
+    char *timeshift_filename;
+    unsigned int timeshift_size;
+    struct timeshift_tag *timeshift;
+
+    /* per mount stats changed for each listener */
+    struct _stats_counter_tag *connections_stat;
+    struct _stats_counter_tag *listener_connections_stat;
+    struct _stats_counter_tag *slow_listeners_stat;
+    struct _stats_counter_tag *skipped_listeners_stat;
+    struct _stats_counter_tag *skipped_bytes_stat;
+
     unsigned long peak_listeners;
     unsigned long listeners;
     unsigned long prev_listeners;
@@ -59,24 +85,50 @@ typedef struct source_tag
     int fallback_override;
     int fallback_when_full;
     int shoutcast_compat;
+    int skip_slow_listeners;
+    unsigned int skip_interval;
 
     /* per source burst handling for connecting clients */
     unsigned int burst_size;    /* trigger level for burst on connect */
     unsigned int burst_offset; 
     refbuf_t *burst_point;
 
+    /* ring of the sync points from the burst point onwards, oldest first.
+     * Only the source thread changes it, sync_lock covers the worker
+     * searching it for a listener start */
+    spin_t sync_lock;
+    source_sync_t *sync_index;
+    unsigned int sync_size;
+    unsigned int sync_start;
+    unsigned int sync_count;
+    uint64_t stream_offset;     /* bytes queued since the source started */
+    uint64_t burst_start;       /* stream offset of the burst point */
+
     unsigned int queue_size;
     unsigned int queue_size_limit;
 
-    unsigned timeout;  /* source timeout in seconds */
+    volatile unsigned timeout;  /* source timeout in seconds */
     int on_demand;
     int on_demand_req;
     int hidden;
-    time_t last_read;
+    volatile time_t last_read;  /* with timeout, read unlocked by the timer */
+    timer_entry_t timeout_timer;
     int short_delay;
 
+    /* the stream queue, appended to by the source thread and trimmed from
+     * the head by the worker, neither end takes a lock */
     refbuf_t *stream_data;
     refbuf_t *stream_data_tail;
+    uint64_t queue_offset;  /* stream offset of stream_data, kept by the worker */
+
+    /* listener worker servicing this source while it runs */
+    struct worker_tag *worker;
+    struct source_tag *worker_next;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* listener sockets, so blocked listeners are only retried once writable */
+    int epoll_fd;
+#endif
 
 } source_t;
 
@@ -92,8 +144,10 @@ client_t *source_find_client(source_t *source, int id);
 int source_compare_sources(void *arg, void *a, void *b);
 void source_free_source(source_t *source);
 void source_move_clients (source_t *source, source_t *dest);
-int source_remove_client(void *key);
 void source_main(source_t *source);
+int source_send_to_listeners (source_t *source);
+void source_sync_mark (source_t *source, refbuf_t *refbuf);
+refbuf_t *source_find_sync_point (source_t *source, long burst_skip, uint64_t *offset);
 void source_recheck_mounts (int update_all);
 
 extern mutex_t move_clients_mutex;
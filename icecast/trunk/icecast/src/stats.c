@@ -62,14 +62,28 @@ typedef struct _event_queue_tag
 
 #define event_queue_init(qp)    { (qp)->head = NULL; (qp)->tail = &(qp)->head; }
 
+/* Processed events are linked into a single published chain, each stats
+ * listener holds a reference on the event it last sent and follows the
+ * chain from there.  The queue only holds the snapshot of the stats taken
+ * when the listener registered.
+ */
 typedef struct _event_listener_tag
 {
     event_queue_t queue;
-    mutex_t mutex;
-
-    struct _event_listener_tag *next;
+    stats_event_t *position;
 } event_listener_t;
 
+/* numeric changes to the same stat within a batch are merged */
+#define STATS_COALESCE_SLOTS    512
+
+typedef struct _coalesce_slot_tag
+{
+    stats_event_t *event;
+    int64_t delta;
+    int merged;
+    int closed;
+} coalesce_slot_t;
+
 static volatile int _stats_running = 0;
 static thread_type *_stats_thread_id;
 static volatile int _stats_threads = 0;
@@ -79,8 +93,23 @@ static mutex_t _stats_mutex;
 
 static event_queue_t _global_event_queue;
 mutex_t _global_event_mutex;
+static cond_t _stats_wakeup;
+static int _stats_wakeup_pending;   /* set and cleared with the cond locked */
 
-static volatile event_listener_t *_event_listeners;
+/* counters are only added to while _stats_mutex is held */
+static stats_counter_t *_counters;
+static stats_counter_t *_global_counters [STATS_GLOBAL_COUNTERS];
+static const char *_global_counter_names [STATS_GLOBAL_COUNTERS] =
+{
+    "clients", "connections", "client_connections", "stats_connections",
+    "file_connections", "listeners", "listener_connections",
+    "queue_memory_relays_refused"
+};
+
+/* end of the published event chain, guarded by _publish_mutex */
+static stats_event_t *_published_tail;
+static mutex_t _publish_mutex;
+static cond_t _publish_cond;
 
 
 static void *_stats_thread(void *arg);
@@ -92,6 +121,11 @@ static void _add_event_to_queue(stats_event_t *event, event_queue_t *queue);
 static stats_node_t *_find_node(avl_tree *tree, const char *name);
 static stats_source_t *_find_source(avl_tree *tree, const char *source);
 static void _free_event(stats_event_t *event);
+static void _release_event(stats_event_t *event);
+static void _fold_counters (void);
+static void _publish_event (stats_event_t *event);
+static void _reset_counters (const char *source, const char *name);
+static void _free_counter (stats_counter_t *counter);
 static stats_event_t *_get_event_from_queue (event_queue_t *queue);
 
 
@@ -115,16 +149,46 @@ static stats_event_t *build_event (const char *source, const char *name, const c
     return event;
 }
 
+/* wake the stats thread, the flag covers a signal sent while the thread
+ * is still processing and not yet waiting */
+static void _stats_signal (void)
+{
+    thread_cond_lock (&_stats_wakeup);
+    _stats_wakeup_pending = 1;
+    thread_cond_signal (&_stats_wakeup);
+    thread_cond_unlock (&_stats_wakeup);
+}
+
+
+/* wake the stats listeners, they check for published events with the cond
+ * locked so none are missed */
+static void _publish_wakeup (void)
+{
+    thread_cond_lock (&_publish_cond);
+    thread_cond_broadcast (&_publish_cond);
+    thread_cond_unlock (&_publish_cond);
+}
+
+
 static void queue_global_event (stats_event_t *event)
 {
+    int wakeup;
+
     thread_mutex_lock(&_global_event_mutex);
+    wakeup = (_global_event_queue.head == NULL);
     _add_event_to_queue (event, &_global_event_queue);
     thread_mutex_unlock(&_global_event_mutex);
+
+    /* the stats thread drains everything queued once woken, so only the
+     * first event queued after a drain needs to wake it */
+    if (wakeup)
+        _stats_signal ();
 }
 
 void stats_initialize(void)
 {
-    _event_listeners = NULL;
+    int i;
+
 
     /* set up global struct */
     _stats.global_tree = avl_tree_new(_compare_stats, NULL);
@@ -136,6 +200,16 @@ void stats_initialize(void)
     /* set up stats queues */
     event_queue_init (&_global_event_queue);
     thread_mutex_create(&_global_event_mutex);
+    thread_cond_create (&_stats_wakeup);
+
+    /* listeners start from an empty placeholder event */
+    thread_mutex_create (&_publish_mutex);
+    thread_cond_create (&_publish_cond);
+    _published_tail = calloc (1, sizeof (stats_event_t));
+    _published_tail->_count = 1;
+
+    for (i = 0; i < STATS_GLOBAL_COUNTERS; i++)
+        _global_counters[i] = stats_counter (NULL, _global_counter_names[i]);
 
     /* fire off the stats thread */
     _stats_running = 1;
@@ -151,7 +225,9 @@ void stats_shutdown(void)
 
     /* wait for thread to exit */
     _stats_running = 0;
+    _stats_signal ();
     thread_join(_stats_thread_id);
+    _publish_wakeup ();
 
     /* wait for other threads to shut down */
     do {
@@ -166,8 +242,21 @@ void stats_shutdown(void)
 
     /* destroy the queue mutexes */
     thread_mutex_destroy(&_global_event_mutex);
+    thread_cond_destroy (&_stats_wakeup);
+
+    _release_event (_published_tail);
+    _published_tail = NULL;
+    thread_mutex_destroy (&_publish_mutex);
+    thread_cond_destroy (&_publish_cond);
 
     thread_mutex_destroy(&_stats_mutex);
+    while (_counters)
+    {
+        stats_counter_t *counter = _counters;
+        _counters = counter->next;
+        _free_counter (counter);
+    }
+    memset (_global_counters, 0, sizeof (_global_counters));
     avl_tree_free(_stats.source_tree, _free_source_stats);
     avl_tree_free(_stats.global_tree, _free_stats);
 
@@ -287,6 +376,7 @@ static char *_get_stats(const char *source, const char *name)
     char *value = NULL;
 
     thread_mutex_lock(&_stats_mutex);
+    _fold_counters ();
 
     if (source == NULL) {
         stats = _find_node(_stats.global_tree, name);
@@ -411,26 +501,6 @@ static stats_source_t *_find_source(avl_tree *source_tree, const char *source)
     return NULL;
 }
 
-static stats_event_t *_copy_event(stats_event_t *event)
-{
-    stats_event_t *copy = (stats_event_t *)calloc(1, sizeof(stats_event_t));
-    if (event->source) 
-        copy->source = (char *)strdup(event->source);
-    else
-        copy->source = NULL;
-    if (event->name)
-        copy->name = (char *)strdup(event->name);
-    if (event->value)
-        copy->value = (char *)strdup(event->value);
-    else
-        copy->value = NULL;
-    copy->hidden = event->hidden;
-    copy->next = NULL;
-
-    return copy;
-}
-
-
 /* helper to apply specialised changes to a stats node */
 static void modify_node_event (stats_node_t *node, stats_event_t *event)
 {
@@ -457,7 +527,7 @@ static void modify_node_event (stats_node_t *node, stats_event_t *event)
                 value = atoi (node->value)-1;
                 break;
             case STATS_EVENT_ADD:
-                value = atoi (node->value)+atoi (event->value);
+                value = atoll (node->value) + atoll (event->value);
                 break;
             case STATS_EVENT_SUB:
                 value = atoll (node->value) - atoll (event->value);
@@ -466,10 +536,11 @@ static void modify_node_event (stats_node_t *node, stats_event_t *event)
                 WARN2 ("unhandled event (%d) for %s", event->action, event->source);
                 break;
         }
-        str = malloc (16);
-        snprintf (str, 16, "%" PRId64, value);
-        if (event->value == NULL)
-            event->value = strdup (str);
+        str = malloc (24);
+        snprintf (str, 24, "%" PRId64, value);
+        /* listeners are sent the resulting value, not the change */
+        free (event->value);
+        event->value = strdup (str);
     }
     else
         str = (char *)strdup (event->value);
@@ -556,6 +627,7 @@ static void process_source_event (stats_event_t *event)
         {
             DEBUG1 ("delete node %s", event->name);
             avl_delete(snode->stats_tree, (void *)node, _free_stats);
+            _reset_counters (event->source, event->name);
             return;
         }
         modify_node_event (node, event);
@@ -581,6 +653,7 @@ static void process_source_event (stats_event_t *event)
     {
         DEBUG1 ("delete source node %s", event->source);
         avl_delete(_stats.source_tree, (void *)snode, _free_source_stats);
+        _reset_counters (event->source, NULL);
     }
 }
 
@@ -618,11 +691,336 @@ void stats_global (ice_config_t *config)
 }
 
 
+/* publish the refbuf allocator and logger counters */
+static void _update_internal_stats (void)
+{
+    refbuf_pool_stats_t pool;
+
+    refbuf_pool_stats (&pool);
+    stats_event_args (NULL, "refbuf_pool_hits", "%" PRIu64, pool.hits);
+    stats_event_args (NULL, "refbuf_pool_misses", "%" PRIu64, pool.misses);
+    stats_event_args (NULL, "refbuf_pool_bytes", "%" PRIu64, pool.allocated);
+    stats_event_args (NULL, "refbuf_pool_free_bytes", "%" PRIu64, pool.free_bytes);
+    stats_event_args (NULL, "queue_memory", "%" PRIu64, refbuf_memory_total ());
+    stats_event_args (NULL, "queue_memory_stream", "%" PRIu64, refbuf_memory_used (REFBUF_MEM_QUEUE));
+    stats_event_args (NULL, "queue_memory_burst", "%" PRIu64, refbuf_memory_used (REFBUF_MEM_BURST));
+    stats_event_args (NULL, "queue_memory_intro", "%" PRIu64, refbuf_memory_used (REFBUF_MEM_INTRO));
+    stats_event_args (NULL, "queue_memory_fserve", "%" PRIu64, refbuf_memory_used (REFBUF_MEM_FSERVE));
+    stats_event_args (NULL, "queue_memory_pressure", "%d", refbuf_memory_pressure ());
+    stats_event_args (NULL, "log_lines_dropped", "%lu", log_lines_dropped ());
+}
+
+/* find or create the counter for this stat.  The returned handle can be
+ * kept, a mount counter lasts until released and the mount stats removed */
+stats_counter_t *stats_counter (const char *source, const char *name)
+{
+    stats_counter_t *counter;
+
+    thread_mutex_lock (&_stats_mutex);
+    for (counter = _counters; counter; counter = counter->next)
+    {
+        if (strcmp (counter->name, name) != 0)
+            continue;
+        if (source == NULL ? counter->source == NULL :
+                (counter->source && strcmp (counter->source, source) == 0))
+            break;
+    }
+    if (counter == NULL)
+    {
+        counter = calloc (1, sizeof (stats_counter_t));
+        if (source)
+            counter->source = strdup (source);
+        counter->name = strdup (name);
+        counter->next = _counters;
+        _counters = counter;
+    }
+    counter->refs++;
+    thread_mutex_unlock (&_stats_mutex);
+    return counter;
+}
+
+
+static void _free_counter (stats_counter_t *counter)
+{
+    free (counter->source);
+    free (counter->name);
+    free (counter);
+}
+
+
+/* drop a handle on a counter.  A mount counter goes once the mount stats
+ * have gone, a global one and its stat as soon as nothing holds it */
+void stats_counter_release (stats_counter_t *counter)
+{
+    stats_counter_t **trail;
+    stats_event_t *event = NULL;
+
+    if (counter == NULL)
+        return;
+    thread_mutex_lock (&_stats_mutex);
+    counter->refs--;
+    if (counter->refs == 0 && (counter->source == NULL ||
+                _find_source (_stats.source_tree, counter->source) == NULL))
+    {
+        for (trail = &_counters; *trail; trail = &(*trail)->next)
+        {
+            if (*trail == counter)
+            {
+                *trail = counter->next;
+                if (counter->source == NULL)
+                    event = build_event (NULL, counter->name, NULL);
+                _free_counter (counter);
+                break;
+            }
+        }
+    }
+    thread_mutex_unlock (&_stats_mutex);
+    /* no more changes can be folded in, so the stat can be dropped */
+    if (event)
+        queue_global_event (event);
+}
+
+
+void stats_counter_add (stats_counter_t *counter, long value)
+{
+    if (counter)
+        thread_atomic_add (&counter->value, value);
+}
+
+
+void stats_global_add (stats_global_counter_t id, long value)
+{
+    if (id < STATS_GLOBAL_COUNTERS)
+        stats_counter_add (_global_counters [id], value);
+}
+
+
+/* apply the counter changes made since the last fold to the stats and pass
+ * them on to the listeners, _stats_mutex must be held */
+static void _fold_counters (void)
+{
+    stats_counter_t *counter;
+
+    for (counter = _counters; counter; counter = counter->next)
+    {
+        long delta = counter->value;
+        stats_event_t *event;
+
+        if (delta == 0)
+            continue;
+        /* later changes may have been made, so only take off what we apply */
+        thread_atomic_sub (&counter->value, delta);
+
+        event = build_event (counter->source, counter->name, "");
+        if (event == NULL)
+            continue;
+        free (event->value);
+        event->value = malloc (24);
+        if (delta < 0)
+        {
+            event->action = STATS_EVENT_SUB;
+            snprintf (event->value, 24, "%ld", -delta);
+        }
+        else
+        {
+            event->action = STATS_EVENT_ADD;
+            snprintf (event->value, 24, "%ld", delta);
+        }
+        if (event->source == NULL)
+            process_global_event (event);
+        else
+            process_source_event (event);
+        _publish_event (event);
+    }
+}
+
+
+/* drop outstanding changes to stats that have been removed, name can be
+ * NULL for all the stats of a source, in which case the counters no longer
+ * held are freed.  _stats_mutex must be held */
+static void _reset_counters (const char *source, const char *name)
+{
+    stats_counter_t **trail = &_counters;
+
+    while (*trail)
+    {
+        stats_counter_t *counter = *trail;
+        long delta = counter->value;
+
+        if (counter->source == NULL || strcmp (counter->source, source) != 0 ||
+                (name && strcmp (counter->name, name) != 0))
+        {
+            trail = &counter->next;
+            continue;
+        }
+        if (name == NULL && counter->refs == 0)
+        {
+            *trail = counter->next;
+            _free_counter (counter);
+            continue;
+        }
+        if (delta)
+            thread_atomic_sub (&counter->value, delta);
+        trail = &counter->next;
+    }
+}
+
+
+static int _same_stat (stats_event_t *a, stats_event_t *b)
+{
+    if (a->source == NULL || b->source == NULL)
+    {
+        if (a->source != b->source)
+            return 0;
+    }
+    else if (strcmp (a->source, b->source) != 0)
+        return 0;
+    return strcmp (a->name, b->name) == 0;
+}
+
+
+static unsigned int _stat_hash (stats_event_t *event)
+{
+    unsigned int hash = 5381;
+    const char *p;
+
+    if (event->source)
+        for (p = event->source; *p; p++)
+            hash = hash * 33 + (unsigned char)*p;
+    for (p = event->name; *p; p++)
+        hash = hash * 33 + (unsigned char)*p;
+    return hash & (STATS_COALESCE_SLOTS - 1);
+}
+
+
+/* the change a numeric event makes, returns 0 for other events */
+static int _event_delta (stats_event_t *event, int64_t *delta)
+{
+    switch (event->action)
+    {
+        case STATS_EVENT_INC: *delta = 1; return 1;
+        case STATS_EVENT_DEC: *delta = -1; return 1;
+        case STATS_EVENT_ADD: *delta = atoll (event->value); return 1;
+        case STATS_EVENT_SUB: *delta = -atoll (event->value); return 1;
+    }
+    return 0;
+}
+
+
+/* rewrite the first event of a merged run to carry the total change */
+static void _finish_merge (coalesce_slot_t *slot)
+{
+    stats_event_t *event = slot->event;
+
+    if (slot->merged == 0)
+        return;
+    free (event->value);
+    event->value = malloc (24);
+    if (slot->delta < 0)
+    {
+        event->action = STATS_EVENT_SUB;
+        snprintf (event->value, 24, "%" PRId64, -slot->delta);
+    }
+    else
+    {
+        event->action = STATS_EVENT_ADD;
+        snprintf (event->value, 24, "%" PRId64, slot->delta);
+    }
+    slot->merged = 0;
+}
+
+
+/* Merge increments, decrements, additions and subtractions to the same stat
+ * within a batch into the first of them, so a busy server is not processing
+ * and sending out an event per listener connect.  Any other event on that
+ * stat ends the run, and source wide events end all runs, to keep ordering.
+ */
+static void _coalesce_events (stats_event_t *batch)
+{
+    coalesce_slot_t slots [STATS_COALESCE_SLOTS];
+    stats_event_t *prev = NULL, *event = batch;
+    unsigned int used = 0, i;
+
+    memset (slots, 0, sizeof (slots));
+    while (event)
+    {
+        coalesce_slot_t *slot = NULL;
+        int64_t delta = 0;
+        int numeric;
+
+        if (event->name == NULL)
+        {
+            for (i = 0; i < STATS_COALESCE_SLOTS; i++)
+                if (slots[i].event)
+                    _finish_merge (&slots[i]);
+            memset (slots, 0, sizeof (slots));
+            used = 0;
+            prev = event;
+            event = event->next;
+            continue;
+        }
+        numeric = _event_delta (event, &delta);
+
+        i = _stat_hash (event);
+        while (slots[i].event && _same_stat (slots[i].event, event) == 0)
+            i = (i + 1) & (STATS_COALESCE_SLOTS - 1);
+        if (slots[i].event)
+            slot = &slots[i];
+
+        if (slot && numeric && slot->closed == 0)
+        {
+            /* fold this one into the earlier event and drop it */
+            slot->delta += delta;
+            slot->merged = 1;
+            prev->next = event->next;
+            _free_event (event);
+            event = prev->next;
+            continue;
+        }
+        if (slot)
+        {
+            _finish_merge (slot);
+            slot->event = event;
+            slot->delta = delta;
+            slot->closed = !numeric;
+        }
+        else if (numeric && used < STATS_COALESCE_SLOTS/2)
+        {
+            slots[i].event = event;
+            slots[i].delta = delta;
+            used++;
+        }
+        prev = event;
+        event = event->next;
+    }
+    for (i = 0; i < STATS_COALESCE_SLOTS; i++)
+        if (slots[i].event)
+            _finish_merge (&slots[i]);
+}
+
+
+/* link a processed event onto the published chain, the chain holds a
+ * reference on the last event so that listeners can find what follows,
+ * and each event holds a reference on the one linked after it */
+static void _publish_event (stats_event_t *event)
+{
+    stats_event_t *old;
+
+    event->next = NULL;
+    event->_count = 2;
+    thread_mutex_lock (&_publish_mutex);
+    old = _published_tail;
+    old->next = event;
+    _published_tail = event;
+    thread_mutex_unlock (&_publish_mutex);
+    _release_event (old);
+}
+
+
 static void *_stats_thread(void *arg)
 {
     stats_event_t *event;
-    stats_event_t *copy;
-    event_listener_t *listener;
+    time_t pool_update = 0;
 
     stats_event_time (NULL, "server_start");
     stats_event_time_iso8601 (NULL, "server_start_iso8601");
@@ -644,48 +1042,61 @@ static void *_stats_thread(void *arg)
 
     INFO0 ("stats thread started");
     while (_stats_running) {
+        stats_event_t *batch;
+
+        /* take everything queued so far in one go */
         thread_mutex_lock(&_global_event_mutex);
-        if (_global_event_queue.head != NULL) {
-            /* grab the next event from the queue */
-            event = _get_event_from_queue (&_global_event_queue);
-            thread_mutex_unlock(&_global_event_mutex);
+        batch = (stats_event_t *)_global_event_queue.head;
+        event_queue_init (&_global_event_queue);
+        thread_mutex_unlock(&_global_event_mutex);
 
-            if (event == NULL)
-                continue;
-            event->next = NULL;
+        if (batch)
+        {
+            _coalesce_events (batch);
 
             thread_mutex_lock(&_stats_mutex);
+            while (batch)
+            {
+                event = batch;
+                batch = event->next;
 
-            /* check if we are dealing with a global or source event */
-            if (event->source == NULL)
-                process_global_event (event);
-            else
-                process_source_event (event);
-            
-            /* now we have an event that's been processed into the running stats */
-            /* this event should get copied to event listeners' queues */
-            listener = (event_listener_t *)_event_listeners;
-            while (listener) {
-                copy = _copy_event(event);
-                thread_mutex_lock (&listener->mutex);
-                _add_event_to_queue (copy, &listener->queue);
-                thread_mutex_unlock (&listener->mutex);
-
-                listener = listener->next;
-            }
-
-            /* now we need to destroy the event */
-            _free_event(event);
+                /* check if we are dealing with a global or source event */
+                if (event->source == NULL)
+                    process_global_event (event);
+                else
+                    process_source_event (event);
 
+                /* the processed event is now shared with the listeners */
+                _publish_event (event);
+            }
+            if (_stats_threads)
+                _fold_counters ();
             thread_mutex_unlock(&_stats_mutex);
+            _publish_wakeup ();
             continue;
         }
-        else
+
+        /* stats listeners want to see counter changes as they happen */
+        if (_stats_threads)
         {
-            thread_mutex_unlock(&_global_event_mutex);
+            thread_mutex_lock(&_stats_mutex);
+            _fold_counters ();
+            thread_mutex_unlock(&_stats_mutex);
+            _publish_wakeup ();
         }
 
-        thread_sleep(300000);
+        if (time (NULL) >= pool_update)
+        {
+            _update_internal_stats ();
+            pool_update = time (NULL) + 5;
+        }
+        /* woken when events are queued, the timeout is for the counters
+         * and internal stats above */
+        thread_cond_lock (&_stats_wakeup);
+        if (_stats_wakeup_pending == 0)
+            thread_cond_timedwait_locked (&_stats_wakeup, 300);
+        _stats_wakeup_pending = 0;
+        thread_cond_unlock (&_stats_wakeup);
     }
 
     return NULL;
@@ -694,18 +1105,12 @@ static void *_stats_thread(void *arg)
 /* you must have the _stats_mutex locked here */
 static void _unregister_listener(event_listener_t *listener)
 {
-    event_listener_t **prev = (event_listener_t **)&_event_listeners,
-                     *current = *prev;
-    while (current)
-    {
-        if (current == listener)
-        {
-            *prev = current->next;
-            break;
-        }
-        prev = &current->next;
-        current = *prev;
-    }
+    stats_event_t *event;
+
+    _release_event (listener->position);
+    listener->position = NULL;
+    while ((event = _get_event_from_queue (&listener->queue)) != NULL)
+        _free_event (event);
 }
 
 
@@ -775,6 +1180,7 @@ static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, const char *show_mount, i
     xmlNodePtr ret = NULL;
 
     thread_mutex_lock(&_stats_mutex);
+    _fold_counters ();
     /* general stats first */
     avlnode = avl_get_first(_stats.global_tree);
     while (avlnode)
@@ -825,6 +1231,7 @@ static void _register_listener (event_listener_t *listener)
     stats_source_t *source;
 
     thread_mutex_lock(&_stats_mutex);
+    _fold_counters ();
 
     /* first we fill our queue with the current stats */
     
@@ -852,9 +1259,12 @@ static void _register_listener (event_listener_t *listener)
         node = avl_get_next(node);
     }
 
-    /* now we register to receive future event notices */
-    listener->next = (event_listener_t *)_event_listeners;
-    _event_listeners = listener;
+    /* now we register to receive future event notices, events are
+     * published with the _stats_mutex held so none can be missed */
+    thread_mutex_lock (&_publish_mutex);
+    listener->position = _published_tail;
+    thread_atomic_add (&listener->position->_count, 1);
+    thread_mutex_unlock (&_publish_mutex);
 
     thread_mutex_unlock(&_stats_mutex);
 }
@@ -874,23 +1284,40 @@ void *stats_connection(void *arg)
     stats_event_args (NULL, "stats", "%d", _stats_threads);
     thread_mutex_unlock(&_stats_mutex);
 
-    thread_mutex_create (&(listener.mutex));
-
     _register_listener (&listener);
 
     while (_stats_running) {
-        thread_mutex_lock (&listener.mutex);
+        /* the snapshot of the stats goes out first */
         event = _get_event_from_queue (&listener.queue);
-        thread_mutex_unlock (&listener.mutex);
         if (event != NULL) {
-            if (_send_event_to_client(event, client) < 0) {
-                _free_event(event);
-                break;
-            }
+            int ret = _send_event_to_client(event, client);
             _free_event(event);
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        /* then follow the published events */
+        thread_mutex_lock (&_publish_mutex);
+        event = listener.position->next;
+        if (event)
+            thread_atomic_add (&event->_count, 1);
+        thread_mutex_unlock (&_publish_mutex);
+        if (event != NULL) {
+            _release_event (listener.position);
+            listener.position = event;
+            if (_send_event_to_client(event, client) < 0)
+                break;
             continue;
         }
-        thread_sleep (500000);
+        /* recheck with the cond locked, a broadcast cannot then be missed */
+        thread_cond_lock (&_publish_cond);
+        thread_mutex_lock (&_publish_mutex);
+        event = listener.position->next;
+        thread_mutex_unlock (&_publish_mutex);
+        if (event == NULL && _stats_running)
+            thread_cond_timedwait_locked (&_publish_cond, 500);
+        thread_cond_unlock (&_publish_cond);
     }
 
     thread_mutex_lock(&_stats_mutex);
@@ -899,7 +1326,6 @@ void *stats_connection(void *arg)
     stats_event_args (NULL, "stats", "%d", _stats_threads);
     thread_mutex_unlock(&_stats_mutex);
 
-    thread_mutex_destroy (&listener.mutex);
     client_destroy (client);
     INFO0 ("stats client finished");
 
@@ -1000,6 +1426,19 @@ static void _free_event(stats_event_t *event)
     free(event);
 }
 
+/* drop a reference on a published event, freeing an event drops the
+ * reference it holds on the next so a run of them can go at once */
+static void _release_event(stats_event_t *event)
+{
+    while (event && thread_atomic_sub (&event->_count, 1) == 0)
+    {
+        stats_event_t *next = event->next;
+
+        _free_event (event);
+        event = next;
+    }
+}
+
 
 refbuf_t *stats_get_streams (void)
 {
@@ -37,9 +37,41 @@ typedef struct _stats_event_tag
     int  hidden;
     int  action;
 
+    /* references held by stats listeners once published */
+    unsigned int _count;
+
     struct _stats_event_tag *next;
 } stats_event_t;
 
+/* A numeric stat updated with an atomic add instead of queueing an event.
+ * The changes are folded into the stats when they are rendered or sent to
+ * stats listeners.
+ */
+typedef struct _stats_counter_tag
+{
+    char *source;
+    char *name;
+    long value;
+    int refs;           /* holders of the handle, changed with the stats lock */
+
+    struct _stats_counter_tag *next;
+} stats_counter_t;
+
+/* global counters changed often, mostly on every client connect or
+ * disconnect */
+typedef enum
+{
+    STATS_CLIENTS,
+    STATS_CONNECTIONS,
+    STATS_CLIENT_CONNECTIONS,
+    STATS_STATS_CONNECTIONS,
+    STATS_FILE_CONNECTIONS,
+    STATS_LISTENERS,
+    STATS_LISTENER_CONNECTIONS,
+    STATS_RELAYS_REFUSED,
+    STATS_GLOBAL_COUNTERS
+} stats_global_counter_t;
+
 typedef struct _stats_source_tag
 {
     char *source;
@@ -89,6 +121,15 @@ void stats_event_sub(const char *source, const char *name, unsigned long value);
 void stats_event_dec(const char *source, const char *name);
 void stats_event_hidden (const char *source, const char *name, int hidden);
 void stats_event_time (const char *mount, const char *name);
+
+stats_counter_t *stats_counter (const char *source, const char *name);
+void stats_counter_release (stats_counter_t *counter);
+void stats_counter_add (stats_counter_t *counter, long value);
+void stats_global_add (stats_global_counter_t id, long value);
+#define stats_counter_inc(c)    stats_counter_add(c,1)
+#define stats_counter_dec(c)    stats_counter_add(c,-1)
+#define stats_global_inc(id)    stats_global_add(id,1)
+#define stats_global_dec(id)    stats_global_add(id,-1)
 void stats_event_time_iso8601 (const char *mount, const char *name);
 
 void *stats_connection(void *arg);
@@ -0,0 +1,102 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* timers.c
+ *
+ * Drives the timer wheel used for header timeouts, listener time limits
+ * and source inactivity, so none of those have to be checked by polling
+ * each connection.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "thread/thread.h"
+#include "timing/timing.h"
+
+#include "timers.h"
+#include "logging.h"
+
+#undef CATMODULE
+#define CATMODULE "timers"
+
+/* resolution of the timeouts in ms */
+#define TIMERS_TICK 100
+
+static timer_wheel_t timers_wheel;
+static mutex_t timers_lock;
+static int timers_running;
+static int timers_active;
+static thread_type *timers_thread;
+
+
+static void *timers_run (void *arg)
+{
+    while (timers_running)
+    {
+        thread_mutex_lock (&timers_lock);
+        timer_wheel_advance (&timers_wheel, timing_get_time());
+        thread_mutex_unlock (&timers_lock);
+        thread_sleep (TIMERS_TICK*1000);
+    }
+    return NULL;
+}
+
+
+void timers_initialize (void)
+{
+    thread_mutex_create (&timers_lock);
+    timer_wheel_init (&timers_wheel, timing_get_time(), TIMERS_TICK);
+    timers_active = 1;
+    timers_running = 1;
+    timers_thread = thread_create ("Timer Thread", timers_run, NULL, THREAD_ATTACHED);
+}
+
+
+void timers_shutdown (void)
+{
+    if (timers_active == 0)
+        return;
+    timers_running = 0;
+    thread_join (timers_thread);
+    thread_mutex_lock (&timers_lock);
+    if (timers_wheel.pending)
+        DEBUG1 ("%u timers still pending", timers_wheel.pending);
+    timers_active = 0;
+    thread_mutex_unlock (&timers_lock);
+}
+
+
+/* fire the timer callback in ms from now, rescheduling if already pending */
+void timers_add (timer_entry_t *timer, unsigned int ms)
+{
+    if (timers_thread == NULL)
+        return;
+    thread_mutex_lock (&timers_lock);
+    if (timers_active)
+        timer_wheel_add (&timers_wheel, timer, timing_get_time() + ms);
+    thread_mutex_unlock (&timers_lock);
+}
+
+
+/* on return the timer callback is not running and will not be called */
+void timers_cancel (timer_entry_t *timer)
+{
+    if (timers_thread == NULL)
+        return;
+    thread_mutex_lock (&timers_lock);
+    timer_wheel_cancel (&timers_wheel, timer);
+    thread_mutex_unlock (&timers_lock);
+}
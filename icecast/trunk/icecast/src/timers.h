@@ -0,0 +1,28 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __TIMERS_H__
+#define __TIMERS_H__
+
+#include "timing/timer.h"
+
+/* Timeouts are kept on a single timer wheel serviced by one thread.  The
+ * callbacks are run from that thread with the timers locked, so they should
+ * only flag the owner of the timer and must not add or cancel timers, a
+ * callback reschedules itself by returning the delay in ms.
+ */
+void timers_initialize (void);
+void timers_shutdown (void);
+void timers_add (timer_entry_t *timer, unsigned int ms);
+void timers_cancel (timer_entry_t *timer);
+
+#endif  /* __TIMERS_H__ */
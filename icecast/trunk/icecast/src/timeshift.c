@@ -0,0 +1,356 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* timeshift.c
+ *
+ * Per mount rewind buffer.  The stream is copied into a fixed size file
+ * through a shared mapping, so listeners joining in the past are sent
+ * straight from the page cache, with sendfile where the connection allows.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "thread/thread.h"
+#include "net/sock.h"
+
+#include "connection.h"
+#include "refbuf.h"
+#include "client.h"
+#include "source.h"
+#include "timeshift.h"
+
+#define CATMODULE "timeshift"
+
+#include "logging.h"
+
+#define TIMESHIFT_MIN_SIZE      (1024*1024)
+#define TIMESHIFT_INDEX_INITIAL 256
+/* most sent to one listener in one go */
+#define TIMESHIFT_CHUNK         (64*1024)
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#define TIMESHIFT_SENDFILE
+#ifdef HAVE_OPENSSL
+#define timeshift_plain_connection(con) ((con)->ssl == NULL)
+#else
+#define timeshift_plain_connection(con) 1
+#endif
+#endif
+
+typedef struct
+{
+    uint64_t offset;
+    time_t time;
+} timeshift_point_t;
+
+struct timeshift_tag
+{
+    int refcount;
+    int fd;
+    char *map;
+    unsigned int size;
+    /* data this close to being overwritten is not handed out, so a
+     * listener part way through a send is not overtaken by the writer */
+    unsigned int guard;
+
+    /* the writer changes these under the lock, listeners read them */
+    spin_t lock;
+    uint64_t written;
+    timeshift_point_t *index;
+    unsigned int index_size;
+    unsigned int index_start;
+    unsigned int index_count;
+};
+
+
+timeshift_t *timeshift_open (const char *filename, unsigned int size)
+{
+#ifdef HAVE_SYS_MMAN_H
+    timeshift_t *ts;
+    int fd;
+    void *map;
+
+    if (size < TIMESHIFT_MIN_SIZE)
+    {
+        WARN2 ("timeshift size for %s raised to %d", filename, TIMESHIFT_MIN_SIZE);
+        size = TIMESHIFT_MIN_SIZE;
+    }
+    fd = open (filename, O_RDWR|O_CREAT, 0600);
+    if (fd < 0)
+    {
+        ERROR2 ("unable to open timeshift file %s, %s", filename, strerror (errno));
+        return NULL;
+    }
+    if (ftruncate (fd, size) < 0)
+    {
+        ERROR2 ("unable to size timeshift file %s, %s", filename, strerror (errno));
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        ERROR2 ("unable to map timeshift file %s, %s", filename, strerror (errno));
+        close (fd);
+        return NULL;
+    }
+    ts = calloc (1, sizeof (timeshift_t));
+    if (ts == NULL)
+    {
+        munmap (map, size);
+        close (fd);
+        return NULL;
+    }
+    ts->refcount = 1;
+    ts->fd = fd;
+    ts->map = map;
+    ts->size = size;
+    ts->guard = size / 8;
+    thread_spin_create (&ts->lock);
+    INFO2 ("timeshift file %s, %u bytes", filename, size);
+    return ts;
+#else
+    WARN1 ("timeshift not available on this platform, %s ignored", filename);
+    return NULL;
+#endif
+}
+
+
+void timeshift_addref (timeshift_t *ts)
+{
+    if (ts)
+        thread_atomic_add (&ts->refcount, 1);
+}
+
+
+void timeshift_release (timeshift_t *ts)
+{
+    if (ts == NULL || thread_atomic_sub (&ts->refcount, 1) > 0)
+        return;
+#ifdef HAVE_SYS_MMAN_H
+    munmap (ts->map, ts->size);
+#endif
+    close (ts->fd);
+    thread_spin_destroy (&ts->lock);
+    free (ts->index);
+    free (ts);
+}
+
+
+/* stream offset of the oldest data that can be sent, lock held */
+static uint64_t timeshift_oldest (timeshift_t *ts)
+{
+    uint64_t span = ts->size - ts->guard;
+
+    return ts->written > span ? ts->written - span : 0;
+}
+
+
+/* copy a queued buffer into the ring, called from the source thread */
+void timeshift_write (timeshift_t *ts, refbuf_t *refbuf)
+{
+    timeshift_point_t *index = NULL, *old = NULL;
+    unsigned int pos, len = refbuf->len, first, size = ts->index_size;
+    uint64_t offset = ts->written, oldest;
+    time_t now = time (NULL);
+    int add = 0;
+
+    if (len == 0 || len > ts->guard)
+        return;
+    pos = (unsigned int)(offset % ts->size);
+    first = ts->size - pos;
+    if (first > len)
+        first = len;
+    memcpy (ts->map + pos, refbuf->data, first);
+    if (len > first)
+        memcpy (ts->map, refbuf->data + first, len - first);
+
+    /* one index point per second is enough for time based requests */
+    if (refbuf->sync_point)
+    {
+        if (ts->index_count == 0)
+            add = 1;
+        else
+        {
+            unsigned int last = (ts->index_start + ts->index_count - 1) & (ts->index_size - 1);
+            add = ts->index [last].time < now;
+        }
+    }
+    if (add && ts->index_count == ts->index_size)
+    {
+        unsigned int i;
+
+        size = size ? size * 2 : TIMESHIFT_INDEX_INITIAL;
+        index = malloc (size * sizeof (timeshift_point_t));
+        if (index == NULL)
+            add = 0;
+        else
+        {
+            for (i = 0; i < ts->index_count; i++)
+                index [i] = ts->index [(ts->index_start + i) & (ts->index_size - 1)];
+        }
+    }
+
+    thread_spin_lock (&ts->lock);
+    if (index)
+    {
+        old = ts->index;
+        ts->index = index;
+        ts->index_size = size;
+        ts->index_start = 0;
+    }
+    if (add)
+    {
+        timeshift_point_t *point = &ts->index
+            [(ts->index_start + ts->index_count) & (ts->index_size - 1)];
+        point->offset = offset;
+        point->time = now;
+        ts->index_count++;
+    }
+    ts->written += len;
+    oldest = timeshift_oldest (ts);
+    while (ts->index_count && ts->index [ts->index_start].offset < oldest)
+    {
+        ts->index_start = (ts->index_start + 1) & (ts->index_size - 1);
+        ts->index_count--;
+    }
+    thread_spin_unlock (&ts->lock);
+    free (old);
+}
+
+
+/* find the first index point queued at or after when, or the closest one
+ * if there is none.  Returns -1 if nothing has been indexed yet */
+int timeshift_find (timeshift_t *ts, time_t when, uint64_t *offset)
+{
+    int ret = -1;
+
+    thread_spin_lock (&ts->lock);
+    if (ts->index_count)
+    {
+        unsigned int mask = ts->index_size - 1;
+        unsigned int low = 0, high = ts->index_count - 1;
+
+        while (low < high)
+        {
+            unsigned int mid = (low + high) / 2;
+
+            if (ts->index [(ts->index_start + mid) & mask].time < when)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        *offset = ts->index [(ts->index_start + low) & mask].offset;
+        ret = 0;
+    }
+    thread_spin_unlock (&ts->lock);
+    return ret;
+}
+
+
+/* client check_buffer handler, returns 0 if there is data to send from the
+ * ring, -1 if the listener has caught up with the stream */
+int timeshift_check_buffer (source_t *source, client_t *client)
+{
+    timeshift_t *ts = client->timeshift;
+    int ret = -1;
+
+    thread_spin_lock (&ts->lock);
+    if (client->timeshift_pos < timeshift_oldest (ts))
+    {
+        /* fallen out of the ring, so restart at the oldest point kept */
+        if (ts->index_count)
+            client->timeshift_pos = ts->index [ts->index_start].offset;
+        else
+            client->timeshift_pos = ts->written;
+        DEBUG1 ("client %lu moved up the timeshift ring", client->con->id);
+    }
+    if (client->timeshift_pos < ts->written)
+        ret = 0;
+    thread_spin_unlock (&ts->lock);
+    return ret;
+}
+
+
+/* client write_to_client handler, send from the ring up to the end of the
+ * file or the end of the data written, whichever is first */
+int timeshift_write_to_client (client_t *client)
+{
+    timeshift_t *ts = client->timeshift;
+    uint64_t written;
+    unsigned int pos, len;
+    int ret;
+
+    thread_spin_lock (&ts->lock);
+    written = ts->written;
+    thread_spin_unlock (&ts->lock);
+
+    if (client->timeshift_pos >= written)
+        return 0;
+    pos = (unsigned int)(client->timeshift_pos % ts->size);
+    len = ts->size - pos;
+    if (written - client->timeshift_pos < len)
+        len = (unsigned int)(written - client->timeshift_pos);
+    if (len > TIMESHIFT_CHUNK)
+        len = TIMESHIFT_CHUNK;
+
+#ifdef TIMESHIFT_SENDFILE
+    if (timeshift_plain_connection (client->con))
+    {
+        off_t file_pos = pos;
+        ssize_t bytes = sendfile (client->con->sock, ts->fd, &file_pos, len);
+
+        if (bytes < 0 && (errno == EINVAL || errno == ENOSYS))
+            ret = client_send_bytes (client, ts->map + pos, len);
+        else if (bytes < 0)
+        {
+            if (sock_recoverable (sock_error()))
+                client->con->blocked = 1;
+            else
+                client->con->error = 1;
+            return -1;
+        }
+        else
+        {
+            if ((unsigned int)bytes < len)
+                client->con->blocked = 1;
+            client->con->sent_bytes += bytes;
+            ret = (int)bytes;
+        }
+    }
+    else
+#endif
+        ret = client_send_bytes (client, ts->map + pos, len);
+
+    if (ret > 0)
+        client->timeshift_pos += ret;
+    return ret;
+}
@@ -0,0 +1,37 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __TIMESHIFT_H__
+#define __TIMESHIFT_H__
+
+#include "refbuf.h"
+
+struct source_tag;
+struct _client_tag;
+typedef struct timeshift_tag timeshift_t;
+
+/* A ring file holding the most recent part of a stream, written by the
+ * source thread through a shared mapping and read back by listeners that
+ * asked to start some time in the past.  Only sync points are indexed,
+ * at most one per second, each with the time it was queued.
+ */
+timeshift_t *timeshift_open (const char *filename, unsigned int size);
+void timeshift_addref (timeshift_t *ts);
+void timeshift_release (timeshift_t *ts);
+void timeshift_write (timeshift_t *ts, refbuf_t *refbuf);
+int  timeshift_find (timeshift_t *ts, time_t when, uint64_t *offset);
+
+/* client handlers for listeners reading from the ring */
+int  timeshift_check_buffer (struct source_tag *source, struct _client_tag *client);
+int  timeshift_write_to_client (struct _client_tag *client);
+
+#endif  /* __TIMESHIFT_H__ */
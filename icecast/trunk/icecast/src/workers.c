@@ -0,0 +1,249 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* workers.c
+ *
+ * A fixed pool of threads which send stream data to listeners. Each
+ * running source is assigned to the least loaded worker when it starts,
+ * the worker then services every listener on that source until the
+ * source thread exits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "thread/thread.h"
+
+#include "cfgfile.h"
+#include "source.h"
+#include "stats.h"
+#include "logging.h"
+#include "workers.h"
+
+#undef CATMODULE
+#define CATMODULE "workers"
+
+/* how long an idle worker waits before checking its listeners anyway,
+ * needed for time limited listeners and new clients */
+#define WORKER_IDLE_WAIT 250
+
+static worker_t *workers;
+static int workers_count;
+static mutex_t workers_lock;
+
+
+/* flag the worker as having something to do, a worker not yet waiting
+ * sees the flag and goes round again instead of sleeping */
+static void worker_signal (worker_t *worker)
+{
+    thread_cond_lock (&worker->wakeup);
+    worker->wakeup_pending = 1;
+    thread_cond_signal (&worker->wakeup);
+    thread_cond_unlock (&worker->wakeup);
+}
+
+
+static int workers_default_count (void)
+{
+    int count = 1;
+#if defined(_SC_NPROCESSORS_ONLN)
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (cpus > 0)
+        count = (int)cpus;
+#endif
+    return count;
+}
+
+
+static void *worker_thread (void *arg)
+{
+    worker_t *worker = arg;
+
+    DEBUG1 ("worker %d started", worker->id);
+    while (1)
+    {
+        source_t *source;
+        int again = 0;
+
+        thread_mutex_lock (&worker->lock);
+        if (worker->running == 0)
+        {
+            thread_mutex_unlock (&worker->lock);
+            break;
+        }
+        for (source = worker->sources; source; source = source->worker_next)
+        {
+            if (source_send_to_listeners (source))
+                again = 1;
+        }
+        thread_mutex_unlock (&worker->lock);
+
+        /* more may be writable on some listeners, so don't wait around */
+        if (again)
+            continue;
+        thread_cond_lock (&worker->wakeup);
+        if (worker->wakeup_pending == 0)
+            thread_cond_timedwait_locked (&worker->wakeup, WORKER_IDLE_WAIT);
+        worker->wakeup_pending = 0;
+        thread_cond_unlock (&worker->wakeup);
+    }
+    DEBUG1 ("worker %d exiting", worker->id);
+    return NULL;
+}
+
+
+void workers_initialize (void)
+{
+    ice_config_t *config = config_get_config();
+    int i, count = config->threadpool_size;
+
+    config_release_config();
+
+    if (count <= 0)
+        count = workers_default_count();
+
+    thread_mutex_create (&workers_lock);
+    workers = calloc (count, sizeof (worker_t));
+    for (i = 0; i < count; i++)
+    {
+        worker_t *worker = &workers[i];
+
+        worker->id = i;
+        worker->running = 1;
+        thread_mutex_create (&worker->lock);
+        thread_cond_create (&worker->wakeup);
+        worker->thread = thread_create ("Listener Worker", worker_thread,
+                worker, THREAD_ATTACHED);
+    }
+    workers_count = count;
+    stats_event_args (NULL, "listener_workers", "%d", count);
+    INFO1 ("started %d listener worker threads", count);
+}
+
+
+void workers_shutdown (void)
+{
+    int i;
+
+    if (workers == NULL)
+        return;
+    /* any source still attached must not refer to the pool after this,
+     * source->worker is only changed with workers_lock held */
+    thread_mutex_lock (&workers_lock);
+    for (i = 0; i < workers_count; i++)
+    {
+        worker_t *worker = &workers[i];
+        source_t *source;
+
+        thread_mutex_lock (&worker->lock);
+        worker->running = 0;
+        for (source = worker->sources; source; source = source->worker_next)
+            source->worker = NULL;
+        worker->sources = NULL;
+        thread_mutex_unlock (&worker->lock);
+    }
+    thread_mutex_unlock (&workers_lock);
+
+    for (i = 0; i < workers_count; i++)
+    {
+        worker_t *worker = &workers[i];
+
+        worker_signal (worker);
+        thread_join (worker->thread);
+        thread_cond_destroy (&worker->wakeup);
+        thread_mutex_destroy (&worker->lock);
+    }
+    free (workers);
+    workers = NULL;
+    workers_count = 0;
+    thread_mutex_destroy (&workers_lock);
+}
+
+
+/* hand the listeners of this source over to the least loaded worker */
+void workers_add_source (source_t *source)
+{
+    worker_t *worker;
+    int i;
+
+    thread_mutex_lock (&workers_lock);
+    worker = &workers[0];
+    for (i = 1; i < workers_count; i++)
+    {
+        if (workers[i].sources_count < worker->sources_count)
+            worker = &workers[i];
+    }
+    thread_mutex_lock (&worker->lock);
+    source->worker = worker;
+    source->worker_next = worker->sources;
+    worker->sources = source;
+    worker->sources_count++;
+    thread_mutex_unlock (&worker->lock);
+    thread_mutex_unlock (&workers_lock);
+
+    DEBUG2 ("source %s assigned to worker %d", source->mount, worker->id);
+}
+
+
+/* detach the source from its worker, on return the worker will no longer
+ * be touching the source listeners */
+void workers_remove_source (source_t *source)
+{
+    worker_t *worker;
+    source_t **trail;
+
+    /* once shut down, the pool has already detached every source */
+    if (workers == NULL)
+        return;
+    thread_mutex_lock (&workers_lock);
+    worker = source->worker;
+    if (worker == NULL)
+    {
+        thread_mutex_unlock (&workers_lock);
+        return;
+    }
+    thread_mutex_lock (&worker->lock);
+    trail = &worker->sources;
+    while (*trail)
+    {
+        if (*trail == source)
+        {
+            *trail = source->worker_next;
+            worker->sources_count--;
+            break;
+        }
+        trail = &(*trail)->worker_next;
+    }
+    source->worker = NULL;
+    source->worker_next = NULL;
+    thread_mutex_unlock (&worker->lock);
+    thread_mutex_unlock (&workers_lock);
+}
+
+
+/* called by the source thread when new data has been queued */
+void workers_wakeup (source_t *source)
+{
+    worker_t *worker = source->worker;
+
+    if (worker)
+        worker_signal (worker);
+}
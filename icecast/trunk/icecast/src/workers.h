@@ -0,0 +1,45 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+#include "thread/thread.h"
+
+struct source_tag;
+
+/* A worker thread delivers queued stream data to the listeners of each
+ * source assigned to it.  The source thread itself only reads from the
+ * source client and appends to the stream queue.
+ */
+typedef struct worker_tag
+{
+    int id;
+    int running;
+    unsigned int sources_count;
+
+    /* held while the listeners of the assigned sources are processed */
+    mutex_t lock;
+    cond_t wakeup;
+    int wakeup_pending;     /* set and cleared with the wakeup lock held */
+    struct source_tag *sources;
+
+    thread_type *thread;
+} worker_t;
+
+void workers_initialize (void);
+void workers_shutdown (void);
+void workers_add_source (struct source_tag *source);
+void workers_remove_source (struct source_tag *source);
+void workers_wakeup (struct source_tag *source);
+
+#endif  /* __WORKERS_H__ */
@@ -18,9 +18,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sys/select.h>
+#endif
 #include <curl/curl.h>
 
 #include "thread/thread.h"
+#include "timing/timing.h"
 
 #include "connection.h"
 #include "refbuf.h"
@@ -37,18 +42,41 @@
 
 #define CATMODULE "yp" 
 
+/* a request to a directory server, the curl handle and post buffer are
+ * kept for later requests to the same server once it completes */
+typedef struct yp_request_tag
+{
+    CURL        *handle;
+    struct yp_server *server;
+    struct ypdata_tag *yp;
+    int         (*process)(struct ypdata_tag *yp, char *s, unsigned len);
+    const char  *cmd;
+    int         started;
+    uint64_t    start_ms;
+    char        *post;
+    unsigned    post_len;
+    char        curl_error[CURL_ERROR_SIZE];
+    struct yp_request_tag *next;
+} yp_request_t;
+
 struct yp_server
 {
     char        *url;
     char        *server_id;
     unsigned    url_timeout;
     unsigned    touch_interval;
+    unsigned    max_requests;
     int         remove;
+    int         id;
+
+    /* requests in progress and idle ones ready for reuse */
+    yp_request_t *active, *idle;
+    unsigned    requests;
+    unsigned    latency_ms;
+    stats_counter_t *sent, *failed;
 
-    CURL *curl;
     struct ypdata_tag *mounts, *pending_mounts;
     struct yp_server *next;
-    char curl_error[CURL_ERROR_SIZE];
 };
 
 
@@ -74,9 +102,14 @@ typedef struct ypdata_tag
     char *subtype;
 
     struct yp_server *server;
+    yp_request_t *request;  /* set while a request is in progress */
     time_t      next_update;
     unsigned    touch_interval;
     char        *error_msg;
+
+    /* unescaped values last sent, to skip escaping them again */
+    char        *last_song;
+    char        *last_subtype;
     int    (*process)(struct ypdata_tag *yp, char *s, unsigned len);
 
     struct ypdata_tag *next;
@@ -93,6 +126,9 @@ static time_t now;
 static thread_type *yp_thread;
 static volatile unsigned client_limit = 0;
 static volatile char *server_version = NULL;
+static CURLM *yp_multi;
+static unsigned yp_requests;
+static int yp_stats_count;
 
 static void *yp_update_thread(void *arg);
 static void add_yp_info (ypdata_t *yp, void *info, int type);
@@ -181,10 +217,32 @@ static void destroy_yp_server (struct yp_server *server)
     if (server == NULL)
         return;
     DEBUG1 ("Removing YP server entry for %s", server->url);
-    if (server->curl)
-        curl_easy_cleanup (server->curl);
+    while (server->active)
+    {
+        yp_request_t *req = server->active;
+
+        server->active = req->next;
+        curl_multi_remove_handle (yp_multi, req->handle);
+        if (req->yp)
+            req->yp->request = NULL;
+        curl_easy_cleanup (req->handle);
+        free (req->post);
+        free (req);
+        yp_requests--;
+    }
+    while (server->idle)
+    {
+        yp_request_t *req = server->idle;
+
+        server->idle = req->next;
+        curl_easy_cleanup (req->handle);
+        free (req->post);
+        free (req);
+    }
     if (server->mounts) WARN0 ("active ypdata not freed up");
     if (server->pending_mounts) WARN0 ("pending ypdata not freed up");
+    stats_counter_release (server->sent);
+    stats_counter_release (server->failed);
     free (server->url);
     free (server->server_id);
     free (server);
@@ -206,13 +264,112 @@ static ypdata_t *find_yp_mount (ypdata_t *mounts, const char *mount)
 }
 
 
+/* the stats for a server are named by its position in the config, the
+ * counters are only taken again if that changes.  yp_lock is held for
+ * writing */
+static void yp_server_stats (struct yp_server *server, int id)
+{
+    char name [40];
+
+    snprintf (name, sizeof (name), "yp_server%d_url", id);
+    stats_event (NULL, name, server->url);
+    if (server->sent && server->id == id)
+        return;
+    stats_counter_release (server->sent);
+    stats_counter_release (server->failed);
+    server->id = id;
+    snprintf (name, sizeof (name), "yp_server%d_requests", id);
+    server->sent = stats_counter (NULL, name);
+    snprintf (name, sizeof (name), "yp_server%d_failures", id);
+    server->failed = stats_counter (NULL, name);
+}
+
+
+/* take an idle request for the server, or create one if the server has
+ * fewer than its limit in progress */
+static yp_request_t *yp_request_get (struct yp_server *server)
+{
+    yp_request_t *req;
+
+    if (server->requests >= server->max_requests)
+        return NULL;
+    req = server->idle;
+    if (req)
+    {
+        server->idle = req->next;
+        req->next = NULL;
+        return req;
+    }
+    req = calloc (1, sizeof (yp_request_t));
+    if (req == NULL)
+        return NULL;
+    req->handle = curl_easy_init();
+    if (req->handle == NULL)
+    {
+        free (req);
+        return NULL;
+    }
+    req->server = server;
+    curl_easy_setopt (req->handle, CURLOPT_USERAGENT, server->server_id);
+    curl_easy_setopt (req->handle, CURLOPT_URL, server->url);
+    curl_easy_setopt (req->handle, CURLOPT_HEADERFUNCTION, handle_returned_header);
+    curl_easy_setopt (req->handle, CURLOPT_WRITEFUNCTION, handle_returned_data);
+    curl_easy_setopt (req->handle, CURLOPT_WRITEDATA, req->handle);
+    curl_easy_setopt (req->handle, CURLOPT_TIMEOUT, server->url_timeout);
+    curl_easy_setopt (req->handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt (req->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (req->handle, CURLOPT_MAXREDIRS, 3L);
+    curl_easy_setopt (req->handle, CURLOPT_PRIVATE, req);
+    curl_easy_setopt (req->handle, CURLOPT_ERRORBUFFER, &(req->curl_error[0]));
+    return req;
+}
+
+
+/* the request is finished with, keep it for reuse */
+static void yp_request_put (yp_request_t *req)
+{
+    struct yp_server *server = req->server;
+
+    if (req->started)
+    {
+        yp_request_t **trail = &server->active;
+
+        while (*trail && *trail != req)
+            trail = &(*trail)->next;
+        if (*trail)
+            *trail = req->next;
+        server->requests--;
+        yp_requests--;
+        req->started = 0;
+    }
+    if (req->yp)
+        req->yp->request = NULL;
+    req->yp = NULL;
+    req->next = server->idle;
+    server->idle = req;
+}
+
+
 void yp_recheck_config (ice_config_t *config)
 {
     int i;
     struct yp_server *server;
 
     DEBUG0("Updating YP configuration");
-    thread_rwlock_rlock (&yp_lock);
+    /* the YP thread reads the server settings changed here */
+    thread_rwlock_wlock (&yp_lock);
+
+    /* drop the stats of servers no longer configured */
+    for (i = config->num_yp_directories; i < yp_stats_count; i++)
+    {
+        char name [40];
+
+        snprintf (name, sizeof (name), "yp_server%d_url", i);
+        stats_event (NULL, name, NULL);
+        snprintf (name, sizeof (name), "yp_server%d_latency_ms", i);
+        stats_event (NULL, name, NULL);
+    }
+    yp_stats_count = config->num_yp_directories;
 
     server = (struct yp_server *)active_yps;
     while (server)
@@ -241,26 +398,10 @@ void yp_recheck_config (ice_config_t *config)
             server->url = strdup (config->yp_url[i]);
             server->url_timeout = config->yp_url_timeout[i];
             server->touch_interval = config->yp_touch_interval[i];
-            server->curl = curl_easy_init();
-            if (server->curl == NULL)
-            {
-                destroy_yp_server (server);
-                break;
-            }
             if (server->url_timeout > 10 || server->url_timeout < 1)
                 server->url_timeout = 6;
             if (server->touch_interval < 30)
                 server->touch_interval = 30;
-            curl_easy_setopt (server->curl, CURLOPT_USERAGENT, server->server_id);
-            curl_easy_setopt (server->curl, CURLOPT_URL, server->url);
-            curl_easy_setopt (server->curl, CURLOPT_HEADERFUNCTION, handle_returned_header);
-            curl_easy_setopt (server->curl, CURLOPT_WRITEFUNCTION, handle_returned_data);
-            curl_easy_setopt (server->curl, CURLOPT_WRITEDATA, server->curl);
-            curl_easy_setopt (server->curl, CURLOPT_TIMEOUT, server->url_timeout);
-            curl_easy_setopt (server->curl, CURLOPT_NOSIGNAL, 1L);
-            curl_easy_setopt (server->curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt (server->curl, CURLOPT_MAXREDIRS, 3L);
-            curl_easy_setopt (server->curl, CURLOPT_ERRORBUFFER, &(server->curl_error[0]));
             server->next = (struct yp_server *)pending_yps;
             pending_yps = server;
             INFO3 ("Adding new YP server \"%s\" (timeout %ds, default interval %ds)",
@@ -270,6 +411,10 @@ void yp_recheck_config (ice_config_t *config)
         {
             server->remove = 0;
         }
+        server->max_requests = config->yp_max_requests[i];
+        if (server->max_requests < 1)
+            server->max_requests = 4;
+        yp_server_stats (server, i);
     }
     thread_rwlock_unlock (&yp_lock);
     yp_update = 1;
@@ -289,57 +434,213 @@ void yp_initialize(void)
 
 
 
-/* handler for curl, checks if successful handling occurred
- * return 0 for ok, -1 for this entry failed, -2 for server fail.
- * On failure case, update and process are modified
+/* start the request for the ypdata on the multi handle, the result is
+ * dealt with in yp_request_done. Returns 0 if started, -2 on failure
  */
 static int send_to_yp (const char *cmd, ypdata_t *yp, char *post)
 {
-    int curlcode;
+    yp_request_t *req = yp->request;
     struct yp_server *server = yp->server;
 
     /* DEBUG2 ("send YP (%s):%s", cmd, post); */
     yp->cmd_ok = 0;
-    curl_easy_setopt (server->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (server->curl, CURLOPT_WRITEHEADER, yp);
-    curlcode = curl_easy_perform (server->curl);
-    if (curlcode)
+    req->cmd = cmd;
+    req->process = yp->process;
+    req->curl_error[0] = '\0';
+    curl_easy_setopt (req->handle, CURLOPT_POSTFIELDS, post);
+    curl_easy_setopt (req->handle, CURLOPT_WRITEHEADER, yp);
+    if (curl_multi_add_handle (yp_multi, req->handle) != CURLM_OK)
     {
         yp->process = do_yp_add;
         yp->next_update = now + 1200;
-        ERROR2 ("connection to %s failed with \"%s\"", server->url, server->curl_error);
+        ERROR1 ("unable to start request to %s", server->url);
         return -2;
     }
-    if (yp->cmd_ok == 0)
+    req->start_ms = timing_get_time();
+    req->started = 1;
+    req->next = server->active;
+    server->active = req;
+    server->requests++;
+    yp_requests++;
+    stats_counter_inc (server->sent);
+    return 0;
+}
+
+
+/* the server could not be contacted, so hold off the entries which are
+ * due now rather than have them fail in turn */
+static void yp_server_failed (struct yp_server *server)
+{
+    ypdata_t *yp = server->mounts;
+
+    while (yp)
     {
-        if (yp->error_msg == NULL)
-            yp->error_msg = strdup ("no response from server");
-        if (yp->process == do_yp_add)
+        if (yp->request == NULL && yp->next_update <= now)
         {
-            ERROR3 ("YP %s on %s failed: %s", cmd, server->url, yp->error_msg);
-            yp->next_update = now + 7200;
+            DEBUG2 ("skiping %s on %s", yp->mount, server->url);
+            yp->process = do_yp_add;
+            yp->next_update = now + 900;
         }
-        if (yp->process == do_yp_touch)
+        yp = yp->next;
+    }
+}
+
+
+/* handler for a completed request, checks if successful handling occurred.
+ * On failure case, update and process are modified
+ */
+static void yp_request_done (yp_request_t *req, CURLcode curlcode)
+{
+    struct yp_server *server = req->server;
+    ypdata_t *yp = req->yp;
+    unsigned latency = (unsigned)(timing_get_time() - req->start_ms);
+    char name [40];
+
+    curl_multi_remove_handle (yp_multi, req->handle);
+    now = time (NULL);
+
+    /* moving average of the response time */
+    if (server->latency_ms)
+        server->latency_ms = (server->latency_ms * 7 + latency) / 8;
+    else
+        server->latency_ms = latency ? latency : 1;
+    snprintf (name, sizeof (name), "yp_server%d_latency_ms", server->id);
+    stats_event_args (NULL, name, "%u", server->latency_ms);
+
+    do
+    {
+        if (yp == NULL)
+            break;
+        if (curlcode)
         {
-            /* At this point the touch request failed, either because they rejected our session
-             * or the server isn't accessible. This means we have to wait before doing another
-             * add request. We have a minimum delay but we could allow the directory server to
-             * give us a wait time using the TouchFreq header. This time could be given in such
-             * cases as a firewall block or incorrect listenurl.
-             */
-            if (yp->touch_interval < 1200)
-                yp->next_update = now + 1200;
-            else
-                yp->next_update = now + yp->touch_interval;
-            INFO3 ("YP %s on %s failed: %s", cmd, server->url, yp->error_msg);
+            yp->process = do_yp_add;
+            yp->next_update = now + 1200;
+            stats_counter_inc (server->failed);
+            ERROR2 ("connection to %s failed with \"%s\"", server->url, req->curl_error);
+            yp_server_failed (server);
+            break;
         }
-        yp->process = do_yp_add;
-        free (yp->sid);
-        yp->sid = NULL;
-        return -1;
+        if (yp->cmd_ok == 0)
+        {
+            stats_counter_inc (server->failed);
+            if (yp->error_msg == NULL)
+                yp->error_msg = strdup ("no response from server");
+            if (req->process == do_yp_add)
+            {
+                ERROR3 ("YP %s on %s failed: %s", req->cmd, server->url, yp->error_msg);
+                yp->next_update = now + 7200;
+            }
+            if (req->process == do_yp_touch)
+            {
+                /* At this point the touch request failed, either because they rejected our session
+                 * or the server isn't accessible. This means we have to wait before doing another
+                 * add request. We have a minimum delay but we could allow the directory server to
+                 * give us a wait time using the TouchFreq header. This time could be given in such
+                 * cases as a firewall block or incorrect listenurl.
+                 */
+                if (yp->touch_interval < 1200)
+                    yp->next_update = now + 1200;
+                else
+                    yp->next_update = now + yp->touch_interval;
+                INFO3 ("YP %s on %s failed: %s", req->cmd, server->url, yp->error_msg);
+            }
+            yp->process = do_yp_add;
+            free (yp->sid);
+            yp->sid = NULL;
+            break;
+        }
+        DEBUG3 ("YP %s at %s succeeded in %ums", req->cmd, server->url, latency);
+        if (req->process == do_yp_add && yp->process == do_yp_add)
+        {
+            yp->process = do_yp_touch;
+            /* force first touch in 5 secs */
+            yp->next_update = now + 5;
+        }
+        if (req->process == do_yp_touch)
+            yp->next_update = now + yp->touch_interval;
+    } while (0);
+
+    if (yp)
+    {
+        /* a remove may have been requested meanwhile */
+        if (yp->release)
+            yp->next_update = 0;
+        if (yp->remove)
+            yp_update = 1;
+    }
+    yp_request_put (req);
+}
+
+
+/* wait up to ms for activity on the requests in progress */
+static void yp_wait (unsigned ms)
+{
+#if LIBCURL_VERSION_NUM >= 0x071c00
+    if (yp_requests == 0)
+    {
+        thread_sleep (ms * 1000);
+        return;
+    }
+    /* not limited to descriptors below FD_SETSIZE, unlike select */
+    curl_multi_wait (yp_multi, NULL, 0, (int)ms, NULL);
+#else
+    fd_set rfds, wfds, efds;
+    int maxfd = -1;
+
+    if (yp_requests == 0)
+    {
+        thread_sleep (ms * 1000);
+        return;
+    }
+    FD_ZERO (&rfds);
+    FD_ZERO (&wfds);
+    FD_ZERO (&efds);
+#if LIBCURL_VERSION_NUM >= 0x070f04
+    {
+        long timeout = -1;
+
+        curl_multi_timeout (yp_multi, &timeout);
+        if (timeout >= 0 && timeout < (long)ms)
+            ms = (unsigned)timeout;
+    }
+#endif
+    if (ms == 0)
+        return;
+    curl_multi_fdset (yp_multi, &rfds, &wfds, &efds, &maxfd);
+    if (maxfd < 0)
+        thread_sleep ((ms < 20 ? ms : 20) * 1000);
+    else
+    {
+        struct timeval tv;
+
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        select (maxfd+1, &rfds, &wfds, &efds, &tv);
+    }
+#endif
+}
+
+
+/* progress the requests in progress and handle those completed */
+static void yp_check_requests (void)
+{
+    CURLMsg *msg;
+    int running, msgs;
+
+    if (yp_requests == 0)
+        return;
+    while (curl_multi_perform (yp_multi, &running) == CURLM_CALL_MULTI_PERFORM)
+        ;
+    while ((msg = curl_multi_info_read (yp_multi, &msgs)))
+    {
+        char *ptr = NULL;
+
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, &ptr);
+        if (ptr)
+            yp_request_done ((yp_request_t *)ptr, msg->data.result);
     }
-    DEBUG2 ("YP %s at %s succeeded", cmd, server->url);
-    return 0;
 }
 
 
@@ -413,14 +714,18 @@ static int do_yp_add (ypdata_t *yp, char *s, unsigned len)
                     yp->server_type, yp->subtype, yp->bitrate, yp->audio_info);
     if (ret >= (signed)len)
         return ret+1;
-    ret = send_to_yp ("add", yp, s);
-    if (ret == 0)
-    {
-        yp->process = do_yp_touch;
-        /* force first touch in 5 secs */
-        yp->next_update = time(NULL) + 5;
-    }
-    return ret;
+    return send_to_yp ("add", yp, s);
+}
+
+
+/* compare with the value last sent, keeping a copy if it differs */
+static int yp_info_changed (char **last, const char *value)
+{
+    if (*last && strcmp (*last, value) == 0)
+        return 0;
+    free (*last);
+    *last = strdup (value);
+    return 1;
 }
 
 
@@ -446,8 +751,11 @@ static int do_yp_touch (ypdata_t *yp, char *s, unsigned len)
          if (song)
          {
              sprintf (song, "%s%s%s", artist, separator, title);
-             add_yp_info(yp, song, YP_CURRENT_SONG);
-             stats_event (yp->mount, "yp_currently_playing", song);
+             if (yp_info_changed (&yp->last_song, song))
+             {
+                 add_yp_info(yp, song, YP_CURRENT_SONG);
+                 stats_event (yp->mount, "yp_currently_playing", song);
+             }
              free (song);
          }
     }
@@ -470,7 +778,8 @@ static int do_yp_touch (ypdata_t *yp, char *s, unsigned len)
     val = stats_get_value (yp->mount, "subtype");
     if (val)
     {
-        add_yp_info (yp, val, YP_SUBTYPE);
+        if (yp_info_changed (&yp->last_subtype, val))
+            add_yp_info (yp, val, YP_SUBTYPE);
         free (val);
     }
 
@@ -481,31 +790,44 @@ static int do_yp_touch (ypdata_t *yp, char *s, unsigned len)
     if (ret >= (signed)len)
         return ret+1; /* space required for above text and nul*/
 
-    if (send_to_yp ("touch", yp, s) == 0)
-    {
-        yp->next_update = now + yp->touch_interval;
-        return 0;
-    }
-    return -1;
+    return send_to_yp ("touch", yp, s);
 }
 
 
 
+/* build and start the next request for the entry if one is due. Returns
+ * 1 if the server has no more requests available, -2 if the server could
+ * not be used and 0 otherwise */
 static int process_ypdata (struct yp_server *server, ypdata_t *yp)
 {
-    unsigned len = 1024;
-    char *s = NULL, *tmp;
+    yp_request_t *req;
+    unsigned len;
 
-    if (now < yp->next_update)
+    if (yp->request || yp->remove || now < yp->next_update)
         return 0;
 
+    req = yp_request_get (server);
+    if (req == NULL)
+        return 1;
+    req->yp = yp;
+    yp->request = req;
+    if (req->post_len < 1024)
+        req->post_len = 1024;
+    len = req->post_len;
+
     /* loop just in case the memory area isn't big enough */
     while (1)
     {
+        char *tmp;
         int ret;
-        if ((tmp = realloc (s, len)) == NULL)
-            return 0;
-        s = tmp;
+
+        if (req->post == NULL || len > req->post_len)
+        {
+            if ((tmp = realloc (req->post, len)) == NULL)
+                break;
+            req->post = tmp;
+            req->post_len = len;
+        }
 
         if (yp->release)
         {
@@ -513,14 +835,17 @@ static int process_ypdata (struct yp_server *server, ypdata_t *yp)
             yp->next_update = 0;
         }
 
-        ret = yp->process (yp, s, len);
+        ret = yp->process (yp, req->post, req->post_len);
         if (ret <= 0)
         {
-           free (s);
-           return ret;
+            /* nothing may of been sent */
+            if (req->started == 0)
+                yp_request_put (req);
+            return ret;
         }
         len = ret;
     }
+    yp_request_put (req);
     return 0;
 }
 
@@ -528,24 +853,23 @@ static int process_ypdata (struct yp_server *server, ypdata_t *yp)
 static void yp_process_server (struct yp_server *server)
 {
     ypdata_t *yp;
-    int state = 0;
 
     /* DEBUG1("processing yp server %s", server->url); */
     yp = server->mounts;
     while (yp)
     {
+        int ret;
+
         now = time (NULL);
-        /* if one of the streams shows that the server cannot be contacted then mark the
-         * other entries for an update later. Assume YP server is dead and skip it for now
-         */
-        if (state == -2)
+        ret = process_ypdata (server, yp);
+        if (ret == -2)
         {
-            DEBUG2 ("skiping %s on %s", yp->mount, server->url);
-            yp->process = do_yp_add;
-            yp->next_update += 900;
+            /* Assume YP server is dead and skip it for now */
+            yp_server_failed (server);
+            break;
         }
-        else
-            state = process_ypdata (server, yp);
+        if (ret)
+            break;  /* no more requests can be started on this server */
         yp = yp->next;
     }
 }
@@ -695,7 +1019,7 @@ static void delete_marked_yp (struct yp_server *server)
 
     while (yp)
     {
-        if (yp->remove)
+        if (yp->remove && yp->request == NULL)
         {
             ypdata_t *to_go = yp;
             DEBUG2 ("removed %s from YP server %s", yp->mount, server->url);
@@ -714,15 +1038,17 @@ static void *yp_update_thread(void *arg)
 {
     INFO0("YP update thread started");
 
+    yp_multi = curl_multi_init ();
     yp_running = 1;
     while (yp_running)
     {
         struct yp_server *server;
 
-        thread_sleep (200000);
+        yp_wait (200);
 
         /* do the YP communication */
         thread_rwlock_rlock (&yp_lock);
+        yp_check_requests ();
         server = (struct yp_server *)active_yps;
         while (server)
         {
@@ -749,6 +1075,12 @@ static void *yp_update_thread(void *arg)
             thread_rwlock_unlock (&yp_lock);
         }
     }
+    /* let any requests in progress complete, they are time limited */
+    while (yp_requests)
+    {
+        yp_wait (200);
+        yp_check_requests ();
+    }
     thread_rwlock_destroy (&yp_lock);
     thread_mutex_destroy (&yp_pending_lock);
     /* free server and ypdata left */
@@ -758,6 +1090,8 @@ static void *yp_update_thread(void *arg)
         active_yps = server->next;
         destroy_yp_server (server);
     }
+    curl_multi_cleanup (yp_multi);
+    yp_multi = NULL;
 
     return NULL;
 }
@@ -804,6 +1138,8 @@ static void yp_destroy_ypdata(ypdata_t *ypdata)
             free(ypdata->audio_info);
         }
         free (ypdata->subtype);
+        free (ypdata->last_song);
+        free (ypdata->last_subtype);
         free (ypdata->error_msg);
         free (ypdata);
     }
@@ -22,6 +22,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 
 
 #ifndef _WIN32
@@ -35,6 +38,14 @@
 #define LOG_MAXLOGS 25
 #define LOG_MAXLINELEN 1024
 
+/* lines queued for the writer thread, must be a power of 2 */
+#define LOG_RING_SLOTS 1024
+#define LOG_BATCH_SIZE 16384
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#define LOG_ASYNC
+#endif
+
 #ifdef _WIN32
 #define mutex_t CRITICAL_SECTION
 #define snprintf _snprintf
@@ -72,15 +83,46 @@ typedef struct log_tag
     log_entry_t *log_head;
     log_entry_t **log_tail;
     
+    /* lines collected by the writer thread before being written out */
     char *buffer;
+    unsigned int buffer_len;
 } log_t;
 
 static log_t loglist[LOG_MAXLOGS];
 
+#ifdef LOG_ASYNC
+/* A bounded multi-producer queue of formatted lines.  A producer claims a
+ * slot by advancing _ring_head, fills it and then publishes it by setting
+ * the slot sequence, the writer thread is the only consumer.  When the ring
+ * is full the line is dropped and counted, logging never blocks.
+ */
+typedef struct log_slot_tag
+{
+    volatile unsigned long sequence;
+    int log_id;
+    time_t when;    /* 0 for lines with no date prefix */
+    unsigned int len;
+    char line [LOG_MAXLINELEN+128];
+} log_slot_t;
+
+static log_slot_t *_ring;
+static volatile unsigned long _ring_head;
+static unsigned long _ring_tail;
+static volatile unsigned long _lines_dropped;
+
+static volatile int _async_running = 0;
+/* producers part way through using the ring */
+static volatile int _ring_users = 0;
+static pthread_t _writer_thread;
+static pthread_mutex_t _writer_mutex;
+static pthread_cond_t _writer_cond;
+#endif
+
 static int _get_log_id(void);
 static void _release_log_id(int log_id);
 static void _lock_logger(void);
 static void _unlock_logger(void);
+static void __vsnprintf(char *str, size_t size, const char *format, va_list ap);
 
 
 static int _log_open (int id)
@@ -327,6 +369,8 @@ void log_close(int log_id)
     loglist[log_id].level = 2;
     if (loglist[log_id].filename) free(loglist[log_id].filename);
     if (loglist[log_id].buffer) free(loglist[log_id].buffer);
+    loglist[log_id].buffer = NULL;
+    loglist[log_id].buffer_len = 0;
 
     if (loglist [log_id] . logfile)
     {
@@ -347,6 +391,12 @@ void log_close(int log_id)
 
 void log_shutdown(void)
 {
+    log_async_stop();
+#ifdef LOG_ASYNC
+    free (_ring);
+    _ring = NULL;
+#endif
+
     /* destroy mutexes */
 #ifndef _WIN32
     pthread_mutex_destroy(&_logger_mutex);
@@ -547,6 +597,289 @@ static void __vsnprintf(char *str, size_t size, const char *format, va_list ap)
     *str = 0;
 }
 
+#ifdef LOG_ASYNC
+/* a producer holds the ring while claiming and filling a slot, returns 0
+ * if lines are to be written directly.  log_async_stop waits for holders
+ * to leave, so the ring and writer can be released after it */
+static int _ring_enter (void)
+{
+    __sync_add_and_fetch (&_ring_users, 1);
+    if (_async_running)
+        return 1;
+    __sync_sub_and_fetch (&_ring_users, 1);
+    return 0;
+}
+
+static void _ring_leave (void)
+{
+    __sync_sub_and_fetch (&_ring_users, 1);
+}
+
+/* reserve the next free slot in the ring, NULL if the ring is full */
+static log_slot_t *_claim_slot (void)
+{
+    unsigned long pos = _ring_head;
+
+    while (1)
+    {
+        log_slot_t *slot = &_ring [pos & (LOG_RING_SLOTS-1)];
+        long diff = (long)(slot->sequence - pos);
+
+        if (diff == 0)
+        {
+            if (__sync_bool_compare_and_swap (&_ring_head, pos, pos+1))
+                return slot;
+        }
+        else if (diff < 0)
+        {
+            __sync_add_and_fetch (&_lines_dropped, 1);
+            return NULL;
+        }
+        pos = _ring_head;
+    }
+}
+
+/* hand a filled slot over to the writer thread */
+static void _publish_slot (log_slot_t *slot, int log_id, time_t when)
+{
+    unsigned long pos = slot->sequence;
+
+    slot->log_id = log_id;
+    slot->when = when;
+    slot->len = strlen (slot->line);
+    __sync_synchronize();
+    slot->sequence = pos + 1;
+    pthread_cond_signal (&_writer_cond);
+}
+
+
+/* write out what the writer thread has collected for this log, the logger
+ * lock must be held */
+static void _log_batch_flush (int log_id)
+{
+    log_t *log = &loglist [log_id];
+
+    if (log->buffer_len == 0)
+        return;
+    if (log->logfile)
+    {
+        fwrite (log->buffer, 1, log->buffer_len, log->logfile);
+        fflush (log->logfile);
+    }
+    log->buffer_len = 0;
+}
+
+
+/* add a complete line to the batch for this log, the logger lock must be
+ * held */
+static void _log_batch_add (int log_id, const char *line, unsigned int len)
+{
+    log_t *log = &loglist [log_id];
+
+    /* a log due to be rotated has to have its pending lines written first */
+    if (log->trigger_level && log->size > log->trigger_level)
+        _log_batch_flush (log_id);
+    if (_log_open (log_id) == 0)
+        return;
+
+    if (log->keep_entries)
+    {
+        log_entry_t *entry = calloc (1, sizeof (log_entry_t));
+        entry->len = len + 1;
+        entry->line = malloc (entry->len);
+        memcpy (entry->line, line, entry->len);
+        log->total += entry->len;
+        *log->log_tail = entry;
+        log->log_tail = &entry->next;
+        if (log->entries >= log->keep_entries)
+        {
+            log_entry_t *to_go = log->log_head;
+            log->log_head = to_go->next;
+            log->total -= to_go->len;
+            free (to_go->line);
+            free (to_go);
+        }
+        else
+            log->entries++;
+    }
+
+    if (log->buffer == NULL)
+    {
+        log->buffer = malloc (LOG_BATCH_SIZE);
+        log->buffer_len = 0;
+        if (log->buffer == NULL)
+            return;
+    }
+    if (log->buffer_len + len > LOG_BATCH_SIZE)
+        _log_batch_flush (log_id);
+    memcpy (log->buffer + log->buffer_len, line, len);
+    log->buffer_len += len;
+    log->size += len;
+}
+
+
+/* Take everything queued in the ring and write it out, returns the number
+ * of lines processed.  The date prefix is only reformatted when the second
+ * changes.
+ */
+static int _log_drain (void)
+{
+    static time_t cached_when = 0;
+    static char cached_date [32];
+    static int cached_len = 0;
+    char line [LOG_MAXLINELEN+128+32+2];
+    int written [LOG_MAXLOGS];
+    int count = 0, i;
+
+    memset (written, 0, sizeof (written));
+    _lock_logger();
+    while (1)
+    {
+        log_slot_t *slot = &_ring [_ring_tail & (LOG_RING_SLOTS-1)];
+        unsigned int len = 0;
+
+        if (slot->sequence != _ring_tail + 1)
+            break;
+        __sync_synchronize();
+        if (slot->when)
+        {
+            if (slot->when != cached_when)
+            {
+                struct tm tm;
+                cached_when = slot->when;
+                localtime_r (&cached_when, &tm);
+                cached_len = strftime (cached_date, sizeof (cached_date), "[%Y-%m-%d  %H:%M:%S]", &tm);
+            }
+            memcpy (line, cached_date, cached_len);
+            len = cached_len;
+        }
+        memcpy (line + len, slot->line, slot->len);
+        len += slot->len;
+        line [len++] = '\n';
+        line [len] = '\0';
+
+        if (slot->log_id >= 0 && slot->log_id < LOG_MAXLOGS && loglist [slot->log_id].in_use)
+        {
+            _log_batch_add (slot->log_id, line, len);
+            written [slot->log_id] = 1;
+        }
+        __sync_synchronize();
+        slot->sequence = _ring_tail + LOG_RING_SLOTS;
+        _ring_tail++;
+        count++;
+    }
+    for (i = 0; i < LOG_MAXLOGS; i++)
+        if (written [i])
+            _log_batch_flush (i);
+    _unlock_logger();
+    return count;
+}
+
+
+static void *_log_writer (void *arg)
+{
+    while (1)
+    {
+        struct timespec ts;
+        struct timeval now;
+
+        if (_log_drain ())
+            continue;
+        if (_async_running == 0)
+            break;
+        /* producers signal after queueing, the timeout covers a signal
+         * sent before we got to wait */
+        gettimeofday (&now, NULL);
+        ts.tv_sec = now.tv_sec;
+        ts.tv_nsec = (now.tv_usec + 100000) * 1000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock (&_writer_mutex);
+        pthread_cond_timedwait (&_writer_cond, &_writer_mutex, &ts);
+        pthread_mutex_unlock (&_writer_mutex);
+    }
+    return NULL;
+}
+#endif
+
+
+/* Hand log writes over to a writer thread, callers then only format the
+ * line into a ring slot.  Returns 0 on success, lines are written directly
+ * if this is not available.
+ */
+int log_async_start (void)
+{
+#ifdef LOG_ASYNC
+    unsigned long i;
+
+    if (_async_running)
+        return 0;
+    if (_ring == NULL)
+    {
+        _ring = calloc (LOG_RING_SLOTS, sizeof (log_slot_t));
+        if (_ring == NULL)
+            return LOG_EINSANE;
+    }
+    for (i = 0; i < LOG_RING_SLOTS; i++)
+        _ring[i].sequence = i;
+    _ring_head = 0;
+    _ring_tail = 0;
+    pthread_mutex_init (&_writer_mutex, NULL);
+    pthread_cond_init (&_writer_cond, NULL);
+    _async_running = 1;
+    if (pthread_create (&_writer_thread, NULL, _log_writer, NULL) != 0)
+    {
+        _async_running = 0;
+        pthread_cond_destroy (&_writer_cond);
+        pthread_mutex_destroy (&_writer_mutex);
+        return LOG_EINSANE;
+    }
+    return 0;
+#else
+    return LOG_ENOTIMPL;
+#endif
+}
+
+
+/* write out anything queued and return to writing lines directly */
+void log_async_stop (void)
+{
+#ifdef LOG_ASYNC
+    if (_async_running == 0)
+        return;
+    _async_running = 0;
+    __sync_synchronize();
+    /* let callers already filling a slot finish, later ones see the flag */
+    while (_ring_users)
+    {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep (&ts, NULL);
+    }
+    pthread_cond_signal (&_writer_cond);
+    pthread_join (_writer_thread, NULL);
+    /* catch lines published just before the writer stopped */
+    _log_drain ();
+    pthread_cond_destroy (&_writer_cond);
+    pthread_mutex_destroy (&_writer_mutex);
+    /* nothing refers to the ring now, log_shutdown can free it */
+#endif
+}
+
+
+/* number of lines lost because the writer thread could not keep up */
+unsigned long log_lines_dropped (void)
+{
+#ifdef LOG_ASYNC
+    return _lines_dropped;
+#else
+    return 0;
+#endif
+}
+
+
 void log_write(int log_id, unsigned priority, const char *cat, const char *func, 
         const char *fmt, ...)
 {
@@ -562,6 +895,28 @@ void log_write(int log_id, unsigned priority, const char *cat, const char *func,
     if (!priority || priority > sizeof(prior)/sizeof(prior[0])) return; /* Bad priority */
 
 
+#ifdef LOG_ASYNC
+    if (_ring_enter())
+    {
+        log_slot_t *slot = _claim_slot();
+        int prelen;
+
+        if (slot)
+        {
+            /* the date is added by the writer thread */
+            prelen = snprintf (slot->line, sizeof (slot->line), " %s %s%s ",
+                    prior [priority-1], cat, func);
+            if (prelen < 0 || prelen >= (int)sizeof (slot->line) - LOG_MAXLINELEN)
+                prelen = 0;
+            va_start(ap, fmt);
+            __vsnprintf(slot->line + prelen, LOG_MAXLINELEN, fmt, ap);
+            va_end(ap);
+            _publish_slot (slot, log_id, time (NULL));
+        }
+        _ring_leave();
+        return;
+    }
+#endif
     va_start(ap, fmt);
     __vsnprintf(line, sizeof(line), fmt, ap);
     va_end(ap);
@@ -588,6 +943,22 @@ void log_write_direct(int log_id, const char *fmt, ...)
 
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
     
+#ifdef LOG_ASYNC
+    if (_ring_enter())
+    {
+        log_slot_t *slot = _claim_slot();
+
+        if (slot)
+        {
+            va_start(ap, fmt);
+            __vsnprintf(slot->line, LOG_MAXLINELEN, fmt, ap);
+            va_end(ap);
+            _publish_slot (slot, log_id, 0);
+        }
+        _ring_leave();
+        return;
+    }
+#endif
     va_start(ap, fmt);
 
     now = time(NULL);
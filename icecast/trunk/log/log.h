@@ -36,6 +36,9 @@ void log_flush(int log_id);
 void log_reopen(int log_id);
 void log_close(int log_id);
 void log_shutdown(void);
+int  log_async_start(void);
+void log_async_stop(void);
+unsigned long log_lines_dropped(void);
 
 void log_write(int log_id, unsigned priority, const char *cat, const char *func, 
         const char *fmt, ...);
@@ -702,7 +702,7 @@ sock_t sock_connect_wto_bind (const char *hostname, int port, const char *bnd, i
 }
 
 
-sock_t sock_get_server_socket (int port, const char *sinterface)
+sock_t sock_get_server_socket_opts (int port, const char *sinterface, int flags)
 {
     struct sockaddr_storage sa;
     struct addrinfo hints, *res, *ai;
@@ -731,6 +731,16 @@ sock_t sock_get_server_socket (int port, const char *sinterface)
             continue;
 
         setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&on, sizeof(on));
+        if (flags & SOCK_REUSEPORT)
+        {
+#ifdef SO_REUSEPORT
+            if (setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&on, sizeof(on)) < 0)
+#endif
+            {
+                sock_close (sock);
+                break;
+            }
+        }
         on = 0;
 #ifdef IPV6_V6ONLY
         setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof on);
@@ -854,7 +864,7 @@ sock_t sock_connect_wto_bind (const char *hostname, int port, const char *bnd, i
 ** interface.  if interface is null, listen on all interfaces.
 ** returns the socket, or SOCK_ERROR on failure
 */
-sock_t sock_get_server_socket(int port, const char *sinterface)
+sock_t sock_get_server_socket_opts(int port, const char *sinterface, int flags)
 {
     struct sockaddr_in sa;
     int error, opt;
@@ -892,6 +902,16 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
     /* reuse it if we can */
     opt = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&opt, sizeof(int));
+    if (flags & SOCK_REUSEPORT)
+    {
+#ifdef SO_REUSEPORT
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&opt, sizeof(int)) < 0)
+#endif
+        {
+            sock_close(sock);
+            return SOCK_ERROR;
+        }
+    }
 
     /* bind socket to port */
     error = bind(sock, (struct sockaddr *)&sa, sizeof (struct sockaddr_in));
@@ -903,6 +923,11 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
 
 #endif
 
+sock_t sock_get_server_socket (int port, const char *sinterface)
+{
+    return sock_get_server_socket_opts (port, sinterface, 0);
+}
+
 void sock_set_send_buffer (sock_t sock, int win_size)
 {
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
@@ -919,31 +944,33 @@ int sock_listen(sock_t serversock, int backlog)
     return (listen(serversock, backlog) == 0);
 }
 
-sock_t sock_accept(sock_t serversock, char *ip, size_t len)
+/* accept a connection, the peer address is left in sa as the system
+ * returned it. len holds the size of sa on entry */
+sock_t sock_accept_addr (sock_t serversock, struct sockaddr *sa, size_t *len)
 {
-#ifdef HAVE_GETNAMEINFO
-    struct sockaddr_storage sa;
-#else    
-    struct sockaddr_in sa;
-#endif
     sock_t ret;
     socklen_t slen;
 
-    if (ip == NULL || len == 0 || !sock_valid_socket(serversock))
+    if (sa == NULL || len == NULL || !sock_valid_socket(serversock))
         return SOCK_ERROR;
 
-    slen = sizeof(sa);
-    ret = accept(serversock, (struct sockaddr *)&sa, &slen);
-
+    slen = (socklen_t)*len;
+#ifdef HAVE_ACCEPT4
+    ret = accept4(serversock, sa, &slen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+    ret = accept(serversock, sa, &slen);
     if (ret != SOCK_ERROR)
     {
-#ifdef HAVE_GETNAMEINFO
-        if (getnameinfo ((struct sockaddr *)&sa, slen, ip, len, NULL, 0, NI_NUMERICHOST))
-            snprintf (ip, len, "unknown");
-#else
-        /* inet_ntoa is not reentrant, we should protect this */
-        strncpy(ip, inet_ntoa(sa.sin_addr), len);
+        sock_set_blocking(ret, 0);
+#ifdef FD_CLOEXEC
+        fcntl(ret, F_SETFD, FD_CLOEXEC);
 #endif
+    }
+#endif
+
+    if (ret != SOCK_ERROR)
+    {
+        *len = slen;
         sock_set_nolinger(ret);
         sock_set_keepalive(ret);
     }
@@ -951,3 +978,39 @@ sock_t sock_accept(sock_t serversock, char *ip, size_t len)
     return ret;
 }
 
+
+/* write the numeric form of the address into ip */
+void sock_addr_ip (const struct sockaddr *sa, size_t salen, char *ip, size_t len)
+{
+    if (ip == NULL || len == 0)
+        return;
+#ifdef HAVE_GETNAMEINFO
+    if (getnameinfo (sa, (socklen_t)salen, ip, len, NULL, 0, NI_NUMERICHOST))
+        snprintf (ip, len, "unknown");
+#else
+    /* inet_ntoa is not reentrant, we should protect this */
+    strncpy(ip, inet_ntoa(((const struct sockaddr_in *)sa)->sin_addr), len);
+#endif
+}
+
+
+sock_t sock_accept(sock_t serversock, char *ip, size_t len)
+{
+#ifdef HAVE_GETNAMEINFO
+    struct sockaddr_storage sa;
+#else    
+    struct sockaddr_in sa;
+#endif
+    size_t slen = sizeof(sa);
+    sock_t ret;
+
+    if (ip == NULL || len == 0)
+        return SOCK_ERROR;
+
+    ret = sock_accept_addr (serversock, (struct sockaddr *)&sa, &slen);
+    if (ret != SOCK_ERROR)
+        sock_addr_ip ((struct sockaddr *)&sa, slen, ip, len);
+
+    return ret;
+}
+
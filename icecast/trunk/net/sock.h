@@ -60,6 +60,8 @@ struct iovec
 #define sock_t int
 #endif
 
+struct sockaddr;
+
 /* The following values are based on unix avoiding errno value clashes */
 #define SOCK_SUCCESS 0
 #define SOCK_ERROR (sock_t)-1
@@ -94,9 +96,12 @@ struct iovec
 # define sock_read_bytes _mangle(sock_read_bytes)
 # define sock_read_line _mangle(sock_read_line)
 # define sock_get_server_socket _mangle(sock_get_server_socket)
+# define sock_get_server_socket_opts _mangle(sock_get_server_socket_opts)
 # define sock_listen _mangle(sock_listen)
 # define sock_set_send_buffer _mangle(sock_set_send_buffer)
 # define sock_accept _mangle(sock_accept)
+# define sock_accept_addr _mangle(sock_accept_addr)
+# define sock_addr_ip _mangle(sock_addr_ip)
 #endif
 
 /* Misc socket functions */
@@ -135,9 +140,15 @@ int sock_read_bytes(sock_t sock, char *buff, size_t len);
 int sock_read_line(sock_t sock, char *string, const int len);
 
 /* server socket functions */
+#define SOCK_REUSEPORT  1   /* allow several sockets to bind the same port */
+
 sock_t sock_get_server_socket(int port, const char *sinterface);
+sock_t sock_get_server_socket_opts(int port, const char *sinterface, int flags);
 int sock_listen(sock_t serversock, int backlog);
+/* accepted sockets are non-blocking and not inherited across exec */
 sock_t sock_accept(sock_t serversock, char *ip, size_t len);
+sock_t sock_accept_addr (sock_t serversock, struct sockaddr *sa, size_t *len);
+void sock_addr_ip (const struct sockaddr *sa, size_t salen, char *ip, size_t len);
 
 #ifdef _WIN32
 int inet_aton(const char *s, struct in_addr *a);
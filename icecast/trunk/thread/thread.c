@@ -515,18 +515,54 @@ void thread_cond_broadcast_c(cond_t *cond, int line, char *file)
     pthread_cond_broadcast(&cond->sys_cond);
 }
 
+static void _cond_abstime(struct timespec *ts, int millis)
+{
+    struct timeval now;
+
+    /* pthread_cond_timedwait wants an absolute time */
+#ifdef _WIN32
+    now.tv_sec = time (NULL);
+    now.tv_usec = 0;
+#else
+    gettimeofday (&now, NULL);
+#endif
+    ts->tv_sec = now.tv_sec + millis/1000;
+    ts->tv_nsec = (now.tv_usec + (millis%1000)*1000) * 1000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
 void thread_cond_timedwait_c(cond_t *cond, int millis, int line, char *file)
 {
     struct timespec time;
 
-    time.tv_sec = millis/1000;
-    time.tv_nsec = (millis - time.tv_sec*1000)*1000000;
-
+    _cond_abstime(&time, millis);
     pthread_mutex_lock(&cond->cond_mutex);
     pthread_cond_timedwait(&cond->sys_cond, &cond->cond_mutex, &time);
     pthread_mutex_unlock(&cond->cond_mutex);
 }
 
+void thread_cond_lock(cond_t *cond)
+{
+    pthread_mutex_lock(&cond->cond_mutex);
+}
+
+void thread_cond_unlock(cond_t *cond)
+{
+    pthread_mutex_unlock(&cond->cond_mutex);
+}
+
+void thread_cond_timedwait_locked(cond_t *cond, int millis)
+{
+    struct timespec time;
+
+    _cond_abstime(&time, millis);
+    pthread_cond_timedwait(&cond->sys_cond, &cond->cond_mutex, &time);
+}
+
 void thread_cond_wait_c(cond_t *cond, int line, char *file)
 {
     pthread_mutex_lock(&cond->cond_mutex);
@@ -666,6 +702,27 @@ static void *_start_routine(void *arg)
     return NULL;
 }
 
+void thread_key_create(thread_key_t *key, void (*destructor)(void *))
+{
+    if (pthread_key_create(&key->sys_key, destructor))
+        abort();
+}
+
+void thread_key_destroy(thread_key_t *key)
+{
+    pthread_key_delete(key->sys_key);
+}
+
+void *thread_key_get(thread_key_t *key)
+{
+    return pthread_getspecific(key->sys_key);
+}
+
+void thread_key_set(thread_key_t *key, void *value)
+{
+    pthread_setspecific(key->sys_key, value);
+}
+
 thread_type *thread_self(void)
 {
     avl_node *node;
@@ -735,6 +792,12 @@ void thread_library_unlock(void)
     _mutex_unlock(&_library_mutex);
 }
 
+unsigned long thread_atomic_unlock(unsigned long value)
+{
+    _mutex_unlock(&_library_mutex);
+    return value;
+}
+
 void thread_join(thread_type *thread)
 {
     void *ret;
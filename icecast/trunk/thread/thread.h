@@ -89,6 +89,11 @@ typedef struct {
     pthread_rwlock_t sys_rwlock;
 } rwlock_t;
 
+/* a value kept separately for each thread */
+typedef struct {
+    pthread_key_t sys_key;
+} thread_key_t;
+
 #ifdef HAVE_PTHREAD_SPIN_LOCK
 typedef struct
 {
@@ -115,13 +120,25 @@ typedef mutex_t spin_t;
 #define thread_cond_signal(x) thread_cond_signal_c(x,__LINE__,__FILE__)
 #define thread_cond_broadcast(x) thread_cond_broadcast_c(x,__LINE__,__FILE__)
 #define thread_cond_wait(x) thread_cond_wait_c(x,__LINE__,__FILE__)
-#define thread_cond_timedwait(x,t) thread_cond_wait_c(x,t,__LINE__,__FILE__)
+#define thread_cond_timedwait(x,t) thread_cond_timedwait_c(x,t,__LINE__,__FILE__)
 #define thread_rwlock_create(x) thread_rwlock_create_c(x,__LINE__,__FILE__)
 #define thread_rwlock_rlock(x) thread_rwlock_rlock_c(x,__LINE__,__FILE__)
 #define thread_rwlock_wlock(x) thread_rwlock_wlock_c(x,__LINE__,__FILE__)
 #define thread_rwlock_unlock(x) thread_rwlock_unlock_c(x,__LINE__,__FILE__)
 #define thread_exit(x) thread_exit_c(x,__LINE__,__FILE__)
 
+/* atomic updates of counters shared between threads, the add and sub forms
+ * evaluate to the updated value */
+#if defined(__GNUC__)
+#define thread_atomic_add(x,v)  __sync_add_and_fetch((x),(v))
+#define thread_atomic_sub(x,v)  __sync_sub_and_fetch((x),(v))
+#define thread_atomic_barrier() __sync_synchronize()
+#else
+#define thread_atomic_add(x,v)  (thread_library_lock(), *(x) += (v), thread_atomic_unlock(*(x)))
+#define thread_atomic_sub(x,v)  (thread_library_lock(), *(x) -= (v), thread_atomic_unlock(*(x)))
+#define thread_atomic_barrier() (thread_library_lock(), thread_library_unlock())
+#endif
+
 #define MUTEX_STATE_NOTLOCKED -1
 #define MUTEX_STATE_NEVERLOCKED -2
 #define MUTEX_STATE_UNINIT -3
@@ -143,6 +160,9 @@ typedef mutex_t spin_t;
 # define thread_cond_wait_c _mangle(thread_cond_wait_c)
 # define thread_cond_timedwait_c _mangle(thread_cond_timedwait_c)
 # define thread_cond_destroy _mangle(thread_cond_destroy)
+# define thread_cond_lock _mangle(thread_cond_lock)
+# define thread_cond_unlock _mangle(thread_cond_unlock)
+# define thread_cond_timedwait_locked _mangle(thread_cond_timedwait_locked)
 # define thread_rwlock_create_c _mangle(thread_rwlock_create_c)
 # define thread_rwlock_rlock_c _mangle(thread_rwlock_rlock_c)
 # define thread_rwlock_wlock_c _mangle(thread_rwlock_wlock_c)
@@ -152,9 +172,14 @@ typedef mutex_t spin_t;
 # define thread_sleep _mangle(thread_sleep)
 # define thread_library_lock _mangle(thread_library_lock)
 # define thread_library_unlock _mangle(thread_library_unlock)
+# define thread_atomic_unlock _mangle(thread_atomic_unlock)
 # define thread_self _mangle(thread_self)
 # define thread_rename _mangle(thread_rename)
 # define thread_join _mangle(thread_join)
+# define thread_key_create _mangle(thread_key_create)
+# define thread_key_destroy _mangle(thread_key_destroy)
+# define thread_key_get _mangle(thread_key_get)
+# define thread_key_set _mangle(thread_key_set)
 #endif
 
 /* init/shutdown of the library */
@@ -175,6 +200,11 @@ void thread_cond_broadcast_c(cond_t *cond, int line, char *file);
 void thread_cond_wait_c(cond_t *cond, int line, char *file);
 void thread_cond_timedwait_c(cond_t *cond, int millis, int line, char *file);
 void thread_cond_destroy(cond_t *cond);
+/* for waiting on a condition, the flag or queue checked is changed and
+ * read with the cond lock held, and the locked wait is called with it held */
+void thread_cond_lock(cond_t *cond);
+void thread_cond_unlock(cond_t *cond);
+void thread_cond_timedwait_locked(cond_t *cond, int millis);
 void thread_rwlock_create_c(rwlock_t *rwlock, int line, char *file);
 void thread_rwlock_rlock_c(rwlock_t *rwlock, int line, char *file);
 void thread_rwlock_wlock_c(rwlock_t *rwlock, int line, char *file);
@@ -182,6 +212,13 @@ void thread_rwlock_unlock_c(rwlock_t *rwlock, int line, char *file);
 void thread_rwlock_destroy(rwlock_t *rwlock);
 void thread_exit_c(long val, int line, char *file);
 
+/* per thread values, the destructor is called on exit of each thread which
+ * set a value */
+void thread_key_create(thread_key_t *key, void (*destructor)(void *));
+void thread_key_destroy(thread_key_t *key);
+void *thread_key_get(thread_key_t *key);
+void thread_key_set(thread_key_t *key, void *value);
+
 /* sleeping */
 void thread_sleep(unsigned long len);
 
@@ -190,6 +227,9 @@ void thread_library_lock(void);
 void thread_library_unlock(void);
 #define PROTECT_CODE(code) { thread_library_lock(); code; thread_library_unlock(); }
 
+/* releases the library lock, passing back the value read under it */
+unsigned long thread_atomic_unlock(unsigned long value);
+
 /* thread information functions */
 thread_type *thread_self(void);
 
@@ -0,0 +1,165 @@
+/* timer.c
+** - Timer wheel
+**
+** This program is distributed under the GNU General Public License, version 2.
+** A copy of this license is included with this source.
+*/
+
+#ifdef HAVE_CONFIG_H
+ #include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer.h"
+
+/* see timing.h for an explanation of _mangle() */
+
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN(l) ((uint64_t)1 << (TIMER_WHEEL_BITS * (l)))
+#define TIMER_WHEEL_MAX     (TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS) - 1)
+
+
+void timer_wheel_init (timer_wheel_t *wheel, uint64_t now, unsigned int tick)
+{
+    memset (wheel, 0, sizeof (*wheel));
+    wheel->origin = now;
+    wheel->tick = tick ? tick : 1;
+}
+
+
+/* put the timer on the level that covers its distance from now.  A
+ * deadline beyond the wheel is parked as far out as possible and linked
+ * again from there when reached */
+static void _wheel_link (timer_wheel_t *wheel, timer_entry_t *timer)
+{
+    uint64_t delta = 0;
+    timer_entry_t **slot;
+    int level;
+
+    /* a timer cascaded down may be due on the tick being processed */
+    if (timer->deadline > wheel->now)
+        delta = timer->deadline - wheel->now;
+    if (delta > TIMER_WHEEL_MAX)
+        delta = TIMER_WHEEL_MAX;
+    timer->expires = wheel->now + delta;
+    for (level = 0; level < TIMER_WHEEL_LEVELS-1; level++)
+        if (delta < TIMER_WHEEL_SPAN(level+1))
+            break;
+
+    slot = &wheel->slots [level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+    timer->next = *slot;
+    if (timer->next)
+        timer->next->prev = &timer->next;
+    timer->prev = slot;
+    *slot = timer;
+}
+
+
+static void _wheel_unlink (timer_entry_t *timer)
+{
+    *timer->prev = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+
+/* schedule the timer to fire at when (in ms), rescheduling it if it is
+ * already pending */
+void timer_wheel_add (timer_wheel_t *wheel, timer_entry_t *timer, uint64_t when)
+{
+    if (timer_entry_pending (timer))
+        timer_wheel_cancel (wheel, timer);
+    if (when < wheel->origin)
+        when = wheel->origin;
+    /* round up so a timer never fires early */
+    timer->deadline = (when - wheel->origin + wheel->tick - 1) / wheel->tick;
+    if (timer->deadline <= wheel->now)
+        timer->deadline = wheel->now + 1;
+    _wheel_link (wheel, timer);
+    wheel->pending++;
+}
+
+
+void timer_wheel_cancel (timer_wheel_t *wheel, timer_entry_t *timer)
+{
+    if (timer_entry_pending (timer) == 0)
+        return;
+    _wheel_unlink (timer);
+    wheel->pending--;
+}
+
+
+/* move the timers in a slot of an upper level down to where they now belong,
+ * returns the slot index so the caller knows whether to carry on up */
+static unsigned int _wheel_cascade (timer_wheel_t *wheel, int level)
+{
+    unsigned int index = (wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer_entry_t *timer = wheel->slots [level][index];
+
+    wheel->slots [level][index] = NULL;
+    while (timer)
+    {
+        timer_entry_t *next = timer->next;
+        _wheel_link (wheel, timer);
+        timer = next;
+    }
+    return index;
+}
+
+
+/* Run the callbacks of all the timers due by now (in ms), returns the
+ * number of timers fired.
+ */
+int timer_wheel_advance (timer_wheel_t *wheel, uint64_t now)
+{
+    uint64_t target;
+    int fired = 0;
+
+    if (now < wheel->origin)
+        return 0;
+    target = (now - wheel->origin) / wheel->tick;
+
+    while (wheel->now < target)
+    {
+        timer_entry_t *timer, **slot;
+        int level;
+
+        /* nothing pending so just catch up */
+        if (wheel->pending == 0)
+        {
+            wheel->now = target;
+            break;
+        }
+        wheel->now++;
+        /* each time a level wraps, the next slot up is spread out below */
+        if ((wheel->now & TIMER_WHEEL_MASK) == 0)
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+                if (_wheel_cascade (wheel, level) != 0)
+                    break;
+
+        slot = &wheel->slots [0][wheel->now & TIMER_WHEEL_MASK];
+        while ((timer = *slot) != NULL)
+        {
+            int again;
+
+            _wheel_unlink (timer);
+            if (timer->deadline > wheel->now)
+            {
+                /* only reached the end of the wheel, not the deadline */
+                _wheel_link (wheel, timer);
+                continue;
+            }
+            wheel->pending--;
+            fired++;
+            again = timer->callback (timer);
+            if (again > 0 && timer_entry_pending (timer) == 0)
+                timer_wheel_add (wheel, timer,
+                        wheel->origin + wheel->now * wheel->tick + again);
+        }
+    }
+    return fired;
+}
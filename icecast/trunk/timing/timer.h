@@ -0,0 +1,62 @@
+/*
+** Timer wheel.
+**
+** This program is distributed under the GNU General Public License, version 2.
+** A copy of this license is included with this source.
+*/
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include "timing.h"
+
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+
+/* A timer is embedded in whatever it times out.  The callback returns the
+ * number of milliseconds until it should fire again, or 0 to stop.
+ */
+typedef struct timer_entry_tag
+{
+    uint64_t deadline;  /* in ticks */
+    uint64_t expires;   /* tick of the slot it is in, before the deadline
+                         * if that is further away than the wheel covers */
+    int (*callback)(struct timer_entry_tag *timer);
+    void *arg;
+
+    struct timer_entry_tag *next;
+    struct timer_entry_tag **prev;
+} timer_entry_t;
+
+/* Hierarchical wheel of timers, adding, cancelling and expiring a timer
+ * are constant time no matter how many are pending.  The wheel does no
+ * locking of its own.
+ */
+typedef struct timer_wheel_tag
+{
+    uint64_t now;       /* last tick processed */
+    uint64_t origin;    /* time in ms of tick 0 */
+    unsigned int tick;  /* ms per tick */
+    unsigned int pending;
+
+    timer_entry_t *slots [TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+#ifdef _mangle
+# define timer_wheel_init _mangle(timer_wheel_init)
+# define timer_wheel_add _mangle(timer_wheel_add)
+# define timer_wheel_cancel _mangle(timer_wheel_cancel)
+# define timer_wheel_advance _mangle(timer_wheel_advance)
+#endif
+
+#define timer_entry_init(t,cb,a)    do { (t)->callback = (cb); (t)->arg = (a); \
+                                         (t)->next = NULL; (t)->prev = NULL; } while (0)
+#define timer_entry_pending(t)      ((t)->prev != NULL)
+
+void timer_wheel_init (timer_wheel_t *wheel, uint64_t now, unsigned int tick);
+void timer_wheel_add (timer_wheel_t *wheel, timer_entry_t *timer, uint64_t when);
+void timer_wheel_cancel (timer_wheel_t *wheel, timer_entry_t *timer);
+int  timer_wheel_advance (timer_wheel_t *wheel, uint64_t now);
+
+#endif  /* __TIMER_H__ */